@@ -0,0 +1,502 @@
+/*
+  ==============================================================================
+
+    DatasetReader.cpp
+
+  ==============================================================================
+*/
+
+#include "DatasetReader.h"
+
+namespace
+{
+    inline int readLittleEndianInt24 (const unsigned char* bytes)
+    {
+        return int (uint32 (bytes[0]) << 8 | uint32 (bytes[1]) << 16 | uint32 (bytes[2]) << 24) >> 8;
+    }
+
+    // Converts one channel of interleaved samples, adding gain * sample to
+    // the destination.
+    template <class SampleType>
+    void accumulate (const char* data, int stride, int count, float gain, float* destination)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            SampleType value;
+            memcpy (&value, data + i * stride, sizeof (SampleType));
+            destination[i] += gain * float (value);
+        }
+    }
+}
+
+//==============================================================================
+class DatasetReader::PrefetchJob : public ThreadPoolJob
+{
+public:
+    PrefetchJob (const DatasetReader&    r,
+                 int                     t,
+                 const std::vector<int>& s,
+                 int64                   start,
+                 int                     n,
+                 float*                  dest) :
+        ThreadPoolJob ("DatasetReader prefetch"),
+        reader (r),
+        track (t),
+        streams (s),
+        startFrame (start),
+        length (n),
+        destination (dest),
+        result (false)
+    {
+    }
+
+    JobStatus runJob() override
+    {
+        result = reader.read (track, streams, startFrame, length, destination);
+        return jobHasFinished;
+    }
+
+    bool getResult() const {
+        return result;
+    };
+
+private:
+    const DatasetReader& reader;
+    int                  track;
+    std::vector<int>     streams;
+    int64                startFrame;
+    int                  length;
+    float*               destination;
+    bool                 result;
+};
+
+//==============================================================================
+DatasetReader::DatasetReader (int numThreads) :
+    pool (numThreads > 0 ? numThreads : SystemStats::getNumCpus()),
+    nextTicket (0)
+{
+}
+
+DatasetReader::~DatasetReader()
+{
+    // The jobs are owned here, so they have to be done before they go.
+    cancelAllPrefetches();
+}
+
+//==============================================================================
+bool DatasetReader::open (const File& root)
+{
+    cancelAllPrefetches();
+    tracks.clear();
+
+    Array<File> directories;
+    root.findChildFiles (directories, File::findDirectories, false);
+    directories.sort();
+
+    for (const File& directory : directories)
+    {
+        std::unique_ptr<Track> track (new Track());
+        track->name = directory.getFileName();
+        track->sampleRate = 0.0;
+        track->numFrames = 0;
+
+        const File containerFile = directory.getChildFile ("stems.slkh");
+        if (containerFile.existsAsFile())
+        {
+            track->container.reset (new StemContainer());
+            if (track->container->open (containerFile))
+            {
+                track->streamNames = track->container->getNames();
+                track->sampleRate = track->container->getSampleRate();
+                track->numFrames = track->container->getNumFrames();
+                tracks.push_back (std::move (track));
+                continue;
+            }
+            track->container = nullptr;
+        }
+
+        Array<File> files;
+        const File mix = directory.getChildFile ("mix.wav");
+        if (mix.existsAsFile())
+            files.add (mix);
+
+        Array<File> stems;
+        directory.getChildFile ("stems").findChildFiles (stems, File::findFiles, false, "*.wav");
+        stems.sort();
+        files.addArray (stems);
+
+        for (const File& file : files)
+        {
+            std::unique_ptr<WavStream> stream (new WavStream());
+            double rate = 0.0;
+            if (! mapWav (file, *stream, rate))
+            {
+                std::cout << "DatasetReader::open error: Skipping "
+                << file.getFullPathName().toStdString() << ", which is not a readable wav file." << std::endl;
+                continue;
+            }
+
+            if (track->sampleRate == 0.0)
+                track->sampleRate = rate;
+            else if (rate != track->sampleRate)
+                std::cout << "DatasetReader::open error: " << file.getFullPathName().toStdString()
+                << " does not match the sample rate of the rest of its track." << std::endl;
+
+            track->streamNames.add (file == mix ? String ("mix") : file.getFileNameWithoutExtension());
+            track->numFrames = jmax (track->numFrames, stream->numFrames);
+            track->wavs.push_back (std::move (stream));
+        }
+
+        if (! track->wavs.empty())
+            tracks.push_back (std::move (track));
+    }
+
+    for (auto& track : tracks)
+        loadMixGains (root.getChildFile (track->name), *track);
+
+    if (tracks.empty())
+    {
+        std::cout << "DatasetReader::open error: No tracks found in "
+        << root.getFullPathName().toStdString() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//==============================================================================
+String DatasetReader::getTrackName (int track) const
+{
+    return isPositiveAndBelow (track, getNumTracks()) ? tracks[size_t (track)]->name : String();
+}
+
+StringArray DatasetReader::getStreamNames (int track) const
+{
+    return isPositiveAndBelow (track, getNumTracks()) ? tracks[size_t (track)]->streamNames : StringArray();
+}
+
+int64 DatasetReader::getNumFrames (int track) const
+{
+    return isPositiveAndBelow (track, getNumTracks()) ? tracks[size_t (track)]->numFrames : 0;
+}
+
+double DatasetReader::getSampleRate (int track) const
+{
+    return isPositiveAndBelow (track, getNumTracks()) ? tracks[size_t (track)]->sampleRate : 0.0;
+}
+
+//==============================================================================
+bool DatasetReader::isValidRequest (int track, const std::vector<int>& streams, int length) const
+{
+    if (! isPositiveAndBelow (track, getNumTracks()))
+    {
+        std::cout << "DatasetReader::read error: Track " << track << " does not exist." << std::endl;
+        return false;
+    }
+
+    for (const int s : streams)
+    {
+        if (! isPositiveAndBelow (s, tracks[size_t (track)]->streamNames.size()))
+        {
+            std::cout << "DatasetReader::read error: Stream " << s << " does not exist in track "
+            << tracks[size_t (track)]->name.toStdString() << "." << std::endl;
+            return false;
+        }
+    }
+    return length >= 0;
+}
+
+bool DatasetReader::read (int                     track,
+                          const std::vector<int>& streams,
+                          int64                   startFrame,
+                          int                     length,
+                          float*                  destination) const
+{
+    if (! isValidRequest (track, streams, length))
+        return false;
+
+    const Track& t = *tracks[size_t (track)];
+    if (t.container != nullptr)
+        return t.container->read (startFrame, length, streams, destination);
+
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        float* const row = destination + i * size_t (length);
+        FloatVectorOperations::clear (row, length);
+        addWav (*t.wavs[size_t (streams[i])], startFrame, length, 1.0f, row);
+    }
+    return true;
+}
+
+//==============================================================================
+bool DatasetReader::remix (int                     track,
+                           const std::vector<int>& streams,
+                           int64                   startFrame,
+                           int                     length,
+                           float                   gainRangeDecibels,
+                           float                   dropoutProbability,
+                           bool                    randomPolarity,
+                           Random&                 random,
+                           float*                  destination,
+                           std::vector<float>&     appliedGains) const
+{
+    if (! isValidRequest (track, streams, length))
+        return false;
+
+    const Track& t = *tracks[size_t (track)];
+
+    std::vector<int> sources = streams;
+    if (sources.empty())
+        for (int s = 0; s < t.streamNames.size(); ++s)
+            if (t.streamNames[s] != "mix")
+                sources.push_back (s);
+
+    appliedGains.clear();
+    bool anyKept = false;
+    for (const int s : sources)
+    {
+        float gain = t.mixGains[size_t (s)];
+        if (gainRangeDecibels > 0.0f)
+            gain *= Decibels::decibelsToGain (gainRangeDecibels * (2.0f * random.nextFloat() - 1.0f));
+        if (randomPolarity && random.nextBool())
+            gain = -gain;
+        if (dropoutProbability > 0.0f && random.nextFloat() < dropoutProbability)
+            gain = 0.0f;
+
+        anyKept = anyKept || gain != 0.0f;
+        appliedGains.push_back (gain);
+    }
+
+    // Dropout never leaves a silent mix: bring one source back.
+    if (! anyKept && ! sources.empty() && dropoutProbability > 0.0f)
+    {
+        const size_t kept = size_t (random.nextInt (int (sources.size())));
+        appliedGains[kept] = t.mixGains[size_t (sources[kept])];
+    }
+
+    FloatVectorOperations::clear (destination, length);
+
+    std::vector<float> scratch;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (appliedGains[i] == 0.0f)
+            continue;
+
+        if (t.container == nullptr)
+        {
+            addWav (*t.wavs[size_t (sources[i])], startFrame, length, appliedGains[i], destination);
+            continue;
+        }
+
+        scratch.resize (size_t (length));
+        if (! t.container->read (startFrame, length, std::vector<int> (1, sources[i]), scratch.data()))
+            return false;
+        FloatVectorOperations::addWithMultiply (destination, scratch.data(), appliedGains[i], length);
+    }
+    return true;
+}
+
+const std::vector<float>& DatasetReader::getMixGains (int track) const
+{
+    static const std::vector<float> none;
+    return isPositiveAndBelow (track, getNumTracks()) ? tracks[size_t (track)]->mixGains : none;
+}
+
+//==============================================================================
+int64 DatasetReader::prefetch (int                     track,
+                               const std::vector<int>& streams,
+                               int64                   startFrame,
+                               int                     length,
+                               float*                  destination)
+{
+    if (! isValidRequest (track, streams, length))
+        return -1;
+
+    std::unique_ptr<PrefetchJob> job (new PrefetchJob (*this, track, streams, startFrame, length, destination));
+    PrefetchJob* const jobPointer = job.get();
+
+    int64 ticket;
+    {
+        const ScopedLock sl (jobLock);
+        ticket = nextTicket++;
+        jobs[ticket] = std::move (job);
+    }
+
+    pool.addJob (jobPointer, false);
+    return ticket;
+}
+
+bool DatasetReader::waitForPrefetch (int64 ticket)
+{
+    PrefetchJob* job = nullptr;
+    {
+        const ScopedLock sl (jobLock);
+        auto found = jobs.find (ticket);
+        if (found == jobs.end())
+            return false;
+        job = found->second.get();
+    }
+
+    pool.waitForJobToFinish (job, -1);
+
+    const ScopedLock sl (jobLock);
+    const bool result = job->getResult();
+    jobs.erase (ticket);
+    return result;
+}
+
+void DatasetReader::waitForAllPrefetches()
+{
+    std::vector<std::pair<int64, PrefetchJob*>> queued;
+    {
+        const ScopedLock sl (jobLock);
+        for (auto& job : jobs)
+            queued.push_back ({ job.first, job.second.get() });
+    }
+
+    for (auto& job : queued)
+        pool.waitForJobToFinish (job.second, -1);
+
+    const ScopedLock sl (jobLock);
+    for (auto& job : queued)
+        jobs.erase (job.first);
+}
+
+void DatasetReader::cancelAllPrefetches()
+{
+    pool.removeAllJobs (false, -1, nullptr);
+
+    const ScopedLock sl (jobLock);
+    jobs.clear();
+}
+
+//==============================================================================
+void DatasetReader::loadMixGains (const File& directory, Track& track)
+{
+    track.mixGains.assign (size_t (track.streamNames.size()), 1.0f);
+
+    const File file = directory.getChildFile ("mix_gains.json");
+    if (! file.existsAsFile())
+        return;
+
+    const var gains = JSON::parse (file);
+    if (gains.getDynamicObject() == nullptr)
+    {
+        std::cout << "DatasetReader::open error: " << file.getFullPathName().toStdString()
+        << " is not a JSON object of stream name to gain." << std::endl;
+        return;
+    }
+
+    for (int s = 0; s < track.streamNames.size(); ++s)
+        if (gains.hasProperty (track.streamNames[s]))
+            track.mixGains[size_t (s)] = float (double (gains[Identifier (track.streamNames[s])]));
+}
+
+//==============================================================================
+bool DatasetReader::mapWav (const File& file, WavStream& stream, double& sampleRate)
+{
+    stream.file.reset (new MemoryMappedFile (file, MemoryMappedFile::readOnly));
+    const char* const bytes = static_cast<const char*> (stream.file->getData());
+    const int64 size = int64 (stream.file->getSize());
+
+    if (bytes == nullptr || size < 12
+        || memcmp (bytes, "RIFF", 4) != 0 || memcmp (bytes + 8, "WAVE", 4) != 0)
+        return false;
+
+    int formatTag = 0;
+    int blockAlign = 0;
+    bool foundFormat = false;
+    stream.data = nullptr;
+
+    for (int64 position = 12; position + 8 <= size;)
+    {
+        const int64 chunkSize = int64 (ByteOrder::littleEndianInt (bytes + position + 4));
+        const char* const chunk = bytes + position + 8;
+        const int64 available = jmin (chunkSize, size - position - 8);
+
+        if (memcmp (bytes + position, "fmt ", 4) == 0 && available >= 16)
+        {
+            formatTag = ByteOrder::littleEndianShort (chunk);
+            stream.numChannels = ByteOrder::littleEndianShort (chunk + 2);
+            sampleRate = double (ByteOrder::littleEndianInt (chunk + 4));
+            blockAlign = ByteOrder::littleEndianShort (chunk + 12);
+            stream.bitsPerSample = ByteOrder::littleEndianShort (chunk + 14);
+
+            // WAVE_FORMAT_EXTENSIBLE keeps the real format in its sub format.
+            if (formatTag == 0xfffe && available >= 26)
+                formatTag = ByteOrder::littleEndianShort (chunk + 24);
+
+            foundFormat = true;
+        }
+        else if (memcmp (bytes + position, "data", 4) == 0)
+        {
+            // Writers that never patched the size leave it at zero or ~0.
+            stream.data = chunk;
+            stream.numFrames = (chunkSize == 0 || chunkSize == 0xffffffff) ? size - position - 8 : available;
+            break;
+        }
+
+        position += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    if (! foundFormat || stream.data == nullptr || stream.numChannels <= 0)
+        return false;
+
+    stream.isFloat = formatTag == 3;
+    const bool supported = stream.isFloat ? stream.bitsPerSample == 32
+                                          : (formatTag == 1 && (stream.bitsPerSample == 16
+                                                                || stream.bitsPerSample == 24
+                                                                || stream.bitsPerSample == 32));
+    if (! supported || blockAlign != stream.numChannels * stream.bitsPerSample / 8)
+        return false;
+
+    stream.numFrames /= blockAlign;
+    return true;
+}
+
+//==============================================================================
+void DatasetReader::addWav (const WavStream& stream, int64 startFrame, int length, float gain, float* destination)
+{
+    const int64 first = jmax (int64 (0), startFrame);
+    const int64 last = jmin (stream.numFrames, startFrame + length);
+    if (first >= last)
+        return;
+
+    const int count = int (last - first);
+    const int bytesPerSample = stream.bitsPerSample / 8;
+    const int stride = stream.numChannels * bytesPerSample;
+    float* const output = destination + (first - startFrame);
+    const char* const frames = stream.data + first * stride;
+
+    // Mono float and 16 bit files, the usual output of the render, are one
+    // vectorised pass over the mapping.
+    if (stream.numChannels == 1 && stream.isFloat)
+    {
+        FloatVectorOperations::addWithMultiply (output, reinterpret_cast<const float*> (frames), gain, count);
+        return;
+    }
+    if (stream.numChannels == 1 && stream.bitsPerSample == 16)
+    {
+        const int16* const samples = reinterpret_cast<const int16*> (frames);
+        const float scale = gain / 32768.0f;
+        for (int i = 0; i < count; ++i)
+            output[i] += scale * float (samples[i]);
+        return;
+    }
+
+    const float channelGain = gain / float (stream.numChannels);
+    for (int c = 0; c < stream.numChannels; ++c)
+    {
+        const char* const channel = frames + c * bytesPerSample;
+
+        if (stream.isFloat)
+            accumulate<float> (channel, stride, count, channelGain, output);
+        else if (stream.bitsPerSample == 16)
+            accumulate<int16> (channel, stride, count, channelGain / 32768.0f, output);
+        else if (stream.bitsPerSample == 32)
+            accumulate<int32> (channel, stride, count, channelGain / 2147483648.0f, output);
+        else
+            for (int i = 0; i < count; ++i)
+                output[i] += channelGain / 8388608.0f
+                             * float (readLittleEndianInt24 (reinterpret_cast<const unsigned char*> (channel + i * stride)));
+    }
+}
@@ -0,0 +1,146 @@
+/*
+  ==============================================================================
+
+    DatasetReader.h
+
+  ==============================================================================
+*/
+
+#ifndef DATASETREADER_H_INCLUDED
+#define DATASETREADER_H_INCLUDED
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "StemContainer.h"
+
+//==============================================================================
+// Random access to the windows of a rendered dataset for training loaders.
+//
+// open() indexes every track directory below a root once. A track is either
+// a stems.slkh container or mix.wav plus stems/*.wav, and its streams are
+// numbered in that order: the mix first (if there is one), then the stems
+// sorted by name. Every file stays memory mapped, so serving a window is a
+// single conversion from the mapped samples into the caller's buffer, with
+// no file opens and no intermediate copies.
+//
+// Windows can also be requested ahead of time. prefetch() queues the read on
+// a pool of threads that write straight into the destination given, and
+// waitForPrefetch() blocks until it is there.
+//
+// remix() sums stems straight from the mappings with their stored mix gains,
+// so a mix (or an augmented one) never has to exist on disk.
+class DatasetReader
+{
+public:
+    // Uses one prefetch thread per hardware thread if numThreads is zero or
+    // less.
+    DatasetReader (int numThreads = 2);
+    ~DatasetReader();
+
+    // Replaces the current index. Returns false if no track was found.
+    bool open (const File& root);
+
+    int getNumTracks() const {
+        return int (tracks.size());
+    };
+
+    String getTrackName (int track) const;
+    StringArray getStreamNames (int track) const;
+    int64 getNumFrames (int track) const;
+    double getSampleRate (int track) const;
+
+    // Reads frames [startFrame, startFrame + length) of the given streams of
+    // a track into a row major streams.size() x length array. Streams with
+    // more than one channel are averaged to mono, and frames outside a
+    // stream are zero. Safe to call from several threads at once.
+    bool read (int                     track,
+               const std::vector<int>& streams,
+               int64                   startFrame,
+               int                     length,
+               float*                  destination) const;
+
+    // Mixes a window of the given streams, or of every stream but "mix" if
+    // streams is empty, into a mono destination of length samples. Each
+    // stream is scaled by its mix gain, then optionally by a random gain of
+    // up to +-gainRangeDecibels and a random polarity flip, and dropped with
+    // the given probability (never all of them). appliedGains receives the
+    // final gain of each stream so the targets can be scaled to match.
+    bool remix (int                     track,
+                const std::vector<int>& streams,
+                int64                   startFrame,
+                int                     length,
+                float                   gainRangeDecibels,
+                float                   dropoutProbability,
+                bool                    randomPolarity,
+                Random&                 random,
+                float*                  destination,
+                std::vector<float>&     appliedGains) const;
+
+    // The gain of every stream of a track in the stored mix, read from the
+    // track's mix_gains.json ({"S00": 0.5, ...}) when it has one and 1
+    // otherwise.
+    const std::vector<float>& getMixGains (int track) const;
+
+    // Queues read() with the same arguments on the prefetch threads and
+    // returns a ticket for waitForPrefetch(), or -1 if the arguments are
+    // invalid. destination must stay valid until the ticket is waited for.
+    int64 prefetch (int                     track,
+                    const std::vector<int>& streams,
+                    int64                   startFrame,
+                    int                     length,
+                    float*                  destination);
+
+    // Blocks until a prefetched window has been written and forgets the
+    // ticket. Returns the result of its read().
+    bool waitForPrefetch (int64 ticket);
+
+    // Blocks until every queued prefetch has been written and forgets
+    // their tickets.
+    void waitForAllPrefetches();
+
+protected:
+    // Drops the prefetches that have not started, waits for the running
+    // ones and forgets every ticket, so no job writes to its destination
+    // any more.
+    void cancelAllPrefetches();
+
+private:
+    struct WavStream
+    {
+        std::unique_ptr<MemoryMappedFile> file;
+        const char*                       data;
+        int64                             numFrames;
+        int                               numChannels;
+        int                               bitsPerSample;
+        bool                              isFloat;
+    };
+
+    struct Track
+    {
+        String                                   name;
+        StringArray                              streamNames;
+        double                                   sampleRate;
+        int64                                    numFrames;
+        std::unique_ptr<StemContainer>           container;
+        std::vector<std::unique_ptr<WavStream>>  wavs;
+        std::vector<float>                       mixGains;
+    };
+
+    class PrefetchJob;
+
+    static bool mapWav (const File& file, WavStream& stream, double& sampleRate);
+    static void loadMixGains (const File& directory, Track& track);
+    static void addWav (const WavStream& stream, int64 startFrame, int length, float gain, float* destination);
+
+    bool isValidRequest (int track, const std::vector<int>& streams, int length) const;
+
+    std::vector<std::unique_ptr<Track>> tracks;
+
+    ThreadPool                                    pool;
+    CriticalSection                               jobLock;
+    std::map<int64, std::unique_ptr<PrefetchJob>> jobs;
+    int64                                         nextTicket;
+};
+
+#endif  // DATASETREADER_H_INCLUDED
@@ -0,0 +1,160 @@
+/*
+  ==============================================================================
+
+    ExecutionPolicy.cpp
+
+  ==============================================================================
+*/
+
+#include "ExecutionPolicy.h"
+#include <algorithm>
+
+#if JUCE_LINUX
+ #include <sched.h>
+ #include <sys/resource.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+namespace
+{
+    // Parses a kernel CPU list such as "0-3,8,10-11".
+    void addCpuList (const String& list, std::vector<int>& cpus)
+    {
+        for (const String& range : StringArray::fromTokens (list.trim(), ",", ""))
+        {
+            const int first = range.upToFirstOccurrenceOf ("-", false, false).getIntValue();
+            const int last = range.contains ("-") ? range.fromFirstOccurrenceOf ("-", false, false).getIntValue()
+                                                  : first;
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back (cpu);
+        }
+    }
+
+   #if JUCE_LINUX
+    static_assert (sizeof (cpu_set_t) <= 16 * sizeof (uint64),
+                   "cpu_set_t does not fit into ScopedExecutionPolicy::previousAffinity");
+
+    bool setThreadCpus (const std::vector<int>& cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO (&set);
+        for (int cpu : cpus)
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET (cpu, &set);
+        return pthread_setaffinity_np (pthread_self(), sizeof (set), &set) == 0;
+    }
+   #endif
+}
+
+//==============================================================================
+std::vector<int> ExecutionPolicy::getCpus() const
+{
+    std::vector<int> result (cpus);
+
+    if (numaNode >= 0)
+    {
+        const File cpuList ("/sys/devices/system/node/node" + String (numaNode) + "/cpulist");
+        if (cpuList.existsAsFile())
+            addCpuList (cpuList.loadFileAsString(), result);
+        else
+            std::cout << "ExecutionPolicy::getCpus error: There is no NUMA node "
+            << numaNode << "." << std::endl;
+    }
+
+    std::sort (result.begin(), result.end());
+    result.erase (std::unique (result.begin(), result.end()), result.end());
+    return result;
+}
+
+//==============================================================================
+ExecutionPolicy ExecutionPolicy::getResolved() const
+{
+    ExecutionPolicy resolved (*this);
+    resolved.cpus = getCpus();
+    resolved.numaNode = -1;
+    return resolved;
+}
+
+//==============================================================================
+String ExecutionPolicy::toString() const
+{
+    const std::vector<int> allCpus = getCpus();
+    StringArray cpuNames;
+    for (int cpu : allCpus)
+        cpuNames.add (String (cpu));
+
+    return "cpus=" + (allCpus.empty() ? String ("any") : cpuNames.joinIntoString (","))
+         + (numaNode >= 0 ? " numa_node=" + String (numaNode) : String())
+         + " no_denormals=" + (noDenormals ? "true" : "false")
+         + " nice=" + String (niceLevel);
+}
+
+//==============================================================================
+ScopedExecutionPolicy::ScopedExecutionPolicy (const ExecutionPolicy& policy) :
+    affinitySet (false),
+    niceLevelSet (false),
+    denormalsDisabled (false),
+    previousDenormalsDisabled (FloatVectorOperations::areDenormalsDisabled())
+{
+    // Flush-to-zero and denormals-are-zero, as ScopedNoDenormals sets them.
+    if (policy.noDenormals)
+    {
+        FloatVectorOperations::disableDenormalisedNumberSupport (true);
+        denormalsDisabled = true;
+    }
+
+    // Only a NUMA node needs a (allocating) lookup.
+    std::vector<int> nodeCpus;
+    if (policy.numaNode >= 0)
+        nodeCpus = policy.getCpus();
+    const std::vector<int>& cpus = policy.numaNode >= 0 ? nodeCpus : policy.cpus;
+
+   #if JUCE_LINUX
+    if (! cpus.empty()
+        && pthread_getaffinity_np (pthread_self(), sizeof (cpu_set_t),
+                                   reinterpret_cast<cpu_set_t*> (previousAffinity)) == 0)
+    {
+        affinitySet = setThreadCpus (cpus);
+        if (! affinitySet)
+            std::cout << "ScopedExecutionPolicy error: Could not set the affinity to "
+            << policy.toString().toStdString() << std::endl;
+    }
+
+    if (policy.niceLevel != 0)
+    {
+        const id_t thread = id_t (syscall (SYS_gettid));
+        errno = 0;
+        const int current = getpriority (PRIO_PROCESS, thread);
+        niceLevelSet = (errno == 0 && current == policy.niceLevel)
+                    || setpriority (PRIO_PROCESS, thread, policy.niceLevel) == 0;
+        if (! niceLevelSet)
+            std::cout << "ScopedExecutionPolicy error: Could not set the nice level to "
+            << policy.niceLevel << "." << std::endl;
+    }
+   #else
+    ignoreUnused (cpus);
+   #endif
+}
+
+ScopedExecutionPolicy::~ScopedExecutionPolicy()
+{
+   #if JUCE_LINUX
+    if (affinitySet)
+        pthread_setaffinity_np (pthread_self(), sizeof (cpu_set_t),
+                                reinterpret_cast<const cpu_set_t*> (previousAffinity));
+   #endif
+
+    if (denormalsDisabled)
+        FloatVectorOperations::disableDenormalisedNumberSupport (previousDenormalsDisabled);
+}
+
+//==============================================================================
+int ScopedExecutionPolicy::getCurrentCpu()
+{
+   #if JUCE_LINUX
+    return sched_getcpu();
+   #else
+    return -1;
+   #endif
+}
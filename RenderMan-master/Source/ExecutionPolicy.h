@@ -0,0 +1,92 @@
+/*
+  ==============================================================================
+
+    ExecutionPolicy.h
+
+  ==============================================================================
+*/
+
+#ifndef EXECUTIONPOLICY_H_INCLUDED
+#define EXECUTIONPOLICY_H_INCLUDED
+
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// How a thread runs while it renders: the CPUs it may run on, its nice level
+// and whether denormals are flushed to zero. Tails decaying into denormals
+// can make a plugin's processBlock many times slower than usual.
+struct ExecutionPolicy
+{
+    ExecutionPolicy() :
+        numaNode (-1),
+        noDenormals (true),
+        niceLevel (0)
+    {
+    }
+
+    // CPUs the thread may run on, together with those of numaNode. No CPUs
+    // and a numaNode of -1 leave the affinity alone.
+    std::vector<int> cpus;
+    int              numaNode;
+
+    // Sets flush-to-zero and denormals-are-zero while rendering.
+    bool             noDenormals;
+
+    // Zero leaves the nice level alone.
+    int              niceLevel;
+
+    // The CPUs of cpus and numaNode together, sorted, or an empty list if
+    // the affinity is left alone.
+    std::vector<int> getCpus() const;
+
+    // The same policy with numaNode looked up and merged into cpus, so
+    // applying it reads nothing from /sys.
+    ExecutionPolicy getResolved() const;
+
+    String toString() const;
+};
+
+//==============================================================================
+// Applies an ExecutionPolicy to the calling thread for as long as it exists.
+// The affinity and floating point mode are restored afterwards. The nice
+// level is not, as lowering it again needs privileges. Affinity and nice
+// level are only supported on Linux, where both apply to the thread alone.
+// Nothing is allocated for a resolved policy, so it can be used per render.
+class ScopedExecutionPolicy
+{
+public:
+    explicit ScopedExecutionPolicy (const ExecutionPolicy& policy);
+
+    ~ScopedExecutionPolicy();
+
+    bool isAffinitySet() const {
+        return affinitySet;
+    };
+
+    bool isNiceLevelSet() const {
+        return niceLevelSet;
+    };
+
+    bool areDenormalsDisabled() const {
+        return denormalsDisabled;
+    };
+
+    // The CPU the calling thread is running on, or -1 if unknown.
+    static int getCurrentCpu();
+
+private:
+    bool   affinitySet;
+    bool   niceLevelSet;
+    bool   denormalsDisabled;
+    bool   previousDenormalsDisabled;
+
+    // The thread's previous cpu_set_t (1024 CPUs).
+    uint64 previousAffinity[16];
+
+    JUCE_DECLARE_NON_COPYABLE (ScopedExecutionPolicy)
+};
+
+#endif  // EXECUTIONPOLICY_H_INCLUDED
@@ -0,0 +1,225 @@
+/*
+  ==============================================================================
+
+    FeaturePipeline.cpp
+
+  ==============================================================================
+*/
+
+#include "FeaturePipeline.h"
+
+//==============================================================================
+FeaturePipeline::FeaturePipeline (double sampleRate,
+                                  int    fftSize,
+                                  int    hopSize,
+                                  int    bands,
+                                  int    requestedFeatures) :
+    Thread ("FeaturePipeline"),
+    features (requestedFeatures),
+    numMelBands ((requestedFeatures & (melFeature | onsetFeature)) != 0 ? jmax (1, bands) : 0),
+    fifo (jmax (1 << 16, fftSize * 4)),
+    pendingStart (0),
+    received (0),
+    numFrames (0),
+    endOfInput (false)
+{
+    stft.setup (fftSize, hopSize);
+
+    if (numMelBands > 0)
+        mel.setup (int (sampleRate), fftSize, hopSize, numMelBands, 1, 0.0, 0.0);
+
+    ring.resize (size_t (fifo.getTotalSize()));
+    spectrum.resize (size_t (stft.getNumBins()));
+    stftScratch.resize (size_t (stft.fftSize + stft.getNumBins()));
+    logMel.resize (size_t (numMelBands));
+    previousLogMel.resize (size_t (numMelBands));
+
+    startThread();
+}
+
+FeaturePipeline::~FeaturePipeline()
+{
+    signalThreadShouldExit();
+    dataReady.signal();
+    stopThread (2000);
+}
+
+//==============================================================================
+void FeaturePipeline::begin (const int expectedSamples)
+{
+    // The feature thread is idle until the first push, so the stream state
+    // can be reset from here.
+    fifo.reset();
+    pending.clear();
+    pendingStart = 0;
+    received = 0;
+    numFrames = 0;
+    std::fill (previousLogMel.begin(), previousLogMel.end(), 0.0f);
+
+    const size_t frames = size_t (stft.getNumFrames (expectedSamples));
+    pending.reserve (size_t (stft.fftSize) * 2 + size_t (fifo.getTotalSize()));
+    magnitudes.clear();
+    melBands.clear();
+    onsetStrength.clear();
+    rms.clear();
+
+    if (features & stftFeature)
+        magnitudes.reserve (frames * size_t (getNumBins()));
+    if (features & melFeature)
+        melBands.reserve (frames * size_t (numMelBands));
+    if (features & onsetFeature)
+        onsetStrength.reserve (frames);
+    if (features & rmsFeature)
+        rms.reserve (frames);
+}
+
+//==============================================================================
+void FeaturePipeline::push (const float* samples, int numSamples)
+{
+    while (numSamples > 0)
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+
+        // Only waits when the feature thread has fallen a whole FIFO behind.
+        if (size1 + size2 == 0)
+        {
+            spaceAvailable.wait (1);
+            continue;
+        }
+
+        std::copy (samples, samples + size1, ring.begin() + start1);
+        std::copy (samples + size1, samples + size1 + size2, ring.begin() + start2);
+        fifo.finishedWrite (size1 + size2);
+
+        samples += size1 + size2;
+        numSamples -= size1 + size2;
+        dataReady.signal();
+    }
+}
+
+//==============================================================================
+void FeaturePipeline::finish()
+{
+    endOfInput = true;
+    dataReady.signal();
+    finished.wait();
+}
+
+//==============================================================================
+void FeaturePipeline::run()
+{
+    while (! threadShouldExit())
+    {
+        dataReady.wait (100);
+
+        // Everything pushed before finish() is in the FIFO once the flag is
+        // seen, so drain after reading it.
+        const bool ending = endOfInput;
+        drainFifo();
+
+        if (ending)
+        {
+            analyseFrames (stft.getNumFrames (int (received)));
+            endOfInput = false;
+            finished.signal();
+        }
+    }
+}
+
+//==============================================================================
+void FeaturePipeline::drainFifo()
+{
+    const int numReady = fifo.getNumReady();
+    if (numReady == 0)
+        return;
+
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (numReady, start1, size1, start2, size2);
+    pending.insert (pending.end(), ring.begin() + start1, ring.begin() + start1 + size1);
+    pending.insert (pending.end(), ring.begin() + start2, ring.begin() + start2 + size2);
+    fifo.finishedRead (size1 + size2);
+    spaceAvailable.signal();
+
+    received += size1 + size2;
+
+    // Every frame that fits entirely in the samples received so far.
+    const int64 fftSize = stft.fftSize;
+    if (received >= fftSize)
+        analyseFrames (int ((received - fftSize) / stft.hopSize) + 1);
+}
+
+//==============================================================================
+void FeaturePipeline::analyseFrames (const int lastFrame)
+{
+    const int64 fftSize = stft.fftSize;
+
+    for (; numFrames < lastFrame; ++numFrames)
+    {
+        const int64 offset = int64 (numFrames) * stft.hopSize - pendingStart;
+        const int available = int (jlimit (int64 (0), fftSize, int64 (pending.size()) - offset));
+        analyseFrame (available > 0 ? pending.data() + offset : pending.data(), available);
+    }
+
+    // Drop the samples no later frame will look at.
+    const int64 consumed = jmin (int64 (numFrames) * stft.hopSize - pendingStart,
+                                 int64 (pending.size()));
+    if (consumed >= fftSize)
+    {
+        pending.erase (pending.begin(), pending.begin() + consumed);
+        pendingStart += consumed;
+    }
+}
+
+//==============================================================================
+void FeaturePipeline::analyseFrame (const float* frame, const int available)
+{
+    const int bins = getNumBins();
+    const bool needsMel = numMelBands > 0;
+
+    float* magnitudeRow = spectrum.data();
+    if (features & stftFeature)
+    {
+        magnitudes.resize (magnitudes.size() + size_t (bins));
+        magnitudeRow = magnitudes.data() + magnitudes.size() - bins;
+    }
+
+    stft.processFrames (frame, available, magnitudeRow, NULL, 0, 1, stftScratch.data());
+
+    if (needsMel)
+    {
+        for (int k = 0; k < bins; ++k)
+            spectrum[k] = magnitudeRow[k] * magnitudeRow[k];
+
+        float* melRow = logMel.data();
+        if (features & melFeature)
+        {
+            melBands.resize (melBands.size() + size_t (numMelBands));
+            melRow = melBands.data() + melBands.size() - numMelBands;
+        }
+
+        mel.applyFilterbank (spectrum.data(), melRow);
+
+        if (features & onsetFeature)
+        {
+            for (int i = 0; i < numMelBands; ++i)
+                logMel[i] = std::log (jmax (melRow[i], 1e-10f));
+
+            float flux = 0.0f;
+            if (numFrames > 0)
+                for (int i = 0; i < numMelBands; ++i)
+                    flux += jmax (0.0f, logMel[i] - previousLogMel[i]);
+
+            onsetStrength.push_back (flux / numMelBands);
+            previousLogMel.swap (logMel);
+        }
+    }
+
+    if (features & rmsFeature)
+    {
+        double sum = 0.0;
+        for (int i = 0; i < available; ++i)
+            sum += double (frame[i]) * frame[i];
+        rms.push_back (float (std::sqrt (sum / stft.fftSize)));
+    }
+}
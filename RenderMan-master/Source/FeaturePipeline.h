@@ -0,0 +1,136 @@
+/*
+  ==============================================================================
+
+    FeaturePipeline.h
+
+  ==============================================================================
+*/
+
+#ifndef FEATUREPIPELINE_H_INCLUDED
+#define FEATUREPIPELINE_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+#include "Maximilian/libs/maxiMFCC.h"
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// Computes audio features on a side thread while the engine renders. The
+// render thread pushes each mono block into a lock free single producer /
+// single consumer FIFO and carries on with the plugin; the feature thread
+// frames the stream as it arrives. Frames are laid out exactly like
+// maxiSTFT: frame f starts at sample f * hopSize and the last frames are
+// zero padded.
+//
+// Each frame can produce:
+//  - STFT magnitudes (fftSize / 2 + 1 bins, Hann windowed)
+//  - mel bands of the power spectrum
+//  - onset strength: the mean positive change of the log mel bands since
+//    the previous frame
+//  - RMS of the (unwindowed, zero padded) frame
+class FeaturePipeline : private Thread
+{
+public:
+    enum Feature
+    {
+        stftFeature  = 1,
+        melFeature   = 2,
+        onsetFeature = 4,
+        rmsFeature   = 8
+    };
+
+    // features is a combination of Feature flags. fftSize must be a power
+    // of two.
+    FeaturePipeline (double sampleRate,
+                     int    fftSize,
+                     int    hopSize,
+                     int    numMelBands,
+                     int    features);
+
+    ~FeaturePipeline();
+
+    int getFeatures() const {
+        return features;
+    };
+
+    int getNumBins() const {
+        return stft.getNumBins();
+    };
+
+    int getNumMelBands() const {
+        return numMelBands;
+    };
+
+    // Called from the render thread: begin before the first block, push
+    // every block and finish after the last one. finish blocks until the
+    // remaining frames are done.
+    void begin (const int expectedSamples);
+
+    void push (const float* samples, const int numSamples);
+
+    void finish();
+
+    // Results of the last finished render. Each is row major with
+    // getNumFrames() rows, empty for features that were not requested.
+    int getNumFrames() const {
+        return numFrames;
+    };
+
+    const std::vector<float>& getMagnitudes() const {
+        return magnitudes;
+    };
+
+    const std::vector<float>& getMelBands() const {
+        return melBands;
+    };
+
+    const std::vector<float>& getOnsetStrength() const {
+        return onsetStrength;
+    };
+
+    const std::vector<float>& getRms() const {
+        return rms;
+    };
+
+private:
+    void run() override;
+
+    void drainFifo();
+
+    void analyseFrames (const int lastFrame);
+
+    void analyseFrame (const float* frame, const int available);
+
+    const int         features;
+    const int         numMelBands;
+    maxiSTFT          stft;
+    maxiMelAnalyser   mel;
+
+    // Stream state, only touched by the feature thread between begin and
+    // finish.
+    AbstractFifo       fifo;
+    std::vector<float> ring;
+    std::vector<float> pending;
+    int64              pendingStart;
+    int64              received;
+    int                numFrames;
+
+    std::vector<float> spectrum;
+    std::vector<float> stftScratch;
+    std::vector<float> logMel;
+    std::vector<float> previousLogMel;
+
+    std::vector<float> magnitudes;
+    std::vector<float> melBands;
+    std::vector<float> onsetStrength;
+    std::vector<float> rms;
+
+    WaitableEvent      dataReady;
+    WaitableEvent      spaceAvailable;
+    WaitableEvent      finished;
+    std::atomic<bool>  endOfInput;
+};
+
+#endif  // FEATUREPIPELINE_H_INCLUDED
@@ -0,0 +1,450 @@
+/*
+  ==============================================================================
+
+    ForkServer.cpp
+
+  ==============================================================================
+*/
+
+#include "ForkServer.h"
+#include <cmath>
+#include <cstdio>
+
+#if JUCE_LINUX || JUCE_MAC
+ #include <cerrno>
+ #include <csignal>
+ #include <poll.h>
+ #include <sys/socket.h>
+ #include <sys/wait.h>
+ #include <unistd.h>
+ #if JUCE_LINUX
+  #include <sys/prctl.h>
+ #endif
+#endif
+
+namespace
+{
+   #if JUCE_LINUX || JUCE_MAC
+   #if JUCE_LINUX
+    const int sendFlags = MSG_NOSIGNAL;
+   #else
+    const int sendFlags = 0;    // the sockets are SO_NOSIGPIPE instead
+   #endif
+
+    // Messages are a uint32 size followed by that many bytes. Writing to a
+    // dead peer fails instead of raising SIGPIPE.
+    bool writeFully (const int socket, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*> (data);
+        while (size > 0)
+        {
+            const ssize_t written = ::send (socket, bytes, size, sendFlags);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            bytes += written;
+            size -= size_t (written);
+        }
+        return true;
+    }
+
+    bool readFully (const int socket, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*> (data);
+        while (size > 0)
+        {
+            const ssize_t got = ::read (socket, bytes, size);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+            bytes += got;
+            size -= size_t (got);
+        }
+        return true;
+    }
+
+    bool writeMessage (const int socket, const MemoryOutputStream& message)
+    {
+        const uint32 size = ByteOrder::swapIfBigEndian (uint32 (message.getDataSize()));
+        return writeFully (socket, &size, sizeof (size))
+            && writeFully (socket, message.getData(), message.getDataSize());
+    }
+
+    bool readMessage (const int socket, MemoryBlock& message)
+    {
+        uint32 size = 0;
+        if (! readFully (socket, &size, sizeof (size)))
+            return false;
+        message.setSize (size_t (ByteOrder::swapIfBigEndian (size)));
+        return readFully (socket, message.getData(), message.getSize());
+    }
+
+    void closeWorker (const int pid, const int socket)
+    {
+        ::close (socket);
+        int status = 0;
+        while (waitpid (pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+   #endif
+
+    bool writeWav (const File&                file,
+                   const std::vector<double>& frames,
+                   const double               sampleRate,
+                   const float                gain,
+                   const int                  bitsPerSample,
+                   String&                    error)
+    {
+        HeapBlock<float> samples (frames.size());
+        for (size_t i = 0; i < frames.size(); ++i)
+            samples[i] = float (frames[i] * gain);
+
+        file.deleteFile();
+        std::unique_ptr<FileOutputStream> stream (file.createOutputStream());
+        if (stream == nullptr || stream->failedToOpen())
+        {
+            error = "Could not open " + file.getFullPathName() + ".";
+            return false;
+        }
+
+        WavAudioFormat wav;
+        std::unique_ptr<AudioFormatWriter> writer (wav.createWriterFor (stream.get(), sampleRate, 1, bitsPerSample,
+                                                                        StringPairArray(), 0));
+        if (writer == nullptr)
+        {
+            error = "Could not write " + String (bitsPerSample) + " bit wav files.";
+            return false;
+        }
+
+        // The writer owns the stream now.
+        stream.release();
+        const float* channel = samples.getData();
+        if (! writer->writeFromFloatArrays (&channel, 1, int (frames.size())))
+        {
+            error = "Could not write " + file.getFullPathName() + ".";
+            return false;
+        }
+        return true;
+    }
+}
+
+//==============================================================================
+ForkServer::ForkServer (RenderEngine& engine,
+                        int           numWorkers) :
+    nextJob (0)
+{
+   #if JUCE_LINUX || JUCE_MAC
+    // Anything still buffered would be written once more by every child.
+    std::cout.flush();
+    std::fflush (stdout);
+
+    for (int i = 0; i < jmax (1, numWorkers); ++i)
+    {
+        int sockets[2];
+        if (socketpair (AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        {
+            std::cout << "ForkServer::ForkServer error: Could not create a socket pair." << std::endl;
+            break;
+        }
+
+       #if JUCE_MAC
+        const int noSigPipe = 1;
+        setsockopt (sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof (noSigPipe));
+        setsockopt (sockets[1], SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof (noSigPipe));
+       #endif
+
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            std::cout << "ForkServer::ForkServer error: Could not fork worker " << i << "." << std::endl;
+            ::close (sockets[0]);
+            ::close (sockets[1]);
+            break;
+        }
+
+        if (pid == 0)
+        {
+            // Interrupts are for the parent, which stops the workers by
+            // closing their sockets.
+            signal (SIGINT, SIG_IGN);
+           #if JUCE_LINUX
+            prctl (PR_SET_PDEATHSIG, SIGKILL);
+           #endif
+
+            for (const Worker& worker : workers)
+                ::close (worker.socket);
+            ::close (sockets[0]);
+
+            runWorker (engine, sockets[1]);
+            _exit (0);
+        }
+
+        ::close (sockets[1]);
+        Worker worker;
+        worker.pid = int (pid);
+        worker.socket = sockets[0];
+        worker.job = -1;
+        workers.push_back (worker);
+    }
+   #else
+    ignoreUnused (engine, numWorkers);
+    std::cout << "ForkServer::ForkServer error: Forking is not supported on this platform." << std::endl;
+   #endif
+}
+
+ForkServer::~ForkServer()
+{
+    shutdown();
+}
+
+//==============================================================================
+void ForkServer::shutdown()
+{
+   #if JUCE_LINUX || JUCE_MAC
+    // A worker exits when its socket is closed, after the job it is on.
+    for (const Worker& worker : workers)
+        closeWorker (worker.pid, worker.socket);
+   #endif
+    workers.clear();
+    queue.clear();
+    failed.clear();
+}
+
+//==============================================================================
+int ForkServer::getNumPending() const
+{
+    int pending = int (queue.size() + failed.size());
+    for (const Worker& worker : workers)
+        if (worker.job >= 0)
+            ++pending;
+    return pending;
+}
+
+//==============================================================================
+int64 ForkServer::submit (const Job& job)
+{
+    const int64 id = nextJob++;
+    queue.push_back (std::make_pair (id, job));
+    dispatch();
+    return id;
+}
+
+//==============================================================================
+void ForkServer::dispatch()
+{
+   #if JUCE_LINUX || JUCE_MAC
+    for (size_t i = 0; i < workers.size();)
+    {
+        if (queue.empty())
+            return;
+        Worker& worker = workers[i];
+        if (worker.job >= 0)
+        {
+            ++i;
+            continue;
+        }
+
+        const int64 id = queue.front().first;
+        const Job& job = queue.front().second;
+
+        MemoryOutputStream message;
+        message.writeInt64 (id);
+        message.writeString (job.midiPath);
+        message.writeString (job.wavPath);
+        message.writeDouble (job.renderLength);
+        message.writeDouble (job.minTail);
+        message.writeDouble (job.maxTail);
+        message.writeDouble (job.minLength);
+        message.writeFloat (job.peak);
+        message.writeInt (job.bitsPerSample);
+
+        queue.pop_front();
+        if (writeMessage (worker.socket, message))
+        {
+            worker.job = id;
+            ++i;
+            continue;
+        }
+
+        // A worker that cannot be written to has died, its job fails.
+        Result result = Result();
+        result.job = id;
+        result.ok = false;
+        result.error = "Worker " + String (worker.pid) + " had exited before the job.";
+        failed.push_back (result);
+        closeWorker (worker.pid, worker.socket);
+        workers.erase (workers.begin() + std::ptrdiff_t (i));
+    }
+   #endif
+}
+
+//==============================================================================
+bool ForkServer::waitForResult (Result& result,
+                                double  timeoutSeconds)
+{
+    dispatch();
+
+    if (! failed.empty())
+    {
+        result = failed.front();
+        failed.pop_front();
+        return true;
+    }
+
+    // With no workers left, queued jobs fail one by one.
+    if (workers.empty() && ! queue.empty())
+    {
+        result = Result();
+        result.job = queue.front().first;
+        result.ok = false;
+        result.error = "No workers are left.";
+        queue.pop_front();
+        return true;
+    }
+
+   #if JUCE_LINUX || JUCE_MAC
+    const double deadline = Time::getMillisecondCounterHiRes() + timeoutSeconds * 1000.0;
+
+    for (;;)
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<size_t> busy;
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            if (workers[i].job >= 0)
+            {
+                struct pollfd fd;
+                fd.fd = workers[i].socket;
+                fd.events = POLLIN;
+                fd.revents = 0;
+                fds.push_back (fd);
+                busy.push_back (i);
+            }
+        }
+        if (fds.empty())
+            return false;
+
+        const int timeoutMs = timeoutSeconds < 0.0 ? -1
+                                                   : jmax (0, int (deadline - Time::getMillisecondCounterHiRes()));
+        const int ready = poll (fds.data(), nfds_t (fds.size()), timeoutMs);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            return false;
+
+        for (size_t f = 0; f < fds.size(); ++f)
+        {
+            if (fds[f].revents == 0)
+                continue;
+
+            Worker& worker = workers[busy[f]];
+            result = Result();
+            result.job = worker.job;
+
+            MemoryBlock reply;
+            if (readMessage (worker.socket, reply))
+            {
+                MemoryInputStream stream (reply, false);
+                result.job = stream.readInt64();
+                result.ok = stream.readBool();
+                result.renderLength = stream.readDouble();
+                result.numSamples = stream.readInt64();
+                result.peak = stream.readFloat();
+                result.renderSeconds = stream.readDouble();
+                result.error = stream.readString();
+                worker.job = -1;
+            }
+            else
+            {
+                result.ok = false;
+                result.error = "Worker " + String (worker.pid) + " exited during the job.";
+                closeWorker (worker.pid, worker.socket);
+                workers.erase (workers.begin() + std::ptrdiff_t (busy[f]));
+            }
+
+            dispatch();
+            return true;
+        }
+    }
+   #else
+    ignoreUnused (result, timeoutSeconds);
+    return false;
+   #endif
+}
+
+//==============================================================================
+void ForkServer::runWorker (RenderEngine& engine,
+                            int           socket)
+{
+   #if JUCE_LINUX || JUCE_MAC
+    MemoryBlock request;
+    while (readMessage (socket, request))
+    {
+        MemoryInputStream stream (request, false);
+        Job job;
+        const int64 id = stream.readInt64();
+        job.midiPath = stream.readString();
+        job.wavPath = stream.readString();
+        job.renderLength = stream.readDouble();
+        job.minTail = stream.readDouble();
+        job.maxTail = stream.readDouble();
+        job.minLength = stream.readDouble();
+        job.peak = stream.readFloat();
+        job.bitsPerSample = stream.readInt();
+
+        Result result = Result();
+        result.job = id;
+        const int64 start = Time::getHighResolutionTicks();
+
+        if (job.bitsPerSample != 16 && job.bitsPerSample != 24 && job.bitsPerSample != 32)
+        {
+            result.error = "Cannot write " + String (job.bitsPerSample) + " bit wav files.";
+        }
+        else if (! engine.loadMidi (job.midiPath.toStdString()))
+        {
+            result.error = "Could not load " + job.midiPath + ".";
+        }
+        else
+        {
+            result.renderLength = job.renderLength > 0.0 ? job.renderLength
+                                                         : engine.getAutoRenderLength (job.minTail,
+                                                                                       job.maxTail,
+                                                                                       job.minLength);
+            engine.renderMidi (result.renderLength);
+
+            const std::vector<double>& frames = engine.getAudioFrames();
+            double peak = 0.0;
+            for (double sample : frames)
+                peak = jmax (peak, std::abs (sample));
+            result.numSamples = int64 (frames.size());
+            result.peak = float (peak);
+
+            if (job.peak > 0.0f && peak <= 0.0)
+                result.ok = true;
+            else
+                result.ok = writeWav (File (job.wavPath), frames, engine.getSampleRate(),
+                                      job.peak > 0.0f ? float (job.peak / peak) : 1.0f,
+                                      job.bitsPerSample, result.error);
+        }
+
+        result.renderSeconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+
+        MemoryOutputStream reply;
+        reply.writeInt64 (result.job);
+        reply.writeBool (result.ok);
+        reply.writeDouble (result.renderLength);
+        reply.writeInt64 (result.numSamples);
+        reply.writeFloat (result.peak);
+        reply.writeDouble (result.renderSeconds);
+        reply.writeString (result.error);
+        if (! writeMessage (socket, reply))
+            break;
+    }
+    ::close (socket);
+   #else
+    ignoreUnused (engine, socket);
+   #endif
+}
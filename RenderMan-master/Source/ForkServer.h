@@ -0,0 +1,126 @@
+/*
+  ==============================================================================
+
+    ForkServer.h
+
+  ==============================================================================
+*/
+
+#ifndef FORKSERVER_H_INCLUDED
+#define FORKSERVER_H_INCLUDED
+
+#include <deque>
+#include <vector>
+#include "RenderEngine.h"
+
+//==============================================================================
+// Renders MIDI files with several processes sharing one loaded engine.
+//
+// The constructor forks numWorkers children from the calling process after
+// the engine's plugin and preset are loaded. Each child inherits the plugin
+// instance and its sample memory copy-on-write, so a Kontakt patch that took
+// seconds and gigabytes to load is loaded once and rendered N times in
+// parallel. Children only read and write through their own copy of the
+// engine and take jobs over a socket, they never return to the caller.
+//
+// Only the forking thread exists in a child. Plugins that render through
+// threads of their own (disk streaming, worker pools) may hang or go silent
+// in the children, so check a render against the parent's before relying on
+// it. Not available on Windows.
+class ForkServer
+{
+public:
+    struct Job
+    {
+        Job() :
+            renderLength (0.0),
+            minTail (0.5),
+            maxTail (10.0),
+            minLength (0.0),
+            peak (0.0f),
+            bitsPerSample (16)
+        {
+        }
+
+        String midiPath;
+        String wavPath;
+
+        // Zero or less picks the length with getAutoRenderLength (minTail,
+        // maxTail, minLength).
+        double renderLength;
+        double minTail;
+        double maxTail;
+        double minLength;
+
+        // Scales the render to this peak before writing, zero or less writes
+        // it as rendered. A silent render is not written when scaling.
+        float  peak;
+
+        // 16 or 24 bit PCM, or 32 bit float.
+        int    bitsPerSample;
+    };
+
+    struct Result
+    {
+        int64  job;
+        bool   ok;
+        double renderLength;
+        int64  numSamples;
+
+        // Of the render before scaling.
+        float  peak;
+        double renderSeconds;
+        String error;
+    };
+
+    // Forks the workers. The engine must not be rendering and must outlive
+    // the server.
+    ForkServer (RenderEngine& engine,
+                int           numWorkers);
+
+    // Stops the workers and waits for them to exit.
+    ~ForkServer();
+
+    bool isReady() const {
+        return ! workers.empty();
+    };
+
+    int getNumWorkers() const {
+        return int (workers.size());
+    };
+
+    // Jobs submitted whose results have not been taken yet.
+    int getNumPending() const;
+
+    // Queues a job and returns its id.
+    int64 submit (const Job& job);
+
+    // Waits for the next job to finish, for at most timeoutSeconds unless
+    // that is negative. Returns false on timeout or when nothing is pending.
+    // A worker that dies is not replaced, its job comes back with ok false.
+    bool waitForResult (Result& result,
+                        double  timeoutSeconds);
+
+    // Stops the workers. Pending jobs are dropped.
+    void shutdown();
+
+private:
+    struct Worker
+    {
+        int   pid;
+        int   socket;
+        int64 job;   // -1 while idle
+    };
+
+    void dispatch();
+
+    static void runWorker (RenderEngine& engine,
+                           int           socket);
+
+    std::vector<Worker>                 workers;
+    std::deque<std::pair<int64, Job>>   queue;
+    std::deque<Result>                  failed;    // jobs no worker took
+    int64                               nextJob;
+};
+
+#endif  // FORKSERVER_H_INCLUDED
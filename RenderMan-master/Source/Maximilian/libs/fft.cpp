@@ -582,3 +582,108 @@ void fft::inversePowerSpectrum_vdsp(int start, float *finalOut, float *window, f
 }
 
 #endif
+
+
+/* Real input FFT */
+fftReal::fftReal(int fftSize) {
+	n = fftSize;
+	half = fftSize / 2;
+	
+	if (!IsPowerOfTwo(n) || n < 4) {
+		fprintf(stderr, "fftReal: %d is not a power of two of at least 4\n", n);
+		exit(1);
+	}
+	
+	int bits = NumberOfBitsNeeded(half);
+	bitReverse.resize(half);
+	for (int i = 0; i < half; i++)
+		bitReverse[i] = ReverseBits(i, bits);
+	
+	/* twiddles for the stage with butterfly span s start at index s - 1 */
+	stageCos.resize(half);
+	stageSin.resize(half);
+	for (int span = 1; span < half; span <<= 1) {
+		for (int j = 0; j < span; j++) {
+			double angle = -M_PI * j / span;
+			stageCos[span - 1 + j] = cos(angle);
+			stageSin[span - 1 + j] = sin(angle);
+		}
+	}
+	
+	unpackCos.resize(half / 2 + 1);
+	unpackSin.resize(half / 2 + 1);
+	for (int k = 0; k <= half / 2; k++) {
+		double angle = -2.0 * M_PI * k / n;
+		unpackCos[k] = cos(angle);
+		unpackSin[k] = sin(angle);
+	}
+}
+
+/* One stage's butterflies for one block. The halves never overlap, which
+ the restrict qualifiers tell the compiler so it can vectorise the loop. */
+static inline void butterflies(float *__restrict ar, float *__restrict ai,
+							   float *__restrict br, float *__restrict bi,
+							   const float *__restrict wr, const float *__restrict wi, int span) {
+	for (int j = 0; j < span; j++) {
+		float tr = wr[j] * br[j] - wi[j] * bi[j];
+		float ti = wr[j] * bi[j] + wi[j] * br[j];
+		br[j] = ar[j] - tr;
+		bi[j] = ai[j] - ti;
+		ar[j] += tr;
+		ai[j] += ti;
+	}
+}
+
+void fftReal::forward(const float *input, float *real, float *imag) const {
+	const int m = half;
+	
+	/* even samples become the real part, odd ones the imaginary part */
+	for (int i = 0; i < m; i++) {
+		int j = bitReverse[i];
+		real[j] = input[2 * i];
+		imag[j] = input[2 * i + 1];
+	}
+	
+	/* first stage has a twiddle of 1 */
+	for (int i = 0; i < m; i += 2) {
+		float tr = real[i + 1], ti = imag[i + 1];
+		real[i + 1] = real[i] - tr;
+		imag[i + 1] = imag[i] - ti;
+		real[i] += tr;
+		imag[i] += ti;
+	}
+	
+	for (int span = 2; span < m; span <<= 1) {
+		for (int block = 0; block < m; block += 2 * span)
+			butterflies(real + block, imag + block, real + block + span, imag + block + span,
+						&stageCos[span - 1], &stageSin[span - 1], span);
+	}
+	
+	/* unpack: X[k] = E[k] + w^k O[k] with E, O the spectra of the even and
+	 odd samples, recovered from Z[k] and conj(Z[m - k]). Pairs k and m - k
+	 are done together so this can work in place. */
+	float z0r = real[0], z0i = imag[0];
+	real[0] = z0r + z0i;
+	imag[0] = 0;
+	real[m] = z0r - z0i;
+	imag[m] = 0;
+	
+	for (int k = 1; k <= m / 2; k++) {
+		float ar = real[k], ai = imag[k];
+		float br = real[m - k], bi = imag[m - k];
+		
+		float er = 0.5f * (ar + br), ei = 0.5f * (ai - bi);
+		float or_ = 0.5f * (ai + bi), oi = -0.5f * (ar - br);
+		
+		float wr = unpackCos[k], wi = unpackSin[k];
+		float tr = wr * or_ - wi * oi;
+		float ti = wr * oi + wi * or_;
+		
+		real[k] = er + tr;
+		imag[k] = ei + ti;
+		/* X[m - k] = conj(E[k]) - conj(w^k O[k]) */
+		real[m - k] = er - tr;
+		imag[m - k] = -ei + ti;
+	}
+}
+
@@ -41,6 +41,7 @@
 #include <Accelerate/Accelerate.h>
 #endif
 
+#include <vector>
 
 
 class fft {
@@ -76,4 +77,31 @@ public:
 };
 
 
+/* Real input FFT of a power of two size n. The input is packed into a complex
+ FFT of half the size whose bit reversal order and per stage twiddles are
+ computed once, then unpacked into the n/2 + 1 bins of the real spectrum.
+ The butterfly loops run over contiguous split real/imaginary arrays so the
+ compiler can vectorise them. forward() is const and uses no state of its
+ own, so one fftReal can be shared by any number of threads. */
+class fftReal {
+	
+public:
+	
+	fftReal(int fftSize);
+	
+	int n; //fftSize
+	int half; //halfFFTSize
+	
+	/* real and imag must hold n/2 + 1 floats each and receive bins 0 to n/2 */
+	void forward(const float *input, float *real, float *imag) const;
+	
+private:
+	
+	std::vector<int>   bitReverse;
+	std::vector<float> stageCos, stageSin;     // concatenated per stage
+	std::vector<float> unpackCos, unpackSin;   // e^(-2 pi i k / n)
+	
+};
+
+
 #endif	
@@ -38,7 +38,9 @@
 	#include "../maximilian.h"
 #endif
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 #include "math.h"
 
 using namespace std;
@@ -194,6 +196,82 @@ maxiIFFT::~maxiIFFT() {
 
 
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//S T F T
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void maxiSTFT::setup(int _fftSize, int _hopSize, int windowType) {
+	delete _fft;
+	_fft = new fftReal(_fftSize);
+	fftSize = _fftSize;
+	hopSize = _hopSize > 0 ? _hopSize : _fftSize;
+	window.assign(fftSize, 0);
+	fft::genWindow(windowType, fftSize, &window[0]);
+}
+
+int maxiSTFT::getNumFrames(int numSamples) const {
+	if (numSamples <= fftSize)
+		return 1;
+	return 1 + (numSamples - fftSize + hopSize - 1) / hopSize;
+}
+
+void maxiSTFT::process(const float *samples, int numSamples, float *magnitudes, float *phases, int numThreads) const {
+	int numFrames = getNumFrames(numSamples);
+	if (numThreads <= 0)
+		numThreads = std::thread::hardware_concurrency();
+	//not worth a thread for less than a few frames each
+	numThreads = std::max(1, std::min(numThreads, numFrames / 8));
+	
+	std::vector<std::thread> workers;
+	int framesPerThread = (numFrames + numThreads - 1) / numThreads;
+	for (int t = 1; t < numThreads; t++) {
+		int first = t * framesPerThread;
+		int last = std::min(numFrames, first + framesPerThread);
+		if (first < last)
+			workers.push_back(std::thread(&maxiSTFT::processFrames, this, samples, numSamples,
+										  magnitudes + (size_t) first * getNumBins(),
+										  phases ? phases + (size_t) first * getNumBins() : NULL,
+										  first, last, (float *) NULL));
+	}
+	processFrames(samples, numSamples, magnitudes, phases, 0, std::min(numFrames, framesPerThread));
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void maxiSTFT::processFrames(const float *samples, int numSamples, float *magnitudes, float *phases, int firstFrame, int lastFrame, float *scratch) const {
+	const int bins = getNumBins();
+	std::vector<float> ownScratch(scratch ? 0 : fftSize + bins);
+	float *frame = scratch ? scratch : &ownScratch[0];
+	float *imag = frame + fftSize;
+	
+	for (int f = firstFrame; f < lastFrame; f++) {
+		//window the frame, zero padding past the end of the buffer
+		int start = f * hopSize;
+		int available = std::max(0, std::min(fftSize, numSamples - start));
+		for (int i = 0; i < available; i++)
+			frame[i] = samples[start + i] * window[i];
+		for (int i = available; i < fftSize; i++)
+			frame[i] = 0;
+		
+		//the spectrum is written straight into the output rows, then turned into polar form
+		float *mag = magnitudes + (size_t) (f - firstFrame) * bins;
+		float *im = phases ? phases + (size_t) (f - firstFrame) * bins : imag;
+		_fft->forward(frame, mag, im);
+		for (int k = 0; k < bins; k++) {
+			float re = mag[k];
+			mag[k] = sqrtf(re * re + im[k] * im[k]);
+			if (phases)
+				im[k] = atan2f(im[k], re);
+		}
+	}
+}
+
+maxiSTFT::~maxiSTFT() {
+	delete _fft;
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //O C T A V E  A N A L Y S E R
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -92,6 +92,36 @@ private:
 };
 
 
+/* Block short time Fourier transform. Takes a whole buffer at once instead
+ of a sample at a time and writes frames x (fftSize / 2 + 1) magnitude and
+ phase matrices, with frames split across threads. Frame f starts at sample
+ f * hopSize; frames running past the end of the buffer are zero padded. */
+class maxiSTFT {
+	
+public:
+	maxiSTFT() : fftSize(0), hopSize(0), _fft(NULL) {};
+	~maxiSTFT();
+	void setup(int fftSize, int hopSize, int windowType = 3);
+	int getNumFrames(int numSamples) const;
+	int getNumBins() const { return fftSize / 2 + 1; }
+	/* magnitudes and phases are row major numFrames x getNumBins(), phases
+	 may be NULL. numThreads <= 0 uses every hardware thread. */
+	void process(const float *samples, int numSamples, float *magnitudes, float *phases, int numThreads = 0) const;
+	/* frames firstFrame to lastFrame - 1 on the calling thread, written from
+	 the first row of magnitudes and phases. scratch, if not NULL, holds
+	 fftSize + getNumBins() floats and saves allocating them per call */
+	void processFrames(const float *samples, int numSamples, float *magnitudes, float *phases, int firstFrame, int lastFrame, float *scratch = NULL) const;
+	
+	int fftSize;
+	int hopSize;
+	
+private:
+	fftReal *_fft;
+	std::vector<float> window;
+	
+};
+
+
 class maxiFFTOctaveAnalyzer {
     /*based on code by David Bollinger, http://www.davebollinger.com/
      */
@@ -8,6 +8,8 @@
  */
 
 #include "maxiMFCC.h"
+#include <algorithm>
+#include <thread>
 
 
 #ifdef __APPLE_CC__
@@ -67,13 +69,132 @@ void maxiMFCCAnalyser<T>::melFilterAndLogSq_Part2(float *powerSpectrum) {
 }
 
 
+void maxiMelAnalyser::setup(int sampleRate, int fftSize, int hopSize, int _numFilters, int _numCoeffs, double minFreq, double maxFreq) {
+	stft.setup(fftSize, hopSize);
+	numFilters = _numFilters;
+	numCoeffs = std::min(_numCoeffs, _numFilters);
+	
+	double nyquist = sampleRate / 2.0;
+	if (maxFreq <= 0 || maxFreq > nyquist)
+		maxFreq = nyquist;
+	
+	//filter edges equally spaced in mels, each triangle spans its two neighbours
+	std::vector<double> edges(numFilters + 2);
+	double minMel = hzToMel(minFreq), maxMel = hzToMel(maxFreq);
+	for (int i = 0; i < numFilters + 2; i++)
+		edges[i] = melToHz(minMel + (maxMel - minMel) * i / (numFilters + 1));
+	
+	int bins = stft.getNumBins();
+	double binWidth = (double) sampleRate / fftSize;
+	filterStart.assign(numFilters, 0);
+	filterOffset.assign(numFilters + 1, 0);
+	filterWeights.clear();
+	
+	for (int filter = 0; filter < numFilters; filter++) {
+		double lower = edges[filter], centre = edges[filter + 1], upper = edges[filter + 2];
+		double height = 2.0 / (upper - lower);
+		int first = -1;
+		for (int bin = 0; bin < bins; bin++) {
+			double freq = bin * binWidth;
+			if (freq <= lower || freq >= upper)
+				continue;
+			if (first < 0)
+				first = bin;
+			double weight = freq < centre ? height * (freq - lower) / (centre - lower)
+										  : height * (upper - freq) / (upper - centre);
+			filterWeights.push_back(weight);
+		}
+		filterStart[filter] = first < 0 ? 0 : first;
+		filterOffset[filter + 1] = filterWeights.size();
+	}
+	
+	dctTransposed.assign(numFilters * numCoeffs, 0);
+	for (int j = 0; j < numFilters; j++) {
+		for (int i = 0; i < numCoeffs; i++) {
+			double scale = i == 0 ? sqrt(1.0 / numFilters) : sqrt(2.0 / numFilters);
+			dctTransposed[j * numCoeffs + i] = scale * cos(M_PI * i * (j + 0.5) / numFilters);
+		}
+	}
+}
 
+void maxiMelAnalyser::melSpectrogram(const float *samples, int numSamples, float *melBands, int numThreads) const {
+	run(samples, numSamples, melBands, false, numThreads);
+}
 
+void maxiMelAnalyser::mfcc(const float *samples, int numSamples, float *mfccs, int numThreads) const {
+	run(samples, numSamples, mfccs, true, numThreads);
+}
 
+void maxiMelAnalyser::run(const float *samples, int numSamples, float *output, bool toMfcc, int numThreads) const {
+	int numFrames = getNumFrames(numSamples);
+	int width = toMfcc ? numCoeffs : numFilters;
+	if (numThreads <= 0)
+		numThreads = std::thread::hardware_concurrency();
+	numThreads = std::max(1, std::min(numThreads, numFrames / 8));
+	
+	std::vector<std::thread> workers;
+	int framesPerThread = (numFrames + numThreads - 1) / numThreads;
+	for (int t = 1; t < numThreads; t++) {
+		int first = t * framesPerThread;
+		int last = std::min(numFrames, first + framesPerThread);
+		if (first < last)
+			workers.push_back(std::thread(&maxiMelAnalyser::processFrames, this, samples, numSamples,
+										  output + (size_t) first * width, toMfcc, first, last));
+	}
+	processFrames(samples, numSamples, output, toMfcc, 0, std::min(numFrames, framesPerThread));
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
 
+void maxiMelAnalyser::applyFilterbank(const float *power, float *melBands) const {
+	for (int filter = 0; filter < numFilters; filter++) {
+		const float *weights = &filterWeights[filterOffset[filter]];
+		const float *bins = power + filterStart[filter];
+		int length = filterOffset[filter + 1] - filterOffset[filter];
+		float sum = 0;
+		for (int k = 0; k < length; k++)
+			sum += weights[k] * bins[k];
+		melBands[filter] = sum;
+	}
+}
 
-
-
-
-
+void maxiMelAnalyser::processFrames(const float *samples, int numSamples, float *output, bool toMfcc, int firstFrame, int lastFrame) const {
+	//frames go through in small blocks so the spectra stay in cache
+	const int blockSize = 32;
+	const int bins = stft.getNumBins();
+	std::vector<float> spectra(blockSize * bins), bands(toMfcc ? blockSize * numFilters : 0);
+	
+	for (int block = firstFrame; block < lastFrame; block += blockSize) {
+		int count = std::min(blockSize, lastFrame - block);
+		stft.processFrames(samples, numSamples, &spectra[0], NULL, block, block + count);
+		float *blockOutput = output + (size_t) (block - firstFrame) * (toMfcc ? numCoeffs : numFilters);
+		float *melOut = toMfcc ? &bands[0] : blockOutput;
+		
+		for (int f = 0; f < count; f++) {
+			float *spectrum = &spectra[f * bins];
+			for (int k = 0; k < bins; k++)
+				spectrum[k] *= spectrum[k];
+			
+			applyFilterbank(spectrum, melOut + f * numFilters);
+		}
+		
+		if (!toMfcc)
+			continue;
+		
+		//log, then the DCT as (count x numFilters) * (numFilters x numCoeffs)
+		for (int i = 0; i < count * numFilters; i++)
+			bands[i] = logf(std::max(bands[i], 1e-10f));
+		for (int f = 0; f < count; f++) {
+			float *out = blockOutput + f * numCoeffs;
+			const float *mel = &bands[f * numFilters];
+			std::fill(out, out + numCoeffs, 0.0f);
+			for (int j = 0; j < numFilters; j++) {
+				const float value = mel[j];
+				const float *row = &dctTransposed[j * numCoeffs];
+				for (int i = 0; i < numCoeffs; i++)
+					out[i] += value * row[i];
+			}
+		}
+	}
+}
 
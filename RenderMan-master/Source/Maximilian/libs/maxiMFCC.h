@@ -203,3 +203,35 @@ private:
 
 typedef maxiMFCCAnalyser<double> maxiMFCC;
 //typedef maxiMFCCAnalyser<float> maxiFloatMFCC;
+
+
+/* Mel spectrograms and MFCCs of a whole buffer at once. The triangular mel
+ filters are stored sparsely (first bin plus the non-zero weights) and the
+ DCT is applied to blocks of frames as a matrix product, with frames split
+ across threads. Bands are mel weighted power, MFCCs are the orthonormal
+ DCT-II of their natural log. */
+class maxiMelAnalyser {
+public:
+	maxiMelAnalyser() : numFilters(0), numCoeffs(0) {};
+	void setup(int sampleRate, int fftSize, int hopSize, int numFilters, int numCoeffs, double minFreq, double maxFreq);
+	int getNumFrames(int numSamples) const { return stft.getNumFrames(numSamples); }
+	int getNumFilters() const { return numFilters; }
+	int getNumCoeffs() const { return numCoeffs; }
+	/* melBands is row major numFrames x numFilters */
+	void melSpectrogram(const float *samples, int numSamples, float *melBands, int numThreads = 0) const;
+	/* mfccs is row major numFrames x numCoeffs */
+	void mfcc(const float *samples, int numSamples, float *mfccs, int numThreads = 0) const;
+	/* one frame: a power spectrum of fftSize / 2 + 1 bins to numFilters bands */
+	void applyFilterbank(const float *power, float *melBands) const;
+	
+private:
+	void processFrames(const float *samples, int numSamples, float *output, bool toMfcc, int firstFrame, int lastFrame) const;
+	void run(const float *samples, int numSamples, float *output, bool toMfcc, int numThreads) const;
+	
+	maxiSTFT stft;
+	int numFilters, numCoeffs;
+	std::vector<int> filterStart, filterOffset;
+	std::vector<float> filterWeights;
+	std::vector<float> dctTransposed;  // numFilters x numCoeffs
+};
+
@@ -32,6 +32,12 @@
 
 #include "maximilian.h"
 #include "math.h"
+#include <algorithm>
+#if defined(OS_IS_UNIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /*  Maximilian can be configured to load ogg vorbis format files using the
 *   loadOgg() method.
@@ -732,7 +738,7 @@ bool maxiSample::loadOgg(string fileName, int channel) {
 	readChannel=channel;
     int channelx;
 //    cout << fileName << endl;
-    free(temp);
+    releaseData();
     myDataSize = stb_vorbis_decode_filename(const_cast<char*>(fileName.c_str()), &channelx, &temp);
     result = myDataSize > 0;
     printf("\nchannels = %d\nlength = %d",channelx,myDataSize);
@@ -762,93 +768,200 @@ void maxiSample::trigger() {
     recordPosition = 0;
 }
 
-//This is the main read function.
-bool maxiSample::read()
+//Maps a whole file privately: pages are shared with every other mapping
+//of the file until they are written to, then copied.
+static void* mapSampleFile(const string& path, size_t& size)
 {
-	bool result;
-	ifstream inFile( myPath.c_str(), ios::in | ios::binary);
-	result = inFile.is_open();
-	if (result) {
-		bool datafound = false;
-		inFile.seekg(4, ios::beg);
-		inFile.read( (char*) &myChunkSize, 4 ); // read the ChunkSize
-
-		inFile.seekg(16, ios::beg);
-		inFile.read( (char*) &mySubChunk1Size, 4 ); // read the SubChunk1Size
-
-		//inFile.seekg(20, ios::beg);
-		inFile.read( (char*) &myFormat, sizeof(short) ); // read the file format.  This should be 1 for PCM
-
-		//inFile.seekg(22, ios::beg);
-		inFile.read( (char*) &myChannels, sizeof(short) ); // read the # of channels (1 or 2)
-
-		//inFile.seekg(24, ios::beg);
-		inFile.read( (char*) &mySampleRate, sizeof(int) ); // read the samplerate
-
-		//inFile.seekg(28, ios::beg);
-		inFile.read( (char*) &myByteRate, sizeof(int) ); // read the byterate
-
-		//inFile.seekg(32, ios::beg);
-		inFile.read( (char*) &myBlockAlign, sizeof(short) ); // read the blockalign
-
-		//inFile.seekg(34, ios::beg);
-		inFile.read( (char*) &myBitsPerSample, sizeof(short) ); // read the bitspersample
-
-		//ignore any extra chunks
-		char chunkID[5]="";
-		chunkID[4] = 0;
-		int filePos = 20 + mySubChunk1Size;
-		while(!datafound && !inFile.eof()) {
-			inFile.seekg(filePos, ios::beg);
-			inFile.read((char*) &chunkID, sizeof(char) * 4);
-			inFile.seekg(filePos + 4, ios::beg);
-			inFile.read( (char*) &myDataSize, sizeof(int) ); // read the size of the data
-			filePos += 8;
-			if (strcmp(chunkID,"data") == 0) {
-				datafound = true;
-			}else{
-				filePos += myDataSize;
-			}
-		}
+#if defined(OS_IS_UNIX)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    void* data = NULL;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size = (size_t) info.st_size;
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+    }
+    close(fd);
+    return data;
+#elif defined(OS_IS_WIN)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER fileSize;
+    void* data = NULL;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (mapping != NULL) {
+            size = (size_t) fileSize.QuadPart;
+            data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return data;
+#else
+    return NULL;
+#endif
+}
 
-		// read the data chunk
-		char * myData = (char*) malloc(myDataSize * sizeof(char));
-		inFile.seekg(filePos, ios::beg);
-		inFile.read(myData, myDataSize);
-		length=myDataSize*(0.5/myChannels);
-		inFile.close(); // close the input file
-
-        cout << "Ch: " << myChannels << ", len: " << length << endl;
-		if (myChannels>1) {
-			int position=0;
-			int channel=readChannel*2;
-			for (int i=channel;i<myDataSize+6;i+=(myChannels*2)) {
-				myData[position]=myData[i];
-				myData[position+1]=myData[i+1];
-				position+=2;
-			}
-		}
+static void unmapSampleFile(void* data, size_t size)
+{
+#if defined(OS_IS_UNIX)
+    munmap(data, size);
+#elif defined(OS_IS_WIN)
+    UnmapViewOfFile(data);
+#endif
+}
+
+static inline unsigned int readLittleEndian(const unsigned char* bytes, int numBytes)
+{
+    unsigned int value = 0;
+    for (int i = 0; i < numBytes; i++)
+        value |= (unsigned int) bytes[i] << (8 * i);
+    return value;
+}
+
+//Frees or unmaps the sample data, whichever it is.
+void maxiSample::releaseData()
+{
+    if (mappedFile != NULL) {
+        unmapSampleFile(mappedFile, mappedSize);
+        mappedFile = NULL;
+        mappedSize = 0;
+    } else {
         free(temp);
-        temp = (short*) malloc(myDataSize * sizeof(char));
-        memcpy(temp, myData, myDataSize * sizeof(char));
+    }
+    mappedFrames = NULL;
+    temp = NULL;
+}
 
-        free(myData);
+//One sample of the mapped channel on temp's 16 bit scale. Deeper samples
+//keep their extra bits as the fraction.
+double maxiSample::mappedSample(long index) const
+{
+    const unsigned char* frame = mappedFrames + index * mappedStride;
+    if (mappedIsFloat) {
+        if (mappedBytesPerSample == 4) {
+            float single;
+            memcpy(&single, frame, 4);
+            return single * 32767.0;
+        }
+        double value;
+        memcpy(&value, frame, 8);
+        return value * 32767.0;
+    }
+    if (mappedBytesPerSample == 1)
+        return ((int) frame[0] - 128) * 256.0;
+    //shift up to sign extend from the top byte
+    const int value = (int) (readLittleEndian(frame, mappedBytesPerSample) << (32 - 8 * mappedBytesPerSample));
+    return value / 65536.0;
+}
+
+//The editing functions work on 16 bit samples in temp, so the first edit of
+//a sample still read from its mapping converts it.
+void maxiSample::makeWritable()
+{
+    if (mappedFrames == NULL)
+        return;
+    short* data = (short*) malloc(max((size_t) 2, (size_t) length * sizeof(short)));
+    for (long i = 0; i < length; i++)
+        data[i] = (short) lrint(maxiMap::clamp<double>(mappedSample(i), -32768.0, 32767.0));
+    releaseData();
+    temp = data;
+}
+
+//This is the main read function. It reads 8, 16, 24 and 32 bit PCM and
+//32 and 64 bit float wav files. The file stays mapped: 16 bit mono data is
+//used in place as temp, anything else is played from the requested channel
+//of the mapping at its own precision.
+bool maxiSample::read()
+{
+    releaseData();
 
-	}else {
+    size_t fileSize = 0;
+    unsigned char* file = (unsigned char*) mapSampleFile(myPath, fileSize);
+    if (file == NULL || fileSize < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        if (file != NULL)
+            unmapSampleFile(file, fileSize);
 //		cout << "ERROR: Could not load sample: " <<myPath << endl; //This line seems to be hated by windows
         printf("ERROR: Could not load sample.");
+        return false;
+    }
+
+    //walk the chunks, ignoring any we don't need
+    bool formatFound = false, dataFound = false;
+    size_t dataOffset = 0, dataBytes = 0;
+    short subFormat = 0;
+    size_t filePos = 12;
+    while (filePos + 8 <= fileSize && !dataFound) {
+        const unsigned char* chunk = file + filePos;
+        size_t chunkSize = readLittleEndian(chunk + 4, 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16 && filePos + 8 + chunkSize <= fileSize) {
+            mySubChunk1Size = (int) chunkSize;
+            myFormat = (short) readLittleEndian(chunk + 8, 2);
+            myChannels = (short) readLittleEndian(chunk + 10, 2);
+            mySampleRate = (int) readLittleEndian(chunk + 12, 4);
+            myByteRate = (int) readLittleEndian(chunk + 16, 4);
+            myBlockAlign = (short) readLittleEndian(chunk + 20, 2);
+            myBitsPerSample = (short) readLittleEndian(chunk + 22, 2);
+            //WAVE_FORMAT_EXTENSIBLE keeps the real format in its sub format
+            subFormat = (myFormat == (short) 0xFFFE && chunkSize >= 26) ? (short) readLittleEndian(chunk + 32, 2) : myFormat;
+            formatFound = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            dataOffset = filePos + 8;
+            dataBytes = min(chunkSize, fileSize - dataOffset);
+            dataFound = true;
+        }
+        filePos += 8 + chunkSize + (chunkSize & 1);
+    }
 
-	}
+    const int bytesPerSample = formatFound ? myBitsPerSample / 8 : 0;
+    const bool isFloat = subFormat == 3;
+    if (!dataFound || !formatFound || myChannels < 1 || myBlockAlign < myChannels * bytesPerSample
+        || (isFloat ? (bytesPerSample != 4 && bytesPerSample != 8) : (subFormat != 1 || bytesPerSample < 1 || bytesPerSample > 4))) {
+        unmapSampleFile(file, fileSize);
+        printf("ERROR: Unsupported wav format.");
+        return false;
+    }
 
+    length = (long) (dataBytes / myBlockAlign);
+    cout << "Ch: " << myChannels << ", len: " << length << endl;
 
-	return result; // this should probably be something more descriptive
+    mappedFile = file;
+    mappedSize = fileSize;
+    if (!isFloat && bytesPerSample == 2 && myChannels == 1 && dataOffset % 2 == 0) {
+        //zero copy
+        temp = (short*) (file + dataOffset);
+    } else {
+        int channel = max(0, min(readChannel, (int) myChannels - 1));
+        mappedFrames = file + dataOffset + channel * bytesPerSample;
+        mappedStride = myBlockAlign;
+        mappedBytesPerSample = bytesPerSample;
+        mappedIsFloat = isFloat;
+    }
+
+    //from here on the sample is 16 bit mono, which is what save() writes
+    //once makeWritable has converted it
+    myFormat = 1;
+    myChannels = 1;
+    myBitsPerSample = 16;
+    myBlockAlign = 2;
+    myByteRate = mySampleRate * 2;
+    mySubChunk1Size = 16;
+    myDataSize = (int) (length * 2);
+    myChunkSize = 36 + myDataSize;
+
+    return true;
 }
 
 //This plays back at the correct speed. Always loops.
 double maxiSample::play() {
 	position++;
 	if ((long) position >= length) position=0;
-	output = (double) temp[(long)position]/32767.0;
+	output = sampleAt((long)position)/32767.0;
 	return output;
 }
 
@@ -861,14 +974,14 @@ double maxiSample::playLoop(double start, double end) {
     position++;
     if (position < length * start) position = length * start;
     if ((long) position >= length * end) position = length * start;
-    output = (double) temp[(long)position]/32767.0;
+    output = sampleAt((long)position)/32767.0;
     return output;
 }
 
 double maxiSample::playUntil(double end) {
     position++;
     if ((long) position<length * end)
-        output = (double) temp[(long)position]/32767.0;
+        output = sampleAt((long)position)/32767.0;
     else {
         output=0;
     }
@@ -880,7 +993,7 @@ double maxiSample::playUntil(double end) {
 double maxiSample::playOnce() {
 	position++;
 	if ((long) position<length)
-        output = (double) temp[(long)position]/32767.0;
+        output = sampleAt((long)position)/32767.0;
     else {
         output=0;
     }
@@ -893,7 +1006,7 @@ double maxiSample::playOnce(double speed) {
 	position=position+((speed*chandiv)/(maxiSettings::sampleRate/mySampleRate));
 	double remainder = position - (long) position;
 	if ((long) position<length)
-		output = (double) ((1-remainder) * temp[1+ (long) position] + remainder * temp[2+(long) position])/32767;//linear interpolation
+		output = (double) ((1-remainder) * sampleAt(1+ (long) position) + remainder * sampleAt(2+(long) position))/32767;//linear interpolation
 	else
 		output=0;
 	return(output);
@@ -923,7 +1036,7 @@ double maxiSample::play(double speed) {
 		b=length-1;
 		}
 
-		output = (double) ((1-remainder) * temp[a] + remainder * temp[b])/32767;//linear interpolation
+		output = (double) ((1-remainder) * sampleAt(a) + remainder * sampleAt(b))/32767;//linear interpolation
 } else {
 		if ((long) position<0) position=length;
 		remainder = position - floor(position);
@@ -940,7 +1053,7 @@ double maxiSample::play(double speed) {
 			else {
 				b=0;
 			}
-		output = (double) ((-1-remainder) * temp[a] + remainder * temp[b])/32767;//linear interpolation
+		output = (double) ((-1-remainder) * sampleAt(a) + remainder * sampleAt(b))/32767;//linear interpolation
 	}
 	return(output);
 }
@@ -979,8 +1092,8 @@ double maxiSample::play(double frequency, double start, double end, double &pos)
 			b=length-1;
 		}
 
-		output = (double) ((1-remainder) * temp[a] +
-						   remainder * temp[b])/32767;//linear interpolation
+		output = (double) ((1-remainder) * sampleAt(a) +
+						   remainder * sampleAt(b))/32767;//linear interpolation
 	} else {
 		frequency*=-1.;
 		if ( pos <= start ) pos = end;
@@ -999,8 +1112,8 @@ double maxiSample::play(double frequency, double start, double end, double &pos)
 		else {
 			b=0;
 		}
-		output = (double) ((-1-remainder) * temp[a] +
-						   remainder * temp[b])/32767;//linear interpolation
+		output = (double) ((-1-remainder) * sampleAt(a) +
+						   remainder * sampleAt(b))/32767;//linear interpolation
 
 	}
 
@@ -1020,26 +1133,26 @@ double maxiSample::play4(double frequency, double start, double end) {
 		position += ((end-start)/(maxiSettings::sampleRate/(frequency*chandiv)));
 		remainder = position - floor(position);
 		if (position>0) {
-			a=temp[(int)(floor(position))-1];
+			a=sampleAt((int)(floor(position))-1);
 
 		} else {
-			a=temp[0];
+			a=sampleAt(0);
 
 		}
 
-		b=temp[(long) position];
+		b=sampleAt((long) position);
 		if (position<end-2) {
-			c=temp[(long) position+1];
+			c=sampleAt((long) position+1);
 
 		} else {
-			c=temp[0];
+			c=sampleAt(0);
 
 		}
 		if (position<end-3) {
-			d=temp[(long) position+2];
+			d=sampleAt((long) position+2);
 
 		} else {
-			d=temp[0];
+			d=sampleAt(0);
 		}
 		a1 = 0.5f * (c - a);
 		a2 = a - 2.5 * b + 2.f * c - 0.5f * d;
@@ -1052,26 +1165,26 @@ double maxiSample::play4(double frequency, double start, double end) {
 		position -= ((end-start)/(maxiSettings::sampleRate/(frequency*chandiv)));
 		remainder = position - floor(position);
 		if (position>start && position < end-1) {
-			a=temp[(long) position+1];
+			a=sampleAt((long) position+1);
 
 		} else {
-			a=temp[0];
+			a=sampleAt(0);
 
 		}
 
-		b=temp[(long) position];
+		b=sampleAt((long) position);
 		if (position>start) {
-			c=temp[(long) position-1];
+			c=sampleAt((long) position-1);
 
 		} else {
-			c=temp[0];
+			c=sampleAt(0);
 
 		}
 		if (position>start+1) {
-			d=temp[(long) position-2];
+			d=sampleAt((long) position-2);
 
 		} else {
-			d=temp[0];
+			d=sampleAt(0);
 		}
 		a1 = 0.5f * (c - a);
 		a2 = a - 2.5 * b + 2.f * c - 0.5f * d;
@@ -1279,12 +1392,14 @@ long maxiSample::getLength() {
 }
 
 void maxiSample::setLength(unsigned long numSamples) {
+    makeWritable();
     cout << "Length: " << numSamples << endl;
     short *newData = (short*) malloc(sizeof(short) * numSamples);
     if (NULL!=temp) {
         unsigned long copyLength = min((unsigned long)length, numSamples);
         memcpy(newData, temp, sizeof(short) * copyLength);
     }
+    releaseData();
     temp = newData;
     myDataSize = numSamples * 2;
     length=numSamples;
@@ -1293,6 +1408,7 @@ void maxiSample::setLength(unsigned long numSamples) {
 }
 
 void maxiSample::clear() {
+    makeWritable();
     memset(temp, 0, myDataSize);
 }
 
@@ -1301,6 +1417,7 @@ void maxiSample::reset() {
 }
 
 void maxiSample::normalise(float maxLevel) {
+    makeWritable();
     short maxValue = 0;
     for(int i=0; i < length; i++) {
         if (abs(temp[i]) > maxValue) {
@@ -1314,6 +1431,7 @@ void maxiSample::normalise(float maxLevel) {
 }
 
 void maxiSample::autoTrim(float alpha, float threshold, bool trimStart, bool trimEnd) {
+    makeWritable();
 
     int startMarker=0;
     if(trimStart) {
@@ -1347,7 +1465,7 @@ void maxiSample::autoTrim(float alpha, float threshold, bool trimStart, bool tri
         for(int i=0; i < newLength; i++) {
             newData[i] = temp[i+startMarker];
         }
-        free(temp);
+        releaseData();
         temp = newData;
         myDataSize = newLength * 2;
         length=newLength;
@@ -2197,47 +2315,64 @@ void maxiSampler::trigger() {
 
 ///*************************************************************
 ///
-/// Init most variables
+/// Init most variables. Every buffer the recorder will ever
+/// use is allocated here, so passData never touches the heap.
 ///
 ///*************************************************************
 maxiRecorder::maxiRecorder() :
-bufferSize(maxiSettings::sampleRate * 2),
-bufferQueueSize(3),
-bufferIndex(0),
+bufferSize(16384),
 recordedAmountFrames(0),
-threadRunning(false)
+writtenBytes(0),
+doRecord(false),
+format(pcm16),
+channels(1),
+sampleRate(44100)
 {
-
+    bufferPool.resize(bufferQueueSize * bufferSize);
+    currentBuffer.buffer = -1;
+    currentBuffer.count = 0;
+    freeBuffers.reset();
+    filledBuffers.reset();
 }
 
 ///*************************************************************
 ///
-/// Free resources in RAII manner and save to wav when this
-/// object lifetime is up!
+/// Finish the file in RAII manner if this object's lifetime is
+/// up while still recording.
 ///
 ///*************************************************************
 maxiRecorder::~maxiRecorder()
 {
-    if (isRecording()) saveToWav();
-    freeResources();
+    if (isRecording()) stopRecording();
 }
 
 ///*************************************************************
 ///
-/// Free resources only if they exist; may be called multiple
-/// times in it's lifetime becasuse of destructor.
+/// The rings hand buffer indices between passData (the only
+/// producer) and the writer thread (the only consumer) with
+/// no locks: each side owns one index and publishes it with
+/// release ordering.
 ///
 ///*************************************************************
-void maxiRecorder::freeResources()
+bool maxiRecorder::SlotRing::push(const Slot& _slot)
 {
-    if (savedBuffers.size() > 0)
-    {
-        for (int i = 0; i < savedBuffers.size(); ++i)
-        {
-            delete[] savedBuffers.front();
-            savedBuffers.pop();
-        }
-    }
+    const int h = head.load(std::memory_order_relaxed);
+    const int next = (h + 1) % (bufferQueueSize + 1);
+    if (next == tail.load(std::memory_order_acquire))
+        return false;
+    slots[h] = _slot;
+    head.store(next, std::memory_order_release);
+    return true;
+}
+
+bool maxiRecorder::SlotRing::pop(Slot& _slot)
+{
+    const int t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+        return false;
+    _slot = slots[t];
+    tail.store((t + 1) % (bufferQueueSize + 1), std::memory_order_release);
+    return true;
 }
 
 ///*************************************************************
@@ -2252,264 +2387,281 @@ bool maxiRecorder::isRecording() const
 
 ///*************************************************************
 ///
-/// Set the filename (and path)
+/// Set the filename (and path), the sample format, the sample
+/// rate and the channel count of the wav file.
 ///
 ///*************************************************************
-void maxiRecorder::setup(std::string _filename)
+void maxiRecorder::setup(std::string _filename, Format _format,
+                         int _sampleRate, int _channels)
 {
     filename = _filename;
+    format = _format;
+    sampleRate = _sampleRate;
+    channels = _channels;
 }
 
 ///*************************************************************
 ///
-/// You don't need to worry calling about this, this runs in a
-/// detached thread after calling startRecording() and means
-/// we can allocate new memory without interupting the real
-/// time audio callback. Rather than have multiple ifdefs to
-/// split up the same function to use different OS's threading
-/// services I just redefined the thing because it looked
-/// cleaner.
-///
-/// A pointer to the instanciated object from this class is
-/// passed as '_context'. We do this because we are calling this
-/// function from a static helper func and need to access object
-/// specific variables.
+/// Opens the file, writes a header that stopRecording() fills
+/// in later and starts the writer thread.
 ///
 ///*************************************************************
-#if defined(OS_IS_UNIX)
-void* maxiRecorder::update(void* _context)
-{
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	maxiRecorder* _this = static_cast<maxiRecorder*>(_context);
-	_this->threadRunning = true;
-	while (_this->doRecord)
-	{
-		usleep((long)(10000. / bufferSize / maxiSettings::sampleRate));
-		while (_this->bufferQueueSize > _this->bufferQueue.size())
-		{
-			_this->enqueueBuffer();
-		}
-	}
-	std::cout << "\nFinishing Recording..." << std::endl;
-	return 0;
-}
-#elif defined(OS_IS_WIN)
-void* maxiRecorder::update(void* _context)
+void maxiRecorder::startRecording()
 {
-	maxiRecorder* _this = static_cast<maxiRecorder*>(_context);
-  	_this->threadRunning = true;
-	long time = (long)(1000. / bufferSize / maxiSettings::sampleRate);
-	while (_this->doRecord)
-	{
-		Sleep(time);
-		while (_this->bufferQueueSize > _this->bufferQueue.size())
-		{
-			_this->enqueueBuffer();
-		}
-	}
-	std::cout << "\nFinishing Recording..." << std::endl;
-	return 0;
+    if (isRecording()) return;
+
+    stream.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+    {
+        std::cerr << "Failed to open file: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    recordedAmountFrames = 0;
+    writtenBytes = 0;
+    writeHeader(0);
+
+    freeBuffers.reset();
+    filledBuffers.reset();
+    for (int i = 0; i < bufferQueueSize; ++i)
+    {
+        Slot slot = { i, 0 };
+        freeBuffers.push(slot);
+    }
+    currentBuffer.buffer = -1;
+    currentBuffer.count = 0;
+
+    doRecord = true;
+    daemon = std::thread(&maxiRecorder::update, this);
 }
-#endif
 
 ///*************************************************************
 ///
-/// This whacks the update method into a detached thread which
-/// will ensure there are enough buffers available in the queue.
+/// Hands over the partly filled buffer, waits for the writer
+/// thread to drain everything and patches the sizes into the
+/// header.
 ///
 ///*************************************************************
-void maxiRecorder::startRecording()
+void maxiRecorder::stopRecording()
 {
-    doRecord = true;
-    for (int i = 0; i < bufferQueueSize; ++i)
+    if (!isRecording()) return;
+
+    if (currentBuffer.buffer >= 0 && currentBuffer.count > 0)
+        submitBuffer();
+
     {
-        enqueueBuffer();
+        std::lock_guard<std::mutex> lock(wakeLock);
+        doRecord = false;
     }
+    wakeUp.notify_one();
+    daemon.join();
 
-#if defined(OS_IS_UNIX)
-    if (pthread_create(&daemon, NULL, &maxiRecorder::update_pthread_helper, this) != 0)
-        std::cout << "pthread created incorrectly" << std::endl;
-    if (pthread_detach(daemon) != 0)
-        std::cout << "pthread detached incorrectly" << std::endl;
-#elif defined(OS_IS_WIN)
-	unsigned threadID;
-	daemonHandle = (HANDLE) _beginthreadex(NULL, 0, &maxiRecorder::update_pthread_helper, (void *) this, 0, &threadID);
-#endif
+    // The data chunk is padded to an even size.
+    if (writtenBytes % 2 != 0)
+        stream.put(0);
 
+    writeHeader(writtenBytes);
+    stream.close();
 
+    std::cout << "Wrote " << writtenBytes
+    << " bytes to " << filename.c_str()
+    << std::endl;
 }
 
 ///*************************************************************
 ///
-/// stops the recording thread by allowing the stack to unwind
-/// in update() and stops the Windows thread if necessary
+/// Kept for older code: the file is written as the data comes
+/// in, so all that is left is to finish it.
 ///
 ///*************************************************************
-void maxiRecorder::stopRecording()
+void maxiRecorder::saveToWav()
 {
-#if defined(OS_IS_WIN)
-	CloseHandle(daemonHandle);
-#endif
-    doRecord = false;
+    stopRecording();
 }
 
 ///*************************************************************
 ///
-/// Shamelessly hacked together largely using this link
-/// http://stackoverflow.com/questions/22226872/two-problems-
-/// when-writing-to-wav-c
-///
-/// I haven't bothered to change the syntax much here and the
-/// templated write function was too convenient during my
-/// struggle to get my head around wav headers so I've kept it
-/// very similar to the attached code.
-///
-/// A clear optimisation would be to make getProcessedData()
-/// return a vector of shorts to prevent another loop
+/// The writer thread. Sleeps until a buffer is filled, encodes
+/// it into the file and gives it back to the pool. Exits once
+/// recording is stopped and every filled buffer is written.
 ///
 ///*************************************************************
-template <typename T>
-void maxiRecorder::write(std::ofstream& _stream, const T& _t) {
-    _stream.write((const char*)&_t, sizeof(T));
-}
-
-void maxiRecorder::saveToWav()
+void maxiRecorder::update()
 {
-    if (isRecording()) stopRecording();
-    if (threadRunning)
+    Slot slot;
+    while (true)
     {
-#if defined(OS_IS_UNIX)
-        pthread_cancel(daemon);
-#endif
-        threadRunning = false;
-    }
-    std::vector<double> pcmData = getProcessedData();
-    std::vector<short> pcmDataInt;
-
-    pcmDataInt.resize(pcmData.size());
-
-    int sampleRate = maxiSettings::sampleRate;
-    short channels = maxiSettings::channels;
-    int   buffSize = pcmDataInt.size() * 2;
-
-    std::ofstream stream(filename.c_str(), std::ios::binary);
+        if (filledBuffers.pop(slot))
+        {
+            writeBuffer(slot);
+            slot.count = 0;
+            freeBuffers.push(slot);
+            continue;
+        }
 
-    if (stream.is_open())
-    {
-        /* Header */
-        stream.write("RIFF", 4);
-        write<int>(stream, 36 + buffSize);
-        stream.write("WAVE", 4);
-
-        /* Format Chunk */
-        stream.write("fmt ", 4);
-        write<int>(stream, 16);
-        write<short>(stream, 1);
-        write<short>(stream, channels);
-        write<int>(stream, sampleRate);
-        write<int>(stream, sampleRate * channels * sizeof(short));
-        write<short>(stream, channels * sizeof(short));
-        write<short>(stream, 8 * sizeof(short));
-
-        /* Data Chunk */
-        stream.write("data", 4);
-        stream.write((const char*) &buffSize, 4);
-        stream.write((const char*) pcmDataInt.data(), buffSize);
-
-        stream.close();
-
-        std::cout << "Wrote " << buffSize
-        << " bytes to " << filename.c_str()
-        << std::endl;
-    }
-    else
-    {
-        std::cerr << "Failed to open file: " << strerror(errno) << std::endl;
+        // The timeout covers a buffer that arrives between the pop above
+        // and the wait, passData never takes the lock.
+        std::unique_lock<std::mutex> lock(wakeLock);
+        if (filledBuffers.head != filledBuffers.tail)
+            continue;
+        if (!doRecord)
+            break;
+        wakeUp.wait_for(lock, std::chrono::milliseconds(10));
     }
 }
 
 ///*************************************************************
 ///
-/// This takes the queue of user generated arrays and whacks
-/// it into a vector of doubles which is easier to transverse
-/// and work with.
+/// Converts one buffer to the file's sample format. PCM is
+/// clipped to [-1, 1] and little endian like the rest of the
+/// header.
 ///
 ///*************************************************************
-std::vector<double> maxiRecorder::getProcessedData()
+void maxiRecorder::writeBuffer(const Slot& _slot)
 {
-    std::vector<double> userData;
-    int dataSize = savedBuffers.size() * bufferSize;
-    userData.resize(dataSize);
+    const double* data = &bufferPool[_slot.buffer * bufferSize];
+    const int bytesPerSample = format == pcm16 ? 2 : format == pcm24 ? 3 : 4;
+    encoded.resize(_slot.count * bytesPerSample);
+    char* out = encoded.data();
 
-    int savedIndex = 0;
-    for (int i = 0; i < dataSize; ++i)
+    for (int i = 0; i < _slot.count; ++i)
     {
-        if (i > 0 && i % bufferSize == 0)
+        if (format == float32)
         {
-            savedIndex = 0;
-            savedBuffers.pop();
+            const float value = (float) data[i];
+            memcpy(out, &value, 4);
+            out += 4;
+            continue;
         }
 
-        userData[i] = savedBuffers.front()[savedIndex];
-        ++savedIndex;
+        const double clipped = data[i] < -1.0 ? -1.0 : data[i] > 1.0 ? 1.0 : data[i];
+        const int value = (int) lrint(clipped * (format == pcm16 ? 32767.0 : 8388607.0));
+        *out++ = (char) (value & 0xff);
+        *out++ = (char) ((value >> 8) & 0xff);
+        if (format == pcm24)
+            *out++ = (char) ((value >> 16) & 0xff);
     }
 
-    double lastFrame = userData[userData.size() - 1];
-    while (lastFrame == 0)
-    {
-        userData.pop_back();
-        lastFrame = userData[userData.size() - 1];
-    }
-
-    return userData;
+    stream.write(encoded.data(), encoded.size());
+    writtenBytes += encoded.size();
 }
 
 ///*************************************************************
 ///
-/// Pass the buffer of audio to this method and it will write
-/// it to the right place. This method is real-time safe and
-/// is overriden for ofx's / port's floats array or maximilian's
-/// / rtaudio's double
+/// Started from this link, now written so the sizes can be
+/// filled in once the length is known:
+/// http://stackoverflow.com/questions/22226872/two-problems-
+/// when-writing-to-wav-c
+///
+/// Float files get the extended fmt chunk and the fact chunk
+/// that WAVE_FORMAT_IEEE_FLOAT asks for.
 ///
 ///*************************************************************
-void maxiRecorder::passData(const double* _in, int _inBufferSize)
+template <typename T>
+void maxiRecorder::write(std::ofstream& _stream, const T& _t) {
+    _stream.write((const char*)&_t, sizeof(T));
+}
+
+void maxiRecorder::writeHeader(long int _dataBytes)
 {
-    for (int i = 0; i < _inBufferSize; ++i)
+    const bool isFloat = format == float32;
+    const short bytesPerSample = format == pcm16 ? 2 : format == pcm24 ? 3 : 4;
+    const int fmtSize = isFloat ? 18 : 16;
+    const int factSize = isFloat ? 12 : 0;
+    const int paddedBytes = (int) (_dataBytes + (_dataBytes % 2));
+
+    stream.seekp(0);
+
+    /* Header */
+    stream.write("RIFF", 4);
+    write<int>(stream, 4 + (8 + fmtSize) + factSize + 8 + paddedBytes);
+    stream.write("WAVE", 4);
+
+    /* Format Chunk */
+    stream.write("fmt ", 4);
+    write<int>(stream, fmtSize);
+    write<short>(stream, isFloat ? 3 : 1);
+    write<short>(stream, (short) channels);
+    write<int>(stream, sampleRate);
+    write<int>(stream, sampleRate * channels * bytesPerSample);
+    write<short>(stream, (short) (channels * bytesPerSample));
+    write<short>(stream, (short) (8 * bytesPerSample));
+    if (isFloat)
     {
-        if (bufferIndex >= bufferSize)
-        {
-            bufferQueue.pop();
-            bufferIndex = 0;
-        }
-        bufferQueue.front()[bufferIndex] = _in[i] * 1000.0;
-        ++bufferIndex;
-        ++recordedAmountFrames;
+        write<short>(stream, 0);
+
+        /* Fact Chunk */
+        stream.write("fact", 4);
+        write<int>(stream, 4);
+        write<int>(stream, (int) (_dataBytes / (channels * bytesPerSample)));
     }
+
+    /* Data Chunk */
+    stream.write("data", 4);
+    write<int>(stream, (int) _dataBytes);
+
+    stream.seekp(0, std::ios::end);
 }
-void maxiRecorder::passData(const float* _in, int _inBufferSize)
+
+///*************************************************************
+///
+/// Hands the buffer being filled to the writer thread and
+/// takes the next free one. Only waits when the writer is a
+/// whole pool behind, which can only happen when data comes
+/// in faster than real time.
+///
+///*************************************************************
+void maxiRecorder::submitBuffer()
 {
-    for (int i = 0; i < _inBufferSize; ++i)
+    if (currentBuffer.buffer >= 0)
     {
-        if (bufferIndex >= bufferSize)
-        {
-            bufferQueue.pop();
-            bufferIndex = 0;
-        }
-        bufferQueue.front()[bufferIndex] = (double) _in[i];
-        ++bufferIndex;
-        ++recordedAmountFrames;
+        while (!filledBuffers.push(currentBuffer))
+            std::this_thread::yield();
+        wakeUp.notify_one();
+        currentBuffer.buffer = -1;
     }
+
+    while (!freeBuffers.pop(currentBuffer))
+        std::this_thread::yield();
+    currentBuffer.count = 0;
 }
 
 ///*************************************************************
 ///
-/// The method to instanciate new memory and ensure the correct
-/// structures have the correct addresses.
+/// Pass the buffer of audio to this method and it will write
+/// it to the right place. Samples are interleaved and in the
+/// range [-1, 1]. This method does not allocate and is
+/// overriden for ofx's / port's floats array or maximilian's
+/// / rtaudio's double
 ///
 ///*************************************************************
-void maxiRecorder::enqueueBuffer()
+template <typename T>
+void maxiRecorder::copyIn(const T* _in, int _inBufferSize)
+{
+    if (!isRecording()) return;
+
+    while (_inBufferSize > 0)
+    {
+        if (currentBuffer.buffer < 0 || currentBuffer.count == bufferSize)
+            submitBuffer();
+
+        const int amount = std::min(_inBufferSize, bufferSize - currentBuffer.count);
+        double* out = &bufferPool[currentBuffer.buffer * bufferSize + currentBuffer.count];
+        for (int i = 0; i < amount; ++i)
+            out[i] = (double) _in[i];
+
+        currentBuffer.count += amount;
+        _in += amount;
+        _inBufferSize -= amount;
+        recordedAmountFrames += amount / channels;
+    }
+}
+
+void maxiRecorder::passData(const double* _in, int _inBufferSize)
+{
+    copyIn(_in, _inBufferSize);
+}
+void maxiRecorder::passData(const float* _in, int _inBufferSize)
 {
-    double* b = new double[bufferSize];
-    bufferQueue.push(b);
-    savedBuffers.push(b);
+    copyIn(_in, _inBufferSize);
 }
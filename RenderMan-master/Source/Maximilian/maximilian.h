@@ -45,6 +45,10 @@
 #include <cerrno>
 #include <queue>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #if !defined(_WIN32) && (defined(unix) || defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__)))
 #define OS_IS_UNIX true
@@ -230,6 +234,22 @@ public:
 class maxiSample  {
 
 private:
+	void*	mappedFile;
+	size_t	mappedSize;
+	//The requested channel's first sample in the mapped file while it is
+	//read from there at the file's own precision, NULL once it is in temp.
+	const unsigned char* mappedFrames;
+	int	mappedStride;
+	int	mappedBytesPerSample;
+	bool	mappedIsFloat;
+	void	releaseData();
+	double	mappedSample(long index) const;
+	void	makeWritable();
+	//The sample at index on temp's 16 bit scale, with the fraction kept for
+	//24 bit, 32 bit and float files.
+	inline double sampleAt(long index) const {
+		return mappedFrames != NULL ? mappedSample(index) : temp[index];
+	}
 	string 	myPath;
 	int 	myChunkSize;
 	int	mySubChunk1Size;
@@ -253,6 +273,13 @@ public:
 
 
 //	char* 	myData;
+    // One channel of 16 bit samples. For 16 bit mono files this points
+    // straight into a private (copy on write) mapping of the file, so
+    // every instance and process loading it shares the same pages until
+    // one of them writes. Other wav files stay mapped too and are played
+    // at their own precision, temp is NULL for them until they are edited
+    // (loopRecord, normalise, autoTrim, setLength, clear, save), which
+    // converts them to 16 bit.
     short* temp;
 
 	// get/set for the Path property
@@ -260,12 +287,12 @@ public:
 	~maxiSample()
 	{
 //		if (myData) free(myData);
-        if (temp) free(temp);
+        releaseData();
         printf("freeing SampleData");
 
 	}
 
-    maxiSample():temp(NULL),position(0), recordPosition(0), myChannels(1), mySampleRate(maxiSettings::sampleRate) {};
+    maxiSample():mappedFile(NULL),mappedSize(0),mappedFrames(NULL),mappedStride(0),mappedBytesPerSample(0),mappedIsFloat(false),position(0), recordPosition(0), myChannels(1), mySampleRate(maxiSettings::sampleRate), temp(NULL) {};
 
     maxiSample& operator=(const maxiSample &source) {
         if (this == &source)
@@ -274,10 +301,17 @@ public:
         recordPosition = 0;
         myChannels = source.myChannels;
         mySampleRate = maxiSettings::sampleRate;
-        free(temp);
+        releaseData();
         myDataSize = source.myDataSize;
         temp = (short*) malloc(myDataSize * sizeof(char));
-        memcpy(temp, source.temp, myDataSize * sizeof(char));
+        if (source.mappedFrames != NULL) {
+            for (long i = 0; i < source.length; i++) {
+                const double value = source.mappedSample(i);
+                temp[i] = (short) lrint(value < -32768.0 ? -32768.0 : value > 32767.0 ? 32767.0 : value);
+            }
+        } else {
+            memcpy(temp, source.temp, myDataSize * sizeof(char));
+        }
         length = source.length;
         return *this;
     }
@@ -298,6 +332,7 @@ public:
         loopRecordLag.addSample(recordEnabled);
         if (recordPosition < start * length) recordPosition = start * length;
         if(recordEnabled) {
+            makeWritable();
             double currentSample = temp[(unsigned long)recordPosition] / 32767.0;
             newSample = (recordMix * currentSample) + ((1.0 - recordMix) * newSample);
             newSample *= loopRecordLag.value();
@@ -345,6 +380,7 @@ public:
 
 	bool save(string filename)
 	{
+        makeWritable();
         fstream myFile (filename.c_str(), ios::out | ios::binary);
 
         // write the wav file per the wav file format
@@ -825,46 +861,77 @@ public:
 class maxiRecorder
 {
 public:
+    enum Format
+    {
+        pcm16 = 0,
+        pcm24,
+        float32
+    };
+
     maxiRecorder();
     ~maxiRecorder();
 
-    void                setup(std::string _filename);
+    // The rate and channel count go into the wav header. They default to
+    // the global maxiSettings, read when setup is called.
+    void                setup(std::string _filename, Format _format = pcm16,
+                              int _sampleRate = maxiSettings::sampleRate,
+                              int _channels = maxiSettings::channels);
     void                startRecording();
     void                stopRecording();
     bool                isRecording() const;
     void                passData(const double* _in, int _inBufferSize);
     void                passData(const float*  _in, int _inBufferSize);
     void                saveToWav();
+    long int            getRecordedAmountFrames() const { return recordedAmountFrames; }
 
 private:
+    // A slot in one of the two rings: which pool buffer, and how many of
+    // its samples are valid.
+    struct Slot
+    {
+        int             buffer;
+        int             count;
+    };
+
+    // Single producer / single consumer ring of slots. The pool size is
+    // fixed so one spare entry is enough to tell full from empty.
+    struct SlotRing
+    {
+        Slot                slots[17];
+        std::atomic<int>    head;
+        std::atomic<int>    tail;
+        void                reset() { head = 0; tail = 0; }
+        bool                push(const Slot& _slot);
+        bool                pop(Slot& _slot);
+    };
+
     template <typename T>
     void                write(std::ofstream& _stream, const T& _t);
-    void*               update(void* _context);
-    std::vector<double> getProcessedData();
-    void                enqueueBuffer();
-    void                freeResources();
-    bool                threadRunning;
-    const int           bufferQueueSize;
+    template <typename T>
+    void                copyIn(const T* _in, int _inBufferSize);
+    void                update();
+    void                submitBuffer();
+    void                writeBuffer(const Slot& _slot);
+    void                writeHeader(long int _dataBytes);
+
+    static const int    bufferQueueSize = 16;
     const int           bufferSize;
-    long int            bufferIndex;
+    std::vector<double> bufferPool;
+    SlotRing            freeBuffers;
+    SlotRing            filledBuffers;
+    Slot                currentBuffer;
     long int            recordedAmountFrames;
-    std::queue<double*> bufferQueue;
-    std::queue<double*> savedBuffers;
-    bool                doRecord;
+    long int            writtenBytes;
+    std::atomic<bool>   doRecord;
+    std::thread         daemon;
+    std::mutex          wakeLock;
+    std::condition_variable wakeUp;
+    std::ofstream       stream;
+    std::vector<char>   encoded;
     std::string         filename;
-#if defined(OS_IS_UNIX)
-	pthread_t           daemon;
-	static void*        update_pthread_helper(void* _context)
-#elif defined(OS_IS_WIN)
-	HANDLE				daemonHandle;
-	static unsigned __stdcall
-                        update_pthread_helper(void* _context)
-#endif
-	{
-		maxiRecorder* _this = static_cast<maxiRecorder*>(_context);
-		_this->update(_this);
-		return 0;
-	}
+    Format              format;
+    int                 channels;
+    int                 sampleRate;
 };
 
 #endif
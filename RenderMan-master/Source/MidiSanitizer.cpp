@@ -0,0 +1,179 @@
+/*
+  ==============================================================================
+
+    MidiSanitizer.cpp
+
+  ==============================================================================
+*/
+
+#include "MidiSanitizer.h"
+
+namespace
+{
+    // Controllers whose repeats mean something: data entry and increments
+    // act on the selected (N)RPN, and 120 - 127 are channel mode messages.
+    bool isStatelessController (const int controller)
+    {
+        return controller == 6 || controller == 38
+            || (controller >= 96 && controller <= 101)
+            || controller >= 120;
+    }
+}
+
+//==============================================================================
+MidiSanitizeReport MidiSanitizer::process (MidiBuffer&    buffer,
+                                           const Options& options,
+                                           MidiBuffer&    hangingNoteOffs)
+{
+    MidiSanitizeReport report = MidiSanitizeReport();
+    report.eventsIn = buffer.getNumEvents();
+
+    // Last value per channel, -1 before the first one.
+    int controllers[16][128];
+    int pitchWheel[16];
+    int channelPressure[16];
+    std::fill (&controllers[0][0], &controllers[0][0] + 16 * 128, -1);
+    std::fill (pitchWheel, pitchWheel + 16, -1);
+    std::fill (channelPressure, channelPressure + 16, -1);
+
+    // Note-ons in the input not yet matched by a note-off, and the sample of
+    // the last one. A re-triggered note is ended once, by the note-off of
+    // its last note-on, the ones before it are dropped.
+    int pendingNotes[16][128];
+    int noteStarts[16][128];
+    std::fill (&pendingNotes[0][0], &pendingNotes[0][0] + 16 * 128, 0);
+    std::fill (&noteStarts[0][0], &noteStarts[0][0] + 16 * 128, -1);
+
+    MidiBuffer result;
+    result.ensureSize (size_t (buffer.data.size()));
+
+    MidiBuffer::Iterator it (buffer);
+    MidiMessage m;
+    int sampleNumber;
+
+    while (it.getNextEvent (m, sampleNumber))
+    {
+        if (m.isMetaEvent())
+        {
+            if (options.removeMetaEvents)
+            {
+                ++report.metaEventsRemoved;
+                continue;
+            }
+        }
+        else if (m.isSysEx())
+        {
+            if (options.removeSysEx)
+            {
+                ++report.sysExRemoved;
+                continue;
+            }
+        }
+        else if (m.getChannel() > 0)
+        {
+            const int channel = m.getChannel() - 1;
+
+            if (options.removeRedundantControllers)
+            {
+                int* lastValue = nullptr;
+                int value = 0;
+
+                if (m.isController() && ! isStatelessController (m.getControllerNumber()))
+                {
+                    lastValue = &controllers[channel][m.getControllerNumber()];
+                    value = m.getControllerValue();
+                }
+                else if (m.isPitchWheel())
+                {
+                    lastValue = &pitchWheel[channel];
+                    value = m.getPitchWheelValue();
+                }
+                else if (m.isChannelPressure())
+                {
+                    lastValue = &channelPressure[channel];
+                    value = m.getChannelPressureValue();
+                }
+                else if (m.isController() && m.getControllerNumber() == 121)
+                {
+                    std::fill (controllers[channel], controllers[channel] + 128, -1);
+                    pitchWheel[channel] = -1;
+                    channelPressure[channel] = -1;
+                }
+
+                if (lastValue != nullptr)
+                {
+                    if (*lastValue == value)
+                    {
+                        ++report.redundantControllersRemoved;
+                        continue;
+                    }
+                    *lastValue = value;
+                }
+            }
+
+            if (options.fixOverlappingNotes || options.closeHangingNotes)
+            {
+                if (m.isNoteOn())
+                {
+                    int& pending = pendingNotes[channel][m.getNoteNumber()];
+                    int& start = noteStarts[channel][m.getNoteNumber()];
+                    ++pending;
+                    if (pending > 1 && options.fixOverlappingNotes)
+                    {
+                        if (start == sampleNumber)
+                        {
+                            ++report.duplicateNoteOnsRemoved;
+                            continue;
+                        }
+                        result.addEvent (MidiMessage::noteOff (channel + 1, m.getNoteNumber()), sampleNumber);
+                        ++report.overlappingNotesEnded;
+                    }
+                    start = sampleNumber;
+                }
+                else if (m.isNoteOff())
+                {
+                    int& pending = pendingNotes[channel][m.getNoteNumber()];
+                    if (pending == 0)
+                    {
+                        if (options.fixOverlappingNotes)
+                        {
+                            ++report.strayNoteOffsRemoved;
+                            continue;
+                        }
+                    }
+                    else if (--pending > 0 && options.fixOverlappingNotes)
+                    {
+                        // Ended already, when the note was re-triggered.
+                        continue;
+                    }
+                }
+                else if (m.isAllNotesOff() || m.isAllSoundOff())
+                {
+                    std::fill (pendingNotes[channel], pendingNotes[channel] + 128, 0);
+                }
+            }
+        }
+
+        result.addEvent (m, sampleNumber);
+    }
+
+    hangingNoteOffs.clear();
+    if (options.closeHangingNotes)
+    {
+        for (int channel = 0; channel < 16; ++channel)
+        {
+            for (int note = 0; note < 128; ++note)
+            {
+                if (pendingNotes[channel][note] > 0)
+                {
+                    hangingNoteOffs.addEvent (MidiMessage::noteOff (channel + 1, note), 0);
+                    ++report.hangingNotesClosed;
+                }
+            }
+        }
+    }
+
+    buffer.swapWith (result);
+    report.eventsOut = buffer.getNumEvents();
+    return report;
+}
@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+
+    MidiSanitizer.h
+
+  ==============================================================================
+*/
+
+#ifndef MIDISANITIZER_H_INCLUDED
+#define MIDISANITIZER_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// What one MidiSanitizer::process call changed.
+struct MidiSanitizeReport
+{
+    int eventsIn;
+    int eventsOut;
+    int metaEventsRemoved;
+    int sysExRemoved;
+    int redundantControllersRemoved;
+    int duplicateNoteOnsRemoved;
+    int overlappingNotesEnded;
+    int strayNoteOffsRemoved;
+    int hangingNotesClosed;
+};
+
+//==============================================================================
+// Cleans up the MIDI of a render before the plugin sees it. Files written by
+// pretty_midi and the LMD carry tempo, time signature and track name meta
+// events, sysex, controller values repeated many times over, overlapping
+// notes of the same pitch and notes that are never released. Each of those
+// costs the plugin MIDI handling per block, and a note left hanging rings on
+// into the tail.
+class MidiSanitizer
+{
+public:
+    struct Options
+    {
+        Options() :
+            removeMetaEvents (true),
+            removeSysEx (true),
+            removeRedundantControllers (true),
+            fixOverlappingNotes (true),
+            closeHangingNotes (true)
+        {
+        }
+
+        bool removeMetaEvents;
+        bool removeSysEx;
+
+        // Drops controller, pitch wheel and channel pressure messages that
+        // repeat the value already set on their channel. RPN/NRPN data and
+        // channel mode messages are always kept.
+        bool removeRedundantControllers;
+
+        // A note-on for a pitch that is still sounding on its channel ends
+        // the earlier note first, and the earlier note's own note-off is
+        // dropped so that it does not cut the new one short. A second
+        // note-on at the same sample is dropped, as are note-offs left
+        // without a note.
+        bool fixOverlappingNotes;
+
+        // Notes still on after the last event get a note-off in
+        // hangingNoteOffs, for the caller to send at the end of the render.
+        bool closeHangingNotes;
+    };
+
+    // Rewrites buffer in place and returns what changed. hangingNoteOffs is
+    // cleared and gets the note-offs of hanging notes, all at sample 0.
+    static MidiSanitizeReport process (MidiBuffer&    buffer,
+                                       const Options& options,
+                                       MidiBuffer&    hangingNoteOffs);
+};
+
+#endif  // MIDISANITIZER_H_INCLUDED
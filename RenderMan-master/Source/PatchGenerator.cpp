@@ -10,6 +10,126 @@
 
 #include "PatchGenerator.h"
 
+namespace
+{
+    //==========================================================================
+    // Top 24 bits of a random word as a float in [0, 1).
+    inline float unitFloat (const uint64 bits)
+    {
+        return float (bits >> 40) * (1.0f / 16777216.0f);
+    }
+
+    // Unbiased enough for shuffling: the modulo bias of a 64 bit draw is
+    // far below float resolution.
+    inline int randomBelow (std::mt19937_64& generator, const int limit)
+    {
+        return int (generator() % uint64 (limit));
+    }
+
+    //==========================================================================
+    // Multiplies two polynomials over GF(2) modulo a polynomial of the given
+    // degree. Bit i holds the coefficient of x^i.
+    uint64 multiplyModulo (uint64 a, uint64 b, const uint64 modulus, const int degree)
+    {
+        uint64 result = 0;
+        while (b != 0)
+        {
+            if (b & 1)
+                result ^= a;
+            b >>= 1;
+            a <<= 1;
+            if (a >> degree)
+                a ^= modulus;
+        }
+        return result;
+    }
+
+    uint64 powerOfX (uint64 exponent, const uint64 modulus, const int degree)
+    {
+        uint64 result = 1;
+        uint64 base = 2;
+        if (base >> degree)
+            base ^= modulus;
+
+        while (exponent != 0)
+        {
+            if (exponent & 1)
+                result = multiplyModulo (result, base, modulus, degree);
+            base = multiplyModulo (base, base, modulus, degree);
+            exponent >>= 1;
+        }
+        return result;
+    }
+
+    // A polynomial of degree d is primitive when x has order 2^d - 1 modulo
+    // it, i.e. x^n == 1 but x^(n/q) != 1 for every prime factor q of n.
+    bool isPrimitive (const uint64 polynomial, const int degree)
+    {
+        const uint64 order = (uint64 (1) << degree) - 1;
+
+        if (powerOfX (order, polynomial, degree) != 1)
+            return false;
+
+        uint64 remaining = order;
+        for (uint64 factor = 2; remaining > 1; ++factor)
+        {
+            if (factor * factor > remaining)
+                factor = remaining;
+
+            if (remaining % factor != 0)
+                continue;
+
+            if (powerOfX (order / factor, polynomial, degree) == 1)
+                return false;
+
+            while (remaining % factor == 0)
+                remaining /= factor;
+        }
+
+        return true;
+    }
+
+    // The first count primitive polynomials over GF(2), by ascending degree.
+    std::vector<std::pair<uint64, int>> primitivePolynomials (const size_t count)
+    {
+        std::vector<std::pair<uint64, int>> polynomials;
+        polynomials.reserve (count);
+
+        for (int degree = 1; degree < 32 && polynomials.size() < count; ++degree)
+        {
+            const uint64 top = uint64 (1) << degree;
+            for (uint64 low = 1; low < top && polynomials.size() < count; low += 2)
+                if (isPrimitive (top | low, degree))
+                    polynomials.push_back (std::make_pair (top | low, degree));
+        }
+
+        return polynomials;
+    }
+}
+
+//==============================================================================
+void PatchGenerator::initialise (RenderEngine& engine)
+{
+    skeletonPatch = engine.getPatch();
+    for (auto& parameter : skeletonPatch)
+        parameter.second = 0.0f;
+
+    const size_t size = skeletonPatch.size();
+    parameterIndices.resize (size);
+    rangeStarts.assign (size, 0.0f);
+    rangeEnds.assign (size, 1.0f);
+    fixedValues.resize (size);
+    sampled.assign (size, 1);
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        parameterIndices[i] = skeletonPatch[i].first;
+        fixedValues[i] = engine.getParameter (skeletonPatch[i].first);
+    }
+
+    updateSampledColumns();
+}
+
 //==============================================================================
 std::pair<int, float> PatchGenerator::getRandomParameter (int index)
 {
@@ -27,3 +147,253 @@ PluginPatch PatchGenerator::getRandomPatch()
         parameter.second = distribution (generator);
     return randomPatch;
 }
+
+//==============================================================================
+void PatchGenerator::setSeed (const uint64 seed)
+{
+    generator.seed (seed);
+    resetSobol();
+}
+
+//==============================================================================
+int PatchGenerator::findColumn (const int parameterIndex) const
+{
+    auto iterator = std::find (parameterIndices.begin(),
+                               parameterIndices.end(),
+                               parameterIndex);
+
+    if (iterator == parameterIndices.end())
+        return -1;
+
+    return int (iterator - parameterIndices.begin());
+}
+
+//==============================================================================
+bool PatchGenerator::setParameterRange (const int   parameterIndex,
+                                        const float start,
+                                        const float end)
+{
+    const int column = findColumn (parameterIndex);
+
+    if (column < 0)
+    {
+        std::cout << "PatchGenerator::setParameterRange error: " <<
+                     "Parameter index is not in the patch." << std::endl;
+        return false;
+    }
+    else if (start < 0.0 || end > 1.0 || start > end)
+    {
+        std::cout << "PatchGenerator::setParameterRange error: " <<
+                     "Keep the range between 0.0 and 1.0 with start <= end." <<
+                     std::endl;
+        return false;
+    }
+
+    rangeStarts[column] = start;
+    rangeEnds[column] = end;
+    return true;
+}
+
+//==============================================================================
+bool PatchGenerator::setParameterMask (const int  parameterIndex,
+                                       const bool shouldBeSampled)
+{
+    const int column = findColumn (parameterIndex);
+
+    if (column < 0)
+    {
+        std::cout << "PatchGenerator::setParameterMask error: " <<
+                     "Parameter index is not in the patch." << std::endl;
+        return false;
+    }
+
+    if (bool (sampled[column]) != shouldBeSampled)
+    {
+        sampled[column] = shouldBeSampled ? 1 : 0;
+        updateSampledColumns();
+    }
+    return true;
+}
+
+//==============================================================================
+void PatchGenerator::updateSampledColumns()
+{
+    sampledColumns.clear();
+    for (size_t i = 0; i < sampled.size(); ++i)
+        if (sampled[i])
+            sampledColumns.push_back (int (i));
+
+    // Sobol dimensions map onto sampled columns, so start a new sequence.
+    resetSobol();
+}
+
+//==============================================================================
+void PatchGenerator::generateBatch (float*               destination,
+                                    const int            numPatches,
+                                    const SamplingMethod method)
+{
+    const size_t numColumns = parameterIndices.size();
+    if (numPatches <= 0 || numColumns == 0)
+        return;
+
+    // Masked columns keep their fixed value, sampled ones get overwritten.
+    for (int row = 0; row < numPatches; ++row)
+        std::copy (fixedValues.begin(), fixedValues.end(),
+                   destination + row * numColumns);
+
+    // With every parameter masked there is nothing to sample, and no Sobol
+    // directions to index.
+    if (sampledColumns.empty())
+        return;
+
+    switch (method)
+    {
+        case sobolSampling:          fillSobol (destination, numPatches); break;
+        case latinHypercubeSampling: fillLatinHypercube (destination, numPatches); break;
+        default:                     fillUniform (destination, numPatches); break;
+    }
+}
+
+//==============================================================================
+void PatchGenerator::fillUniform (float* destination, const int numPatches)
+{
+    const size_t numColumns = parameterIndices.size();
+    const size_t numSampled = sampledColumns.size();
+
+    for (int row = 0; row < numPatches; ++row)
+    {
+        float* const rowData = destination + row * numColumns;
+
+        // Each 64 bit draw gives two 24 bit floats.
+        for (size_t i = 0; i < numSampled; i += 2)
+        {
+            const uint64 bits = generator();
+            const int first = sampledColumns[i];
+            rowData[first] = rangeStarts[first]
+                           + unitFloat (bits) * (rangeEnds[first] - rangeStarts[first]);
+
+            if (i + 1 < numSampled)
+            {
+                const int second = sampledColumns[i + 1];
+                rowData[second] = rangeStarts[second]
+                                + unitFloat (bits << 24) * (rangeEnds[second] - rangeStarts[second]);
+            }
+        }
+    }
+}
+
+//==============================================================================
+void PatchGenerator::resetSobol()
+{
+    // Dimension zero is the van der Corput sequence; every other dimension
+    // uses the next primitive polynomial with random odd initial direction
+    // numbers. A random digital shift per dimension scrambles the sequence
+    // so different seeds give different, equally uniform, point sets.
+    const size_t numDimensions = sampledColumns.size();
+    const int bits = 32;
+
+    sobolDirections.assign (numDimensions * bits, 0);
+    sobolShifts.resize (numDimensions);
+    sobolState.assign (numDimensions, 0);
+    sobolIndex = 0;
+
+    if (numDimensions == 0)
+        return;
+
+    const std::vector<std::pair<uint64, int>> polynomials = primitivePolynomials (numDimensions - 1);
+    std::vector<uint64> m (bits + 1);
+
+    for (size_t dimension = 0; dimension < numDimensions; ++dimension)
+    {
+        uint32* const directions = &sobolDirections[dimension * bits];
+
+        if (dimension == 0)
+        {
+            for (int k = 1; k <= bits; ++k)
+                m[k] = 1;
+        }
+        else
+        {
+            const uint64 polynomial = polynomials[dimension - 1].first;
+            const int degree = polynomials[dimension - 1].second;
+
+            for (int k = 1; k <= degree && k <= bits; ++k)
+                m[k] = (generator() % (uint64 (1) << (k - 1))) * 2 + 1;
+
+            for (int k = degree + 1; k <= bits; ++k)
+            {
+                uint64 value = m[k - degree] ^ (m[k - degree] << degree);
+                for (int i = 1; i < degree; ++i)
+                    if ((polynomial >> (degree - i)) & 1)
+                        value ^= m[k - i] << i;
+                m[k] = value;
+            }
+        }
+
+        for (int k = 1; k <= bits; ++k)
+            directions[k - 1] = uint32 (m[k] << (bits - k));
+
+        sobolShifts[dimension] = uint32 (generator());
+    }
+}
+
+//==============================================================================
+void PatchGenerator::fillSobol (float* destination, const int numPatches)
+{
+    const size_t numColumns = parameterIndices.size();
+    const size_t numDimensions = sampledColumns.size();
+
+    for (int row = 0; row < numPatches; ++row)
+    {
+        float* const rowData = destination + row * numColumns;
+
+        for (size_t dimension = 0; dimension < numDimensions; ++dimension)
+        {
+            const int column = sampledColumns[dimension];
+            const uint32 point = sobolState[dimension] ^ sobolShifts[dimension];
+            const float unit = float (point >> 8) * (1.0f / 16777216.0f);
+            rowData[column] = rangeStarts[column] + unit * (rangeEnds[column] - rangeStarts[column]);
+        }
+
+        // Gray code order: flip the direction number of the lowest zero bit.
+        int bit = 0;
+        while ((sobolIndex >> bit) & 1)
+            ++bit;
+
+        if (bit < 32)
+        {
+            const uint32* const directions = &sobolDirections[bit];
+            for (size_t dimension = 0; dimension < numDimensions; ++dimension)
+                sobolState[dimension] ^= directions[dimension * 32];
+        }
+        ++sobolIndex;
+    }
+}
+
+//==============================================================================
+void PatchGenerator::fillLatinHypercube (float* destination, const int numPatches)
+{
+    const size_t numColumns = parameterIndices.size();
+    const double strataWidth = 1.0 / numPatches;
+    strata.resize (numPatches);
+
+    // Every column gets each of the numPatches strata exactly once, in a
+    // fresh random order, with a random position inside the stratum.
+    for (const int column : sampledColumns)
+    {
+        for (int i = 0; i < numPatches; ++i)
+            strata[i] = i;
+
+        for (int i = numPatches - 1; i > 0; --i)
+            std::swap (strata[i], strata[randomBelow (generator, i + 1)]);
+
+        const float start = rangeStarts[column];
+        const float width = rangeEnds[column] - start;
+
+        for (int row = 0; row < numPatches; ++row)
+        {
+            const double unit = (strata[row] + unitFloat (generator())) * strataWidth;
+            destination[row * numColumns + column] = start + float (unit) * width;
+        }
+    }
+}
@@ -14,26 +14,93 @@
 #include "RenderEngine.h"
 
 //==============================================================================
+// Generates random patches for the plugin loaded in an engine. Batches are
+// written as a row major numPatches x getNumParameters() float matrix whose
+// columns follow the engine's patch order (see getParameterIndices), so a
+// row can be handed straight to RenderEngine::setPatchValues.
 class PatchGenerator
 {
 
 public:
+    enum SamplingMethod
+    {
+        uniformSampling = 0,
+        sobolSampling,
+        latinHypercubeSampling
+    };
+
     PatchGenerator (RenderEngine& engine) :
         generator (std::random_device()())
     {
-        skeletonPatch = engine.getPatch();
-        for (auto& parameter : skeletonPatch)
-            parameter.second = 0.0f;
+        initialise (engine);
+    }
+
+    // Two generators with the same seed and settings produce the same patches.
+    PatchGenerator (RenderEngine& engine, const uint64 seed) :
+        generator (seed)
+    {
+        initialise (engine);
     }
 
     std::pair<int, float> getRandomParameter (int index);
 
     PluginPatch getRandomPatch();
 
+    void setSeed (const uint64 seed);
+
+    int getNumParameters() const {
+        return int (parameterIndices.size());
+    };
+
+    const std::vector<int>& getParameterIndices() const {
+        return parameterIndices;
+    };
+
+    // Sampled values for the parameter are mapped into [start, end].
+    bool setParameterRange (const int parameterIndex, const float start, const float end);
+
+    // Parameters that are masked out are not sampled and keep the value the
+    // plugin had when the generator was created.
+    bool setParameterMask (const int parameterIndex, const bool shouldBeSampled);
+
+    // Fills numPatches rows. Sobol rows continue the sequence from the
+    // previous batch until the seed or mask change; Latin hypercube rows
+    // are stratified within each batch.
+    void generateBatch (float*               destination,
+                        const int            numPatches,
+                        const SamplingMethod method);
+
 private:
-    PluginPatch skeletonPatch;
-    
+    void initialise (RenderEngine& engine);
+
+    int findColumn (const int parameterIndex) const;
+
+    void updateSampledColumns();
+
+    void fillUniform (float* destination, const int numPatches);
+
+    void fillSobol (float* destination, const int numPatches);
+
+    void fillLatinHypercube (float* destination, const int numPatches);
+
+    void resetSobol();
+
+    PluginPatch        skeletonPatch;
+    std::vector<int>   parameterIndices;
+    std::vector<float> rangeStarts;
+    std::vector<float> rangeEnds;
+    std::vector<float> fixedValues;
+    std::vector<char>  sampled;
+    std::vector<int>   sampledColumns;
+
     std::mt19937_64 generator;
+
+    std::vector<uint32> sobolDirections;
+    std::vector<uint32> sobolShifts;
+    std::vector<uint32> sobolState;
+    uint32              sobolIndex;
+
+    std::vector<int>    strata;
 };
 
 #endif  // PATCHGENERATOR_H_INCLUDED
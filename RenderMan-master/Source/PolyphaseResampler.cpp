@@ -0,0 +1,174 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.cpp
+
+  ==============================================================================
+*/
+
+#include "PolyphaseResampler.h"
+
+namespace
+{
+    //==========================================================================
+    // Zeroth order modified Bessel function of the first kind.
+    double besselI0 (const double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 64 && term > sum * 1e-12; ++k)
+        {
+            term *= (x * 0.5 / k) * (x * 0.5 / k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    int64 greatestCommonDivisor (int64 a, int64 b)
+    {
+        while (b != 0)
+        {
+            const int64 remainder = a % b;
+            a = b;
+            b = remainder;
+        }
+        return a;
+    }
+
+    // Four partial sums keep the loop free of a serial dependency so it
+    // vectorises without relaxed floating point.
+    inline float dotProduct (const float* __restrict a, const float* __restrict b, const int size)
+    {
+        float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+        int i = 0;
+        for (; i + 4 <= size; i += 4)
+        {
+            sum0 += a[i]     * b[i];
+            sum1 += a[i + 1] * b[i + 1];
+            sum2 += a[i + 2] * b[i + 2];
+            sum3 += a[i + 3] * b[i + 3];
+        }
+        for (; i < size; ++i)
+            sum0 += a[i] * b[i];
+        return (sum0 + sum1) + (sum2 + sum3);
+    }
+}
+
+//==============================================================================
+PolyphaseResampler::PolyphaseResampler (int inRate,
+                                        int outRate,
+                                        int zeroCrossings) :
+    inputRate (inRate),
+    outputRate (outRate)
+{
+    const int64 divisor = greatestCommonDivisor (inRate, outRate);
+    upFactor = outRate / divisor;
+    downFactor = inRate / divisor;
+
+    if (upFactor == 1 && downFactor == 1)
+    {
+        // Same rate, a single unit tap.
+        tapsPerPhase = 1;
+        delay = 0;
+        phases.assign (1, 1.0f);
+        reset();
+        return;
+    }
+
+    // Cutoff just below the lower Nyquist frequency, as a fraction of the
+    // upsampled rate.
+    const double rolloff = 0.95;
+    const double cutoff = rolloff * 0.5 * jmin (inRate, outRate) / (double (inRate) * upFactor);
+    const double beta = 8.6;
+
+    delay = int64 (std::ceil (zeroCrossings / (2.0 * cutoff)));
+    const int64 length = 2 * delay + 1;
+    tapsPerPhase = int ((length + upFactor - 1) / upFactor);
+
+    std::vector<double> prototype (size_t (tapsPerPhase * upFactor), 0.0);
+    const double windowNorm = besselI0 (beta);
+
+    for (int64 n = 0; n < length; ++n)
+    {
+        const double x = double (n - delay);
+        const double sinc = x == 0.0 ? 1.0
+                                     : std::sin (2.0 * double_Pi * cutoff * x) / (2.0 * double_Pi * cutoff * x);
+        const double ratio = x / double (delay);
+        const double window = besselI0 (beta * std::sqrt (jmax (0.0, 1.0 - ratio * ratio))) / windowNorm;
+
+        // Gain L makes up for the zeros the upsampling inserts.
+        prototype[size_t (n)] = double (upFactor) * 2.0 * cutoff * sinc * window;
+    }
+
+    phases.resize (size_t (tapsPerPhase * upFactor));
+    for (int64 p = 0; p < upFactor; ++p)
+        for (int j = 0; j < tapsPerPhase; ++j)
+            phases[size_t (p * tapsPerPhase + j)] = float (prototype[size_t (p + (tapsPerPhase - 1 - j) * upFactor)]);
+
+    reset();
+}
+
+//==============================================================================
+void PolyphaseResampler::reset()
+{
+    history.assign (size_t (tapsPerPhase - 1), 0.0f);
+    historyStart = -(tapsPerPhase - 1);
+    received = 0;
+    produced = 0;
+    output.clear();
+}
+
+//==============================================================================
+void PolyphaseResampler::process (const float* input, const int numSamples)
+{
+    history.insert (history.end(), input, input + numSamples);
+    received += numSamples;
+    produce (false);
+}
+
+//==============================================================================
+void PolyphaseResampler::finish()
+{
+    produce (true);
+}
+
+//==============================================================================
+void PolyphaseResampler::produce (const bool flush)
+{
+    // Output n is centred on upsampled position n * M, i.e. filter output
+    // n * M + delay, which needs input up to index (n * M + delay) / L.
+    const int64 total = (received * upFactor + downFactor - 1) / downFactor;
+
+    if (flush && total > 0)
+    {
+        // Enough zeros for every remaining output to see its full branch.
+        const int64 lastInput = ((total - 1) * downFactor + delay) / upFactor;
+        const int64 needed = lastInput + 1 - historyStart;
+        if (needed > int64 (history.size()))
+            history.resize (size_t (needed), 0.0f);
+    }
+
+    const int64 available = historyStart + int64 (history.size());
+
+    for (; produced < total; ++produced)
+    {
+        const int64 position = produced * downFactor + delay;
+        const int64 newest = position / upFactor;
+        if (newest >= available)
+            break;
+
+        const int64 phase = position % upFactor;
+        const float* branch = phases.data() + phase * tapsPerPhase;
+        const float* samples = history.data() + (newest - (tapsPerPhase - 1) - historyStart);
+        output.push_back (dotProduct (branch, samples, tapsPerPhase));
+    }
+
+    // Drop input that no later output reaches.
+    const int64 oldestNeeded = (produced * downFactor + delay) / upFactor - (tapsPerPhase - 1);
+    const int64 consumed = jmin (oldestNeeded - historyStart, int64 (history.size()));
+    if (consumed > 4096)
+    {
+        history.erase (history.begin(), history.begin() + consumed);
+        historyStart += consumed;
+    }
+}
@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.h
+
+  ==============================================================================
+*/
+
+#ifndef POLYPHASERESAMPLER_H_INCLUDED
+#define POLYPHASERESAMPLER_H_INCLUDED
+
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// Streaming rational resampler. The rate ratio is reduced to L / M. The
+// input is conceptually upsampled by L and filtered with one Kaiser
+// windowed sinc, then decimated by M. Only the L polyphase branches of that
+// filter are ever evaluated, each a short dot product over contiguous input.
+//
+// Output sample n lines up with input time n * inputRate / outputRate (the
+// filter delay is compensated), and a finished stream of N input samples
+// gives ceil(N * outputRate / inputRate) output samples.
+class PolyphaseResampler
+{
+public:
+    // zeroCrossings sets the filter length on each side of its centre, in
+    // zero crossings of the lower of the two rates.
+    PolyphaseResampler (int inputRate,
+                        int outputRate,
+                        int zeroCrossings = 32);
+
+    int getInputRate() const {
+        return inputRate;
+    };
+
+    int getOutputRate() const {
+        return outputRate;
+    };
+
+    // Starts a new stream and clears the output.
+    void reset();
+
+    // Appends the output that these samples complete.
+    void process (const float* input, const int numSamples);
+
+    // Flushes the tail of the stream with zeros.
+    void finish();
+
+    const std::vector<float>& getOutput() const {
+        return output;
+    };
+
+private:
+    void produce (const bool flush);
+
+    int                inputRate;
+    int                outputRate;
+    int64              upFactor;      // L
+    int64              downFactor;    // M
+    int                tapsPerPhase;  // K
+    int64              delay;         // filter centre, upsampled samples
+
+    // Phase p holds taps h[p + (K - 1 - j) * L] for j = 0 .. K - 1, so a
+    // branch lines up with K consecutive input samples in time order.
+    std::vector<float> phases;
+
+    // Input from global sample index historyStart, preceded by K - 1 zeros
+    // at the start of a stream.
+    std::vector<float> history;
+    int64              historyStart;
+    int64              received;
+    int64              produced;
+    std::vector<float> output;
+};
+
+#endif  // POLYPHASERESAMPLER_H_INCLUDED
@@ -0,0 +1,152 @@
+/*
+  ==============================================================================
+
+    RenderCache.cpp
+
+  ==============================================================================
+*/
+
+#include "RenderCache.h"
+
+namespace
+{
+    const char* const magic = "SLKHRNDR";
+    const int headerSize = 16;
+}
+
+//==============================================================================
+RenderCache::RenderCache (const File& cacheDirectory,
+                          int64       maxCacheSize) :
+    directory (cacheDirectory),
+    maxSize (maxCacheSize)
+{
+    if (! directory.isDirectory() && ! directory.createDirectory())
+        std::cout << "RenderCache error: Could not create "
+        << directory.getFullPathName().toStdString() << std::endl;
+}
+
+//==============================================================================
+File RenderCache::getEntry (const String& hash) const
+{
+    return directory.getChildFile (hash + ".render");
+}
+
+//==============================================================================
+bool RenderCache::load (const String& hash, std::vector<double>& audio) const
+{
+    const File entry = getEntry (hash);
+    MemoryMappedFile mapped (entry, MemoryMappedFile::readOnly);
+    const char* const data = static_cast<const char*> (mapped.getData());
+
+    if (data == nullptr || mapped.getSize() < size_t (headerSize) || memcmp (data, magic, 8) != 0)
+        return false;
+
+    const uint64 numSamples = ByteOrder::littleEndianInt64 (data + 8);
+    if (mapped.getSize() != headerSize + numSamples * sizeof (float))
+    {
+        std::cout << "RenderCache::load error: " << entry.getFullPathName().toStdString()
+        << " is truncated, ignoring it." << std::endl;
+        return false;
+    }
+
+    const float* const samples = reinterpret_cast<const float*> (data + headerSize);
+    audio.assign (samples, samples + numSamples);
+
+    // Marks the entry as recently used for eviction.
+    entry.setLastModificationTime (Time::getCurrentTime());
+    return true;
+}
+
+//==============================================================================
+bool RenderCache::store (const String& hash, const std::vector<double>& audio)
+{
+    const File entry = getEntry (hash);
+    const File temporary = entry.getSiblingFile (hash + "." + String::toHexString (Random::getSystemRandom().nextInt64())
+                                                 + ".tmp");
+
+    {
+        FileOutputStream stream (temporary);
+        if (stream.failedToOpen())
+        {
+            std::cout << "RenderCache::store error: Could not open "
+            << temporary.getFullPathName().toStdString() << std::endl;
+            return false;
+        }
+
+        // The renders are float to begin with, so nothing is lost here.
+        std::vector<float> samples (audio.begin(), audio.end());
+        stream.write (magic, 8);
+        stream.writeInt64 (int64 (samples.size()));
+        stream.write (samples.data(), samples.size() * sizeof (float));
+        stream.flush();
+
+        if (stream.getStatus().failed())
+        {
+            std::cout << "RenderCache::store error: "
+            << stream.getStatus().getErrorMessage().toStdString() << std::endl;
+            temporary.deleteFile();
+            return false;
+        }
+    }
+
+    if (! temporary.moveFileTo (entry))
+    {
+        temporary.deleteFile();
+        return false;
+    }
+
+    evict();
+    return true;
+}
+
+//==============================================================================
+int64 RenderCache::getSize() const
+{
+    int64 size = 0;
+    for (DirectoryIterator it (directory, false, "*.render"); it.next();)
+        size += it.getFile().getSize();
+    return size;
+}
+
+//==============================================================================
+void RenderCache::evict()
+{
+    if (maxSize <= 0)
+        return;
+
+    struct Entry
+    {
+        File  file;
+        int64 size;
+        Time  lastUsed;
+    };
+
+    std::vector<Entry> entries;
+    int64 size = 0;
+
+    bool isDirectory;
+    int64 fileSize;
+    Time modificationTime;
+    for (DirectoryIterator it (directory, false, "*.render"); it.next (&isDirectory, nullptr, &fileSize,
+                                                                          &modificationTime, nullptr, nullptr);)
+    {
+        entries.push_back ({ it.getFile(), fileSize, modificationTime });
+        size += fileSize;
+    }
+
+    if (size <= maxSize)
+        return;
+
+    std::sort (entries.begin(), entries.end(),
+               [] (const Entry& a, const Entry& b) { return a.lastUsed < b.lastUsed; });
+
+    // Another process may have deleted an entry already, which is fine.
+    for (const Entry& entry : entries)
+    {
+        if (size <= maxSize)
+            break;
+
+        entry.file.deleteFile();
+        size -= entry.size;
+    }
+}
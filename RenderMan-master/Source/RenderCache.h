@@ -0,0 +1,59 @@
+/*
+  ==============================================================================
+
+    RenderCache.h
+
+  ==============================================================================
+*/
+
+#ifndef RENDERCACHE_H_INCLUDED
+#define RENDERCACHE_H_INCLUDED
+
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// A directory of finished renders named by the hash of everything that went
+// into them (see RenderEngine::getRenderHash), so identical renders are only
+// ever done once no matter where their output ends up.
+//
+// Each entry is <hash>.render: "SLKHRNDR", uint64 numSamples, then the mono
+// audio as float32. Entries are written to a temporary file and renamed, so
+// several processes can share one directory. Hits refresh an entry's
+// modification time, and once the directory grows past its size limit the
+// least recently used entries are deleted.
+class RenderCache
+{
+public:
+    // A maxSize of zero or less never evicts anything.
+    RenderCache (const File& directory,
+                 int64       maxSize);
+
+    const File& getDirectory() const {
+        return directory;
+    };
+
+    int64 getMaxSize() const {
+        return maxSize;
+    };
+
+    // Returns false if there is no entry for the hash.
+    bool load (const String& hash, std::vector<double>& audio) const;
+
+    bool store (const String& hash, const std::vector<double>& audio);
+
+    // Total size of the entries in the directory, in bytes.
+    int64 getSize() const;
+
+private:
+    File getEntry (const String& hash) const;
+
+    void evict();
+
+    File  directory;
+    int64 maxSize;
+};
+
+#endif  // RENDERCACHE_H_INCLUDED
@@ -9,6 +9,26 @@
 */
 
 #include "RenderEngine.h"
+
+namespace
+{
+    // Makes room for at least numElements, growing by half again so a run of
+    // slightly longer renders doesn't reallocate every time. Returns whether
+    // it had to allocate.
+    // Channels an AudioSampleBuffer can refer to without allocating its list
+    // of channel pointers.
+    const int maxSegmentReferenceChannels = 32;
+
+    template <typename T>
+    bool reserveGrowing (std::vector<T>& vector, const size_t numElements)
+    {
+        if (vector.capacity() >= numElements)
+            return false;
+
+        vector.reserve (jmax (numElements, vector.capacity() + vector.capacity() / 2));
+        return true;
+    }
+}
 //==============================================================================
 bool RenderEngine::loadPreset (const std::string& path)
 {
@@ -23,6 +43,34 @@ bool RenderEngine::loadPreset (const std::string& path)
 //==============================================================================
 bool RenderEngine::loadPlugin (const std::string& path)
 {
+    // Native instruments skip plugin scanning entirely.
+    if (SfzInstrument::isSfzPath (path))
+    {
+        String errorMessage;
+        SfzInstrument* instrument = SfzInstrument::createFromPath (path, errorMessage);
+
+        if (instrument == nullptr)
+        {
+            std::cout << "RenderEngine::loadPlugin error: "
+            << errorMessage.toStdString()
+            << std::endl;
+            return false;
+        }
+
+        if (plugin != nullptr) delete plugin;
+        plugin = instrument;
+        plugin->prepareToPlay (sampleRate, bufferSize);
+        plugin->setNonRealtime (true);
+        fillAvailablePluginParameters (pluginParameters);
+        fillPluginParameterInfo();
+        pluginDescription = plugin->getPluginDescription();
+        automationLanes.clear();
+        multiOutput = false;
+        outputGroups.clear();
+        stemOutputs.clear();
+        return true;
+    }
+
     OwnedArray<PluginDescription> pluginDescriptions;
     KnownPluginList pluginList;
     AudioPluginFormatManager pluginFormatManager;
@@ -58,9 +106,19 @@ bool RenderEngine::loadPlugin (const std::string& path)
         // Resize the pluginParameters patch type to fit this plugin and init
         // all the values to 0.0f!
         fillAvailablePluginParameters (pluginParameters);
+
+        // Cache the parameter metadata, hosts like Kontakt expose thousands.
+        fillPluginParameterInfo();
         
         pluginDescription = plugin->getPluginDescription();
 
+        // Lanes refer to the old plugin's parameter indices, and stems to
+        // its outputs.
+        automationLanes.clear();
+        multiOutput = false;
+        outputGroups.clear();
+        stemOutputs.clear();
+
         return true;
     }
 
@@ -79,6 +137,7 @@ bool RenderEngine::loadMidi(const std::string& path)
     midiFile.readFrom(fileStream);
     midiFile.convertTimestampTicksToSeconds();
     midiBuffer.clear();
+    stemOutputs.clear();
     
     for (int t = 0; t < midiFile.getNumTracks(); t++) {
         const MidiMessageSequence* track = midiFile.getTrack(t);
@@ -89,51 +148,753 @@ bool RenderEngine::loadMidi(const std::string& path)
         }
     }
     
+    sanitizeMidi();
     return midiBuffer.getNumEvents();
 }
 
+//==============================================================================
+void RenderEngine::sanitizeMidi ()
+{
+    if (midiSanitization)
+    {
+        midiSanitizeReport = MidiSanitizer::process (midiBuffer, midiSanitizeOptions, hangingNoteOffs);
+        return;
+    }
+
+    hangingNoteOffs.clear();
+    midiSanitizeReport = MidiSanitizeReport();
+    midiSanitizeReport.eventsIn = midiBuffer.getNumEvents();
+    midiSanitizeReport.eventsOut = midiBuffer.getNumEvents();
+}
+
 void RenderEngine::renderMidi (const double renderLength)
 {
-    // Data structure to hold multi-channel audio data.
-    AudioSampleBuffer audioBuffer (plugin->getTotalNumOutputChannels(),
-                                   bufferSize);
+    const int64 renderStart = Time::getHighResolutionTicks();
+    const ScopedExecutionPolicy scopedPolicy (resolvedExecutionPolicy);
+
+    lastRenderStats = RenderStats();
+    lastRenderStats.cpu = ScopedExecutionPolicy::getCurrentCpu();
+    lastRenderStats.affinitySet = scopedPolicy.isAffinitySet();
+    lastRenderStats.niceLevelSet = scopedPolicy.isNiceLevelSet();
+    lastRenderStats.denormalsDisabled = scopedPolicy.areDenormalsDisabled();
+    lastRenderStats.policy = executionPolicyDescription;
+
+    lastRenderCached = false;
+    String cacheHash;
+
+    // The cache only holds the mixed down audio, not the stems.
+    const bool useCache = renderCache != nullptr && stemOutputs.empty();
+    if (useCache)
+    {
+        cacheHash = getRenderHash (renderLength);
+        if (renderCache->load (cacheHash, processedMonoAudioPreview))
+        {
+            lastRenderCached = true;
+            replayCachedRender();
+            lastRenderStats.renderSeconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks()
+                                                                                - renderStart);
+            return;
+        }
+    }
+
+    // Everything below reuses the engine's buffers and only grows them when
+    // a render needs more than any before it.
+    int& growths = lastRenderStats.arenaGrowths;
+    const int numChannels = plugin->getTotalNumOutputChannels();
+    if (numChannels * bufferSize > renderBufferCapacity)
+    {
+        renderBufferCapacity = numChannels * bufferSize;
+        ++growths;
+    }
+    AudioSampleBuffer& audioBuffer = renderBuffer;
+    audioBuffer.setSize (numChannels, bufferSize, false, false, true);
+    audioBuffer.clear();
+    if (numChannels >= maxSegmentReferenceChannels)
+        segmentBuffer.setSize (numChannels, bufferSize, false, false, true);
     
-    int numberOfBuffers = int (std::ceil (renderLength * sampleRate / bufferSize));
+    const int outputSamples = getNumRenderSamples (renderLength);
     
-    // Clear and reserve memory for the audio storage!
     processedMonoAudioPreview.clear();
-    processedMonoAudioPreview.reserve (numberOfBuffers * bufferSize);
+    growths += reserveGrowing (processedMonoAudioPreview, size_t (outputSamples));
+    growths += reserveGrowing (featureBlock, size_t (bufferSize));
     
-    plugin->prepareToPlay (sampleRate, bufferSize);
+    // No block can hold more MIDI than the whole render.
+    const size_t midiSize = size_t (midiBuffer.data.size() + hangingNoteOffs.data.size());
+    blockMidiBuffer.ensureSize (midiSize);
+    segmentMidiBuffer.ensureSize (midiSize);
+    
+    // The plugin was prepared when it was loaded, resetting it starts the
+    // render from silence just the same without reallocating its buffers.
+    plugin->reset();
+    
+    // With latency compensation the plugin runs for its latency longer and
+    // that much is dropped from the start, so the output lines up with the
+    // MIDI and every stem is aligned whatever plugin rendered it.
+    const int latency = latencyCompensation ? jmax (0, plugin->getLatencySamples()) : 0;
+    const int numberOfBuffers = (outputSamples + latency + bufferSize - 1) / bufferSize;
+    
+    if (featurePipeline != nullptr)
+        featurePipeline->begin (outputSamples);
+    
+    for (auto& resampler : resamplers)
+        resampler->reset();
+    
+    stemAudio.resize (stemOutputs.size());
+    for (auto& stem : stemAudio)
+    {
+        stem.clear();
+        growths += reserveGrowing (stem, size_t (outputSamples));
+    }
+    
+    for (auto& lane : automationLanes)
+    {
+        lane.cursor = 0;
+        lane.lastValue = -1.0f;
+    }
     
-    MidiBuffer renderMidiBuffer;
+    MidiBuffer& renderMidiBuffer = blockMidiBuffer;
     MidiBuffer::Iterator it(midiBuffer);
     
     MidiMessage m;
     int sampleNumber = -1;
-    bool isMessageBetween;
-    bool bufferRemaining = it.getNextEvent(m, sampleNumber);
+    bool eventPending = it.getNextEvent(m, sampleNumber);
     
     for (int i = 0; i < numberOfBuffers; ++i)
     {
-        double start = i * bufferSize;
-        double end = (i + 1) * bufferSize;
+        const int start = i * bufferSize;
+        const int end = (i + 1) * bufferSize;
         
-        isMessageBetween = sampleNumber >= start && sampleNumber < end;
-        do {
-            if (isMessageBetween) {
-                renderMidiBuffer.addEvent(m, sampleNumber - start);
-                bufferRemaining = it.getNextEvent(m, sampleNumber);
-                isMessageBetween = sampleNumber >= start && sampleNumber < end;
-            }
-        } while (isMessageBetween && bufferRemaining);
+        // Only this block's events, stamped relative to its start.
+        renderMidiBuffer.clear();
+        while (eventPending && sampleNumber < end)
+        {
+            renderMidiBuffer.addEvent(m, jmax(0, sampleNumber - start));
+            eventPending = it.getNextEvent(m, sampleNumber);
+        }
+        
+        // Notes the MIDI never releases sound to the end of the render and
+        // are released on its last sample.
+        if (i == numberOfBuffers - 1 && ! hangingNoteOffs.isEmpty())
+            renderMidiBuffer.addEvents (hangingNoteOffs, 0, -1,
+                                        jlimit (0, bufferSize - 1, outputSamples + latency - 1 - start));
         
         // Turn Midi to audio via the vst.
-        plugin->processBlock (audioBuffer, renderMidiBuffer);
+        const bool automate = ! automationLanes.empty();
+        const int64 blockStart = Time::getHighResolutionTicks();
+        
+        if (sampleAccurateMidi || (automate && automationInterval > 0
+                                   && automationInterval < bufferSize))
+        {
+            processBlockInSegments (audioBuffer, renderMidiBuffer, start);
+        }
+        else
+        {
+            if (automate)
+                applyAutomation (start);
+            
+            plugin->processBlock (audioBuffer, renderMidiBuffer);
+        }
+        
+        const double blockSeconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks()
+                                                                        - blockStart);
+        lastRenderStats.meanBlockSeconds += blockSeconds;
+        lastRenderStats.maxBlockSeconds = jmax (lastRenderStats.maxBlockSeconds, blockSeconds);
+        
+        // Get audio features and fill the datastructure, with just the
+        // part of the block after the latency.
+        const int keepStart = jlimit (0, bufferSize, latency - start);
+        const int keepEnd = jlimit (0, bufferSize, latency + outputSamples - start);
+        if (keepEnd <= keepStart)
+            continue;
+        
+        fillAudioFeatures (audioBuffer, keepStart, keepEnd - keepStart);
+        
+        if (! stemOutputs.empty())
+            fillStemAudio (audioBuffer, keepStart, keepEnd - keepStart);
+    }
+    
+    for (auto& resampler : resamplers)
+        resampler->finish();
+    
+    lastRenderStats.numBlocks = numberOfBuffers;
+    if (numberOfBuffers > 0)
+        lastRenderStats.meanBlockSeconds /= numberOfBuffers;
+    
+    if (featurePipeline != nullptr)
+    {
+        featurePipeline->finish();
         
-        // Get audio features and fill the datastructure.
-        fillAudioFeatures (audioBuffer);
+        const std::vector<float>& rms = featurePipeline->getRms();
+        rmsFrames.assign (rms.begin(), rms.end());
+    }
+
+    if (useCache)
+        renderCache->store (cacheHash, processedMonoAudioPreview);
+
+    lastRenderStats.renderSeconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks()
+                                                                        - renderStart);
+}
+
+//==============================================================================
+void RenderEngine::replayCachedRender ()
+{
+    // Features and resampled audio come from the cached audio, block by
+    // block, just as if it had been rendered.
+    const int numSamples = int (processedMonoAudioPreview.size());
+
+    if (featurePipeline != nullptr)
+        featurePipeline->begin (numSamples);
+
+    for (auto& resampler : resamplers)
+        resampler->reset();
+
+    for (int start = 0; start < numSamples; start += bufferSize)
+    {
+        const int blockSize = jmin (bufferSize, numSamples - start);
+        featureBlock.assign (processedMonoAudioPreview.begin() + start,
+                             processedMonoAudioPreview.begin() + start + blockSize);
+
+        if (featurePipeline != nullptr)
+            featurePipeline->push (featureBlock.data(), blockSize);
+
+        for (auto& resampler : resamplers)
+            resampler->process (featureBlock.data(), blockSize);
+    }
+
+    for (auto& resampler : resamplers)
+        resampler->finish();
+
+    if (featurePipeline != nullptr)
+    {
+        featurePipeline->finish();
+
+        const std::vector<float>& rms = featurePipeline->getRms();
+        rmsFrames.assign (rms.begin(), rms.end());
+    }
+}
+
+//==============================================================================
+void RenderEngine::fillStemAudio (const AudioSampleBuffer& data,
+                                  const int                startSample,
+                                  const int                numSamples)
+{
+    for (size_t s = 0; s < stemOutputs.size(); ++s)
+    {
+        std::vector<float>& stem = stemAudio[s];
+        const size_t offset = stem.size();
+        stem.resize (offset + size_t (numSamples), 0.0f);
+
+        const OutputGroup& group = outputGroups[size_t (stemOutputs[s])];
+        const int numChannels = jmin (group.numChannels, data.getNumChannels() - group.firstChannel);
+        const float gain = 1.0f / float (jmax (1, numChannels));
+
+        for (int c = 0; c < numChannels; ++c)
+            FloatVectorOperations::addWithMultiply (stem.data() + offset,
+                                                    data.getReadPointer (group.firstChannel + c, startSample),
+                                                    gain, numSamples);
+    }
+}
+
+//==============================================================================
+bool RenderEngine::setMultiOutput (const bool shouldUseAllOutputs)
+{
+    outputGroups.clear();
+    multiOutput = false;
+
+    if (plugin == nullptr)
+    {
+        std::cout << "RenderEngine::setMultiOutput error: Load a plugin first." << std::endl;
+        return false;
+    }
+
+    if (shouldUseAllOutputs && ! plugin->enableAllBuses())
+        std::cout << "RenderEngine::setMultiOutput error: " <<
+                     "The plugin refused some of its output buses." << std::endl;
+
+    plugin->prepareToPlay (sampleRate, bufferSize);
+
+    if (shouldUseAllOutputs)
+    {
+        const int numBuses = plugin->getBusCount (false);
+        for (int b = 0; numBuses > 1 && b < numBuses; ++b)
+        {
+            const AudioProcessor::Bus* bus = plugin->getBus (false, b);
+            if (bus != nullptr && bus->isEnabled() && bus->getNumberOfChannels() > 0)
+                outputGroups.push_back ({ bus->getName(),
+                                          plugin->getChannelIndexInProcessBlockBuffer (false, b, 0),
+                                          bus->getNumberOfChannels() });
+        }
+
+        // One wide bus, as VST2 plugins without pin properties report.
+        if (outputGroups.empty())
+        {
+            const int numChannels = plugin->getTotalNumOutputChannels();
+            for (int c = 0; c < numChannels; c += 2)
+                outputGroups.push_back ({ "Output " + String (c / 2 + 1), c, jmin (2, numChannels - c) });
+        }
+
+        multiOutput = true;
+    }
+
+    // Mappings to outputs that no longer exist are dropped.
+    for (int& output : stemOutputs)
+        if (output >= int (outputGroups.size()))
+            output = 0;
+    if (outputGroups.empty())
+        stemOutputs.clear();
+
+    return multiOutput == shouldUseAllOutputs;
+}
+
+//==============================================================================
+bool RenderEngine::loadStemMidi (const std::vector<std::string>& paths)
+{
+    if (! multiOutput)
+    {
+        std::cout << "RenderEngine::loadStemMidi error: Call setMultiOutput first." << std::endl;
+        return false;
+    }
+
+    if (paths.empty() || paths.size() > 16)
+    {
+        std::cout << "RenderEngine::loadStemMidi error: Give between 1 and 16 MIDI files, " <<
+                     "one per MIDI channel." << std::endl;
+        return false;
+    }
+
+    midiBuffer.clear();
+    stemOutputs.clear();
+
+    for (size_t stem = 0; stem < paths.size(); ++stem)
+    {
+        FileInputStream fileStream (File (paths[stem]));
+        MidiFile midiFile;
+        if (fileStream.failedToOpen() || ! midiFile.readFrom (fileStream))
+        {
+            std::cout << "RenderEngine::loadStemMidi error: Could not read " << paths[stem] << std::endl;
+            midiBuffer.clear();
+            stemOutputs.clear();
+            return false;
+        }
+        midiFile.convertTimestampTicksToSeconds();
+
+        for (int t = 0; t < midiFile.getNumTracks(); ++t)
+        {
+            const MidiMessageSequence* track = midiFile.getTrack (t);
+            for (int i = 0; i < track->getNumEvents(); ++i)
+            {
+                MidiMessage m = track->getEventPointer (i)->message;
+                if (m.getChannel() > 0)
+                    m.setChannel (int (stem) + 1);
+                midiBuffer.addEvent (m, int (sampleRate * m.getTimeStamp()));
+            }
+        }
+
+        stemOutputs.push_back (jmin (int (stem), int (outputGroups.size()) - 1));
+    }
+
+    sanitizeMidi();
+    return true;
+}
+
+//==============================================================================
+bool RenderEngine::setStemOutputs (const std::vector<int>& outputs)
+{
+    if (outputs.size() != stemOutputs.size())
+    {
+        std::cout << "RenderEngine::setStemOutputs error: Give one output per stem." << std::endl;
+        return false;
+    }
+
+    for (const int output : outputs)
+    {
+        if (output < 0 || output >= int (outputGroups.size()))
+        {
+            std::cout << "RenderEngine::setStemOutputs error: Output " << output <<
+                         " does not exist." << std::endl;
+            return false;
+        }
+    }
+
+    stemOutputs = outputs;
+    return true;
+}
+
+//==============================================================================
+const std::vector<float>* RenderEngine::getStemAudio (const int stem) const
+{
+    if (stem < 0 || stem >= int (stemAudio.size()))
+        return nullptr;
+    return &stemAudio[size_t (stem)];
+}
+
+//==============================================================================
+double RenderEngine::getAutoRenderLength (const double minTail,
+                                          const double maxTail,
+                                          const double minLength) const
+{
+    const double lastEvent = midiBuffer.getNumEvents() > 0 ? midiBuffer.getLastEventTime() / sampleRate : 0.0;
+
+    // Unknown (0) and infinite tails end up at the bounds, as does NaN.
+    double tail = plugin != nullptr ? plugin->getTailLengthSeconds() : 0.0;
+    if (std::isnan (tail))
+        tail = maxTail;
+    tail = jlimit (minTail, jmax (minTail, maxTail), tail);
+
+    return jmax (lastEvent, minLength) + tail;
+}
+
+//==============================================================================
+bool RenderEngine::enableRenderCache (const std::string& directory,
+                                      const int64        maxSize)
+{
+    const File cacheDirectory (directory);
+    renderCache.reset (new RenderCache (cacheDirectory, maxSize));
+
+    if (! cacheDirectory.isDirectory())
+    {
+        renderCache = nullptr;
+        return false;
     }
+    return true;
+}
+
+//==============================================================================
+String RenderEngine::getRenderHash (const double renderLength)
+{
+    if (plugin == nullptr)
+        return String();
+
+    const int numSamples = getNumRenderSamples (renderLength);
+
+    MemoryOutputStream key;
+    key.writeString ("RenderMan render 2");
+    key.writeString (pluginDescription.createIdentifierString());
+    key.writeString (pluginDescription.version);
+
+    MemoryBlock state;
+    plugin->getStateInformation (state);
+    key.writeInt64 (int64 (state.getSize()));
+    key.write (state.getData(), state.getSize());
+
+    const int numParameters = plugin->getNumParameters();
+    key.writeInt (numParameters);
+    for (int i = 0; i < numParameters; ++i)
+        key.writeFloat (plugin->getParameter (i));
+
+    key.writeInt (int (overridenParameters.size()));
+    for (const auto& parameter : overridenParameters)
+    {
+        key.writeInt (parameter.first);
+        key.writeFloat (parameter.second);
+    }
+
+    key.writeInt (int (automationLanes.size()));
+    for (const auto& lane : automationLanes)
+    {
+        key.writeInt (lane.parameter);
+        key.writeInt (int (lane.times.size()));
+        key.write (lane.times.data(), lane.times.size() * sizeof (double));
+        key.write (lane.values.data(), lane.values.size() * sizeof (float));
+    }
+    key.writeInt (automationInterval);
+    key.writeBool (sampleAccurateMidi);
+    key.writeBool (latencyCompensation);
+    key.writeBool (executionPolicy.noDenormals);
+    key.writeInt (plugin->getLatencySamples());
+
+    key.writeDouble (sampleRate);
+    key.writeInt (bufferSize);
+    key.writeInt (numSamples);
+
+    // Only what reaches the plugin: events inside the render, without the
+    // meta events that depend on how the file was written.
+    MidiBuffer::Iterator it (midiBuffer);
+    MidiMessage message;
+    int samplePosition;
+    while (it.getNextEvent (message, samplePosition))
+    {
+        if (samplePosition >= numSamples)
+            break;
+        if (message.isMetaEvent())
+            continue;
+
+        key.writeInt (samplePosition);
+        key.writeInt (message.getRawDataSize());
+        key.write (message.getRawData(), size_t (message.getRawDataSize()));
+    }
+
+    key.writeInt (hangingNoteOffs.getNumEvents());
+    key.write (hangingNoteOffs.data.getRawDataPointer(), size_t (hangingNoteOffs.data.size()));
+
+    return SHA256 (key.getData(), key.getDataSize()).toHexString();
+}
+
+//==============================================================================
+bool RenderEngine::setOutputSampleRates (const std::vector<int>& rates)
+{
+    for (const int rate : rates)
+    {
+        if (rate <= 0)
+        {
+            std::cout << "RenderEngine::setOutputSampleRates error: " <<
+                         "Sample rates must be positive." << std::endl;
+            return false;
+        }
+    }
+    
+    resamplers.clear();
+    for (const int rate : rates)
+        if (getResampledAudio (rate) == nullptr)
+            resamplers.emplace_back (new PolyphaseResampler (int (sampleRate), rate));
+    
+    return true;
+}
+
+//==============================================================================
+std::vector<int> RenderEngine::getOutputSampleRates () const
+{
+    std::vector<int> rates;
+    for (const auto& resampler : resamplers)
+        rates.push_back (resampler->getOutputRate());
+    return rates;
+}
+
+//==============================================================================
+const std::vector<float>* RenderEngine::getResampledAudio (const int rate) const
+{
+    for (const auto& resampler : resamplers)
+        if (resampler->getOutputRate() == rate)
+            return &resampler->getOutput();
+    return nullptr;
+}
+
+//==============================================================================
+bool RenderEngine::enableFeaturePipeline (const int fftSize,
+                                          const int hopSize,
+                                          const int numMelBands,
+                                          const int features)
+{
+    if (fftSize < 4 || (fftSize & (fftSize - 1)) != 0 || hopSize <= 0)
+    {
+        std::cout << "RenderEngine::enableFeaturePipeline error: " <<
+                     "The fft size must be a power of two of at least 4 and the hop size positive." <<
+                     std::endl;
+        return false;
+    }
+    else if ((features & (FeaturePipeline::stftFeature | FeaturePipeline::melFeature |
+                          FeaturePipeline::onsetFeature | FeaturePipeline::rmsFeature)) == 0)
+    {
+        std::cout << "RenderEngine::enableFeaturePipeline error: No features requested." << std::endl;
+        return false;
+    }
+    else if (numMelBands < 1 && (features & (FeaturePipeline::melFeature | FeaturePipeline::onsetFeature)))
+    {
+        std::cout << "RenderEngine::enableFeaturePipeline error: " <<
+                     "Mel bands and onset strength need at least one mel band." << std::endl;
+        return false;
+    }
+    
+    featurePipeline.reset (new FeaturePipeline (sampleRate, fftSize, hopSize, numMelBands, features));
+    return true;
+}
+
+//==============================================================================
+void RenderEngine::processBlockInSegments (AudioSampleBuffer& audioBuffer,
+                                           MidiBuffer&        blockMidiBuffer,
+                                           const int          blockStart)
+{
+    // The block is cut at every automation interval boundary and, with
+    // sample accurate MIDI, at every event so each one lands on the first
+    // sample of a block even for plugins that only read MIDI at block
+    // boundaries. Segments refer to the block's memory, nothing allocates.
+    float* const* channels = audioBuffer.getArrayOfWritePointers();
+    const int numChannels = audioBuffer.getNumChannels();
+    const int numSamples = audioBuffer.getNumSamples();
+    const bool automate = ! automationLanes.empty();
+    const bool splitAtInterval = automate && automationInterval > 0;
+    
+    MidiBuffer::Iterator it (blockMidiBuffer);
+    MidiMessage m;
+    int sampleNumber;
+    bool eventPending = it.getNextEvent (m, sampleNumber);
+    int segmentStart = 0;
+    
+    while (segmentStart < numSamples)
+    {
+        int segmentEnd = numSamples;
+        
+        if (splitAtInterval)
+        {
+            const int position = blockStart + segmentStart;
+            const int nextUpdate = (position / automationInterval + 1) * automationInterval;
+            segmentEnd = jmin (segmentEnd, nextUpdate - blockStart);
+        }
+        
+        segmentMidiBuffer.clear();
+        while (eventPending && sampleNumber < segmentEnd)
+        {
+            if (sampleAccurateMidi && sampleNumber > segmentStart)
+            {
+                segmentEnd = sampleNumber;
+                break;
+            }
+            segmentMidiBuffer.addEvent (m, sampleNumber - segmentStart);
+            eventPending = it.getNextEvent (m, sampleNumber);
+        }
+        
+        if (automate)
+            applyAutomation (blockStart + segmentStart);
+        
+        const int segmentLength = segmentEnd - segmentStart;
+        if (numChannels < maxSegmentReferenceChannels)
+        {
+            AudioSampleBuffer segment (channels, numChannels, segmentStart, segmentLength);
+            plugin->processBlock (segment, segmentMidiBuffer);
+        }
+        else
+        {
+            // A buffer referring to this many channels would allocate its
+            // channel list, so the segment goes through a copy instead.
+            segmentBuffer.setSize (numChannels, segmentLength, false, false, true);
+            for (int c = 0; c < numChannels; ++c)
+                segmentBuffer.copyFrom (c, 0, audioBuffer, c, segmentStart, segmentLength);
+            plugin->processBlock (segmentBuffer, segmentMidiBuffer);
+            for (int c = 0; c < numChannels; ++c)
+                audioBuffer.copyFrom (c, segmentStart, segmentBuffer, c, 0, segmentLength);
+        }
+        segmentStart = segmentEnd;
+    }
+}
+
+//==============================================================================
+void RenderEngine::applyAutomation (const int samplePosition)
+{
+    for (auto& lane : automationLanes)
+    {
+        const size_t last = lane.times.size() - 1;
+        
+        // Renders only move forward, so each lane keeps its place.
+        while (lane.cursor < last && lane.times[lane.cursor + 1] <= samplePosition)
+            ++lane.cursor;
+        
+        float value;
+        if (lane.cursor == last || samplePosition <= lane.times[lane.cursor])
+        {
+            value = lane.values[lane.cursor];
+        }
+        else
+        {
+            const double t0 = lane.times[lane.cursor];
+            const double t1 = lane.times[lane.cursor + 1];
+            const float  v0 = lane.values[lane.cursor];
+            const float  v1 = lane.values[lane.cursor + 1];
+            value = v0 + float ((samplePosition - t0) / (t1 - t0)) * (v1 - v0);
+        }
+        
+        if (value != lane.lastValue)
+        {
+            plugin->setParameter (lane.parameter, value);
+            lane.lastValue = value;
+        }
+    }
+}
+
+//==============================================================================
+bool RenderEngine::setAutomation (const int                  parameter,
+                                  const std::vector<double>& times,
+                                  const std::vector<float>&  values)
+{
+    if (plugin == nullptr)
+    {
+        std::cout << "RenderEngine::setAutomation error: " <<
+                     "Please load the plugin first!" << std::endl;
+        return false;
+    }
+    else if (parameter < 0 || parameter >= plugin->getNumParameters())
+    {
+        std::cout << "RenderEngine::setAutomation error: " <<
+                     "Parameter index is out of range." << std::endl;
+        return false;
+    }
+    else if (times.size() == 0 || times.size() != values.size())
+    {
+        std::cout << "RenderEngine::setAutomation error: " <<
+                     "Times and values must be non-empty and the same size." <<
+                     std::endl;
+        return false;
+    }
+
+    AutomationLane lane;
+    lane.parameter = parameter;
+    lane.cursor = 0;
+    lane.lastValue = -1.0f;
+    lane.times.reserve (times.size());
+    lane.values = values;
+
+    for (size_t i = 0; i < times.size(); ++i)
+    {
+        if (i > 0 && times[i] < times[i - 1])
+        {
+            std::cout << "RenderEngine::setAutomation error: " <<
+                         "Times must not decrease." << std::endl;
+            return false;
+        }
+        else if (values[i] < 0.0 || values[i] > 1.0)
+        {
+            std::cout << "RenderEngine::setAutomation error: " <<
+                         "Keep the automated values between 0.0 and 1.0." <<
+                         std::endl;
+            return false;
+        }
+        lane.times.push_back (times[i] * sampleRate);
+    }
+
+    removeAutomation (parameter);
+    automationLanes.push_back (std::move (lane));
+    return true;
+}
+
+//==============================================================================
+bool RenderEngine::setAutomationCurve (const int                 parameter,
+                                       const std::vector<float>& values,
+                                       const double              rate)
+{
+    if (rate <= 0.0)
+    {
+        std::cout << "RenderEngine::setAutomationCurve error: " <<
+                     "Rate must be greater than zero." << std::endl;
+        return false;
+    }
+
+    std::vector<double> times (values.size());
+    for (size_t i = 0; i < times.size(); ++i)
+        times[i] = i / rate;
+
+    return setAutomation (parameter, times, values);
+}
+
+//==============================================================================
+bool RenderEngine::removeAutomation (const int parameter)
+{
+    auto iterator = std::find_if (automationLanes.begin(),
+                                  automationLanes.end(),
+                                  [&parameter] (const AutomationLane& lane)
+                                  {
+                                      return lane.parameter == parameter;
+                                  });
+
+    if (iterator == automationLanes.end())
+        return false;
+
+    automationLanes.erase (iterator);
+    return true;
+}
+
+//==============================================================================
+void RenderEngine::clearAutomation ()
+{
+    automationLanes.clear();
 }
 
 //==============================================================================
@@ -153,17 +914,26 @@ void RenderEngine::renderPatch (const uint8  midiNote,
     
     onMessage.setTimeStamp(0);
     offMessage.setTimeStamp(noteLength * sampleRate);
+    
+    // Start from silence: drop the notes of any earlier render and let the
+    // plugin kill voices still ringing from it.
+    midiBuffer.clear();
+    stemOutputs.clear();
+    plugin->reset();
+    
     midiBuffer.addEvent (onMessage, onMessage.getTimeStamp());
     midiBuffer.addEvent (offMessage, offMessage.getTimeStamp());
     renderMidi(renderLength);
 }
 
 //=============================================================================
-void RenderEngine::fillAudioFeatures (const AudioSampleBuffer& data)
+void RenderEngine::fillAudioFeatures (const AudioSampleBuffer& data,
+                                      const int                startSample,
+                                      const int                numSamples)
 {
     // Keep it auto as it may or may not be double precision.
     const auto readptrs = data.getArrayOfReadPointers();
-    for (int i = 0; i < data.getNumSamples(); ++i)
+    for (int i = startSample; i < startSample + numSamples; ++i)
     {
         // Mono the frame.
         int channel = 0;
@@ -178,6 +948,22 @@ void RenderEngine::fillAudioFeatures (const AudioSampleBuffer& data)
         // Save the audio for playback and plotting!
         processedMonoAudioPreview.push_back (currentFrame);
     }
+
+    if (featurePipeline == nullptr && resamplers.empty())
+        return;
+
+    featureBlock.resize (size_t (numSamples));
+    std::copy (processedMonoAudioPreview.end() - numSamples,
+               processedMonoAudioPreview.end(),
+               featureBlock.begin());
+
+    // Hand the block to the feature thread first so it overlaps with the
+    // resampling.
+    if (featurePipeline != nullptr)
+        featurePipeline->push (featureBlock.data(), numSamples);
+
+    for (auto& resampler : resamplers)
+        resampler->process (featureBlock.data(), numSamples);
 }
 
 //=============================================================================
@@ -324,37 +1110,69 @@ void RenderEngine::fillAvailablePluginParameters (PluginPatch& params)
 }
 
 //==============================================================================
-const String RenderEngine::getPluginParametersDescription()
+void RenderEngine::fillPluginParameterInfo ()
 {
-    String parameterListString ("");
+    // Discrete parameters with more steps than this don't get value strings.
+    const int maxValueStrings = 128;
 
-    if (plugin != nullptr)
+    parameterInfo.clear();
+    parameterIndices.clear();
+    parametersDescription = String();
+
+    const OwnedArray<AudioProcessorParameter>& params = plugin->getParameters();
+    const int numParameters = plugin->getNumParameters();
+    parameterInfo.reserve (numParameters);
+    parameterIndices.reserve (numParameters);
+
+    for (int i = 0; i < numParameters; ++i)
     {
-        const OwnedArray<AudioProcessorParameter>& params = plugin->getParameters();
-        for (int i = 0; i < params.size(); ++i)
+        PluginParameterInfo info;
+        info.index = i;
+
+        if (AudioProcessorParameter* param = params[i])
         {
-            const String index      = std::to_string(params[i]->getParameterIndex());
-            const String name       = params[i]->getName(100);
-//            const String label      = params[i]->getLabel();
-//            const String defaultVal = std::to_string(params[i]->getDefaultValue());
-//            const String nSteps     = std::to_string(params[i]->getNumSteps());
-//            const String isDiscrete = std::to_string(params[i]->isDiscrete());
-//            const String isBool     = std::to_string(params[i]->isBoolean());
-//            const String s = typeid(params[i]).name();
-//            const String valStrings = params[i]->getAllValueStrings().joinIntoString("\n");
-//
-//            std::cout << "\n=\ns = \t" << s << "\nvalStrings = \t" << valStrings << std::endl;
-            
+            info.name         = param->getName (100);
+            info.label        = param->getLabel();
+            info.defaultValue = param->getDefaultValue();
+            info.numSteps     = param->getNumSteps();
+            info.isDiscrete   = param->isDiscrete();
 
-            parameterListString += index + ", " + name + "\n";
+            if (info.isDiscrete && info.numSteps > 1 && info.numSteps <= maxValueStrings)
+                for (int step = 0; step < info.numSteps; ++step)
+                    info.valueStrings.add (param->getText (step / float (info.numSteps - 1), 100));
+        }
+        else
+        {
+            info.name         = plugin->getParameterName (i, 100);
+            info.label        = plugin->getParameterLabel (i);
+            info.defaultValue = plugin->getParameterDefaultValue (i);
+            info.numSteps     = plugin->getParameterNumSteps (i);
+            info.isDiscrete   = plugin->isParameterDiscrete (i);
         }
+
+        info.isBoolean = info.isDiscrete && info.numSteps == 2;
+
+        // The first of several parameters with the same name wins.
+        parameterIndices.emplace (info.name.toStdString(), i);
+        parametersDescription += String (i) + ", " + info.name + "\n";
+        parameterInfo.push_back (std::move (info));
     }
-    else
-    {
+}
+
+//==============================================================================
+int RenderEngine::getParameterIndex (const std::string& name) const
+{
+    auto iterator = parameterIndices.find (name);
+    return iterator != parameterIndices.end() ? iterator->second : -1;
+}
+
+//==============================================================================
+const String RenderEngine::getPluginParametersDescription()
+{
+    if (plugin == nullptr)
         std::cout << "Please load the plugin first!" << std::endl;
-    }
 
-    return parameterListString;
+    return parametersDescription;
 }
 
 //void checkType(const OwnedArray<AudioProcessorParameter>& params)
@@ -377,6 +1195,11 @@ void RenderEngine::setPatch (const PluginPatch patch)
     if (currentParameterSize == newPatchParameterSize)
     {
         pluginParameters = patch;
+
+        // Push the patch (with any overrides on top) to the plugin so it is
+        // the starting point for the next render and its automation.
+        for (const auto& parameter : getPatch())
+            plugin->setParameter (parameter.first, parameter.second);
     }
     else
     {
@@ -386,6 +1209,29 @@ void RenderEngine::setPatch (const PluginPatch patch)
     }
 }
 
+//==============================================================================
+bool RenderEngine::setPatchValues (const float* values, const size_t numValues)
+{
+    if (numValues != pluginParameters.size())
+    {
+        std::cout << "RenderEngine::setPatchValues error: Incorrect patch size!" <<
+        "\n- Current size:  " << pluginParameters.size() <<
+        "\n- Supplied size: " << numValues << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < numValues; ++i)
+    {
+        pluginParameters[i].second = values[i];
+        plugin->setParameter (pluginParameters[i].first, values[i]);
+    }
+
+    for (const auto& parameter : overridenParameters)
+        plugin->setParameter (parameter.first, parameter.second);
+
+    return true;
+}
+
 //==============================================================================
 float RenderEngine::getParameter (const int parameter)
 {
@@ -430,7 +1276,7 @@ const size_t RenderEngine::getPluginParameterSize()
 }
 
 //==============================================================================
-const std::vector<double> RenderEngine::getAudioFrames()
+const std::vector<double>& RenderEngine::getAudioFrames() const
 {
     return processedMonoAudioPreview;
 }
@@ -442,19 +1288,39 @@ const std::vector<double> RenderEngine::getRMSFrames()
 }
 
 //==============================================================================
-bool RenderEngine::writeToWav(const std::string& path)
+bool RenderEngine::writeToWav(const std::string&   path,
+                              maxiRecorder::Format format,
+                              const int            outputRate)
 {
-    const auto size = processedMonoAudioPreview.size();
+    const std::vector<float>* resampled = nullptr;
+    if (outputRate > 0)
+    {
+        resampled = getResampledAudio (outputRate);
+        if (resampled == nullptr)
+        {
+            std::cout << "RenderEngine::writeToWav error: " << outputRate <<
+                         " Hz is not one of the output sample rates." << std::endl;
+            return false;
+        }
+    }
+
+    const auto size = resampled != nullptr ? resampled->size() : processedMonoAudioPreview.size();
     if (size == 0)
         return false;
 
+    // The rate is passed to the recorder rather than set in the global
+    // maxiSettings, so engines can write at different rates at once.
     maxiRecorder recorder;
-    recorder.setup (path);
+    recorder.setup (path, format, resampled != nullptr ? outputRate : int (sampleRate), 1);
     recorder.startRecording();
-    const double* data = processedMonoAudioPreview.data();
-    recorder.passData (data, size);
+    if (! recorder.isRecording())
+        return false;
+
+    if (resampled != nullptr)
+        recorder.passData (resampled->data(), int (size));
+    else
+        recorder.passData (processedMonoAudioPreview.data(), int (size));
     recorder.stopRecording();
-    recorder.saveToWav();
     return true;
 }
 
@@ -17,23 +17,94 @@
 #include <sstream>
 #include <string>
 #include <typeinfo>
+#include <unordered_map>
+#include <memory>
 #include "Maximilian/maximilian.h"
+#include "ExecutionPolicy.h"
+#include "FeaturePipeline.h"
+#include "MidiSanitizer.h"
+#include "PolyphaseResampler.h"
+#include "RenderCache.h"
+#include "SfzInstrument.h"
 #include "../JuceLibraryCode/JuceHeader.h"
 
 using namespace juce;
 
 typedef std::vector<std::pair<int, float>>  PluginPatch;
 
+// Breakpoints for one parameter. Times are stored in samples; the value is
+// linearly interpolated between breakpoints and held outside of them.
+struct AutomationLane
+{
+    int                 parameter;
+    std::vector<double> times;
+    std::vector<float>  values;
+    size_t              cursor;
+    float               lastValue;
+};
+
+// Everything the host knows about one parameter, gathered once when the
+// plugin is loaded. Value strings are only filled in for discrete
+// parameters with a manageable number of steps.
+struct PluginParameterInfo
+{
+    int         index;
+    String      name;
+    String      label;
+    float       defaultValue;
+    int         numSteps;
+    bool        isDiscrete;
+    bool        isBoolean;
+    StringArray valueStrings;
+};
+
+// A group of the plugin's output channels that one stem is taken from:
+// an output bus, or a stereo pair of a plugin with a single wide bus.
+struct OutputGroup
+{
+    String name;
+    int    firstChannel;
+    int    numChannels;
+};
+
+// Timing of the last render and the execution policy it ran under. Blocks
+// much slower than the mean usually mean denormals or page faults.
+struct RenderStats
+{
+    double renderSeconds;
+    int    numBlocks;
+    double meanBlockSeconds;
+    double maxBlockSeconds;
+    int    cpu;
+    bool   affinitySet;
+    bool   niceLevelSet;
+    bool   denormalsDisabled;
+    String policy;
+    // How often the engine's reusable buffers had to grow for this render.
+    // Zero once the engine has seen its longest render. Allocations made by
+    // JUCE or the plugin are not counted.
+    int    arenaGrowths;
+};
+
 class RenderEngine
 {
 public:
     RenderEngine (int sr,
                   int bs) :
+        renderBufferCapacity(0),
         sampleRate(sr),
         bufferSize(bs),
-        plugin(nullptr)
+        plugin(nullptr),
+        sampleAccurateMidi(false),
+        latencyCompensation(false),
+        midiSanitization(false),
+        automationInterval(0),
+        lastRenderCached(false),
+        multiOutput(false),
+        lastRenderStats()
     {
         maxiSettings::setup (sampleRate, 1, bufferSize);
+        setExecutionPolicy (ExecutionPolicy());
     }
 
     virtual ~RenderEngine()
@@ -54,8 +125,28 @@ public:
     };
 
     bool loadMidi (const std::string& path);
+
+    // When enabled, loadMidi and loadStemMidi run the loaded events through
+    // MidiSanitizer. The report describes the last load.
+    void setMidiSanitization (const bool                     shouldSanitize,
+                              const MidiSanitizer::Options& options = MidiSanitizer::Options()) {
+        midiSanitization = shouldSanitize;
+        midiSanitizeOptions = options;
+    };
+
+    bool isMidiSanitized () const {
+        return midiSanitization;
+    };
+
+    const MidiSanitizeReport& getMidiSanitizeReport () const {
+        return midiSanitizeReport;
+    };
     
     void setPatch (const PluginPatch patch);
+
+    // Sets the patch from one value per parameter, in getPatch() order, and
+    // sends it to the plugin. Used to apply rows of a PatchGenerator batch.
+    bool setPatchValues (const float* values, const size_t numValues);
     
     float getParameter (const int parameter);
     
@@ -64,7 +155,172 @@ public:
     const PluginPatch getPatch();
     
     void renderMidi (const double renderLength);
+
+    // When enabled, renderMidi splits a block at every MIDI event inside it
+    // so events are sample accurate even for plugins that only read MIDI at
+    // block boundaries. Blocks without such events are rendered whole.
+    void setSampleAccurateMidi (const bool shouldBeSampleAccurate) {
+        sampleAccurateMidi = shouldBeSampleAccurate;
+    };
+
+    bool isSampleAccurateMidi () const {
+        return sampleAccurateMidi;
+    };
+
+    // When enabled, renderMidi runs the plugin for its reported latency
+    // longer and drops that many samples from the start, so the audio lines
+    // up with the MIDI. The output length is unchanged.
+    void setLatencyCompensation (const bool shouldCompensate) {
+        latencyCompensation = shouldCompensate;
+    };
+
+    bool isLatencyCompensated () const {
+        return latencyCompensation;
+    };
+
+    int getLatencySamples () const {
+        return plugin != nullptr ? plugin->getLatencySamples() : 0;
+    };
+
+    // Applied to the calling thread for every render: CPU affinity, nice
+    // level and flush-to-zero. The default only disables denormals.
+    void setExecutionPolicy (const ExecutionPolicy& policy) {
+        executionPolicy = policy;
+        resolvedExecutionPolicy = policy.getResolved();
+        executionPolicyDescription = policy.toString();
+    };
+
+    const ExecutionPolicy& getExecutionPolicy () const {
+        return executionPolicy;
+    };
+
+    const RenderStats& getRenderStats () const {
+        return lastRenderStats;
+    };
+
+    // A render length that covers the last loaded MIDI event (or minLength
+    // seconds if that is later) plus the plugin's reported tail, clamped to
+    // [minTail, maxTail] seconds. Plugins that report no tail get minTail.
+    double getAutoRenderLength (const double minTail,
+                                const double maxTail,
+                                const double minLength = 0.0) const;
+
+    // Automates a parameter during renderMidi. Times are in seconds and must
+    // not decrease, values are between 0.0 and 1.0. Replaces any lane that
+    // already exists for the parameter.
+    bool setAutomation (const int                  parameter,
+                        const std::vector<double>& times,
+                        const std::vector<float>&  values);
+
+    // As above, with values sampled at a fixed rate (in Hz) from time zero.
+    bool setAutomationCurve (const int                 parameter,
+                             const std::vector<float>& values,
+                             const double              rate);
+
+    bool removeAutomation (const int parameter);
+
+    void clearAutomation ();
+
+    // How often automated values are sent to the plugin, in samples. Zero
+    // (the default) updates once per block, anything smaller than the
+    // buffer size splits blocks so updates land every interval samples.
+    void setAutomationInterval (const int intervalInSamples) {
+        automationInterval = jmax (0, intervalInSamples);
+    };
+
+    int getAutomationInterval () const {
+        return automationInterval;
+    };
+
+    double getSampleRate () const {
+        return sampleRate;
+    };
+
+    // Samples renderMidi produces for renderLength seconds. Renders are
+    // made of whole blocks, so this is rounded up to the buffer size.
+    int getNumRenderSamples (const double renderLength) const {
+        return int (std::ceil (renderLength * sampleRate / bufferSize)) * bufferSize;
+    };
+
+    // Computes the requested FeaturePipeline::Feature flags on a side
+    // thread while renderMidi runs. The results of the last render are
+    // available from getFeaturePipeline() once it returns.
+    bool enableFeaturePipeline (const int fftSize,
+                                const int hopSize,
+                                const int numMelBands,
+                                const int features);
+
+    void disableFeaturePipeline () {
+        featurePipeline = nullptr;
+    };
+
+    const FeaturePipeline* getFeaturePipeline () const {
+        return featurePipeline.get();
+    };
+
+    // Every render is also resampled to each of these rates as it runs.
+    // Rates must be positive; an empty list turns resampling off.
+    bool setOutputSampleRates (const std::vector<int>& rates);
+
+    std::vector<int> getOutputSampleRates () const;
+
+    // The mono audio of the last render at one of the output rates, or
+    // nullptr if the rate was not requested.
+    const std::vector<float>* getResampledAudio (const int rate) const;
     
+    // Serves renderMidi from a content addressed cache of renders in this
+    // directory, and adds every render that was not in it. maxSize bounds
+    // the directory in bytes; zero or less never evicts.
+    bool enableRenderCache (const std::string& directory,
+                            const int64        maxSize);
+
+    void disableRenderCache () {
+        renderCache = nullptr;
+    };
+
+    bool wasLastRenderCached () const {
+        return lastRenderCached;
+    };
+
+    // SHA-256 of everything a render of this length depends on: the plugin
+    // identity and state, every parameter value and override, the
+    // automation, sample rate, block size, MIDI options and the MIDI events
+    // as the plugin sees them (meta events, such as track names, left out).
+    String getRenderHash (const double renderLength);
+
+    // Multi-timbral rendering. Enables every output bus of the plugin so
+    // one instance (e.g. a Kontakt multi) can render several stems at once,
+    // each stem played on its own MIDI channel and taken from its own
+    // output. Outputs are the plugin's buses, or stereo pairs of channels if
+    // it only has one.
+    bool setMultiOutput (const bool shouldUseAllOutputs);
+
+    bool isMultiOutput () const {
+        return multiOutput;
+    };
+
+    const std::vector<OutputGroup>& getOutputGroups () const {
+        return outputGroups;
+    };
+
+    // Loads one MIDI file per stem, up to 16. Stem i is moved to MIDI
+    // channel i + 1 and, unless setStemOutputs says otherwise, is taken
+    // from output i.
+    bool loadStemMidi (const std::vector<std::string>& paths);
+
+    bool setStemOutputs (const std::vector<int>& outputs);
+
+    const std::vector<int>& getStemOutputs () const {
+        return stemOutputs;
+    };
+
+    int getNumStems () const {
+        return int (stemOutputs.size());
+    };
+
+    // The mono audio of one stem of the last render, or nullptr.
+    const std::vector<float>* getStemAudio (const int stem) const;
+
     int hello () {
         DBG("hello");
         return 1;
@@ -80,6 +336,13 @@ public:
     const size_t getPluginParameterSize();
 
     const String getPluginParametersDescription();
+
+    const std::vector<PluginParameterInfo>& getPluginParameterInfo() const {
+        return parameterInfo;
+    };
+
+    // Returns -1 if no parameter has exactly this name.
+    int getParameterIndex (const std::string& name) const;
     
     const String getPluginName();
     
@@ -92,16 +355,36 @@ public:
 
     bool removeOverridenParameter (const int index);
 
-    const std::vector<double> getAudioFrames();
+    const std::vector<double>& getAudioFrames() const;
 
-    bool writeToWav(const std::string& path);
+    // Writes the rendered mono audio as a 16 or 24 bit PCM or float32 wav,
+    // at one of the output sample rates if outputRate is not zero.
+    bool writeToWav(const std::string&   path,
+                    maxiRecorder::Format format = maxiRecorder::pcm16,
+                    const int            outputRate = 0);
     
     void loadPluginState(const std::string& inputPath);
     
     void savePluginState(const std::string& outputPath);
 
 private:
-    void fillAudioFeatures (const AudioSampleBuffer& data);
+    void sanitizeMidi ();
+
+    void replayCachedRender ();
+
+    void fillStemAudio (const AudioSampleBuffer& data,
+                        const int                startSample,
+                        const int                numSamples);
+
+    void fillAudioFeatures (const AudioSampleBuffer& data,
+                            const int                startSample,
+                            const int                numSamples);
+
+    void processBlockInSegments (AudioSampleBuffer& audioBuffer,
+                                 MidiBuffer&        blockMidiBuffer,
+                                 const int          blockStart);
+
+    void applyAutomation (const int samplePosition);
 
     void ifTimeSetNoteOff (const double& noteLength,
                            const double& sampleRate,
@@ -113,9 +396,19 @@ private:
                            MidiBuffer&   bufferToNoteOff);
 
     void fillAvailablePluginParameters (PluginPatch& params);
+
+    void fillPluginParameterInfo ();
     
     MidiFile             midiData;
     MidiBuffer           midiBuffer;
+    MidiBuffer           segmentMidiBuffer;
+    
+    // Scratch memory kept from one render to the next, so that back to back
+    // renders don't reallocate it once the engine is warmed up.
+    AudioSampleBuffer    renderBuffer;
+    AudioSampleBuffer    segmentBuffer;
+    MidiBuffer           blockMidiBuffer;
+    int                  renderBufferCapacity;
     
     double               sampleRate;
     int                  bufferSize;
@@ -123,8 +416,32 @@ private:
     PluginDescription    pluginDescription;
     PluginPatch          pluginParameters;
     PluginPatch          overridenParameters;
+    std::vector<PluginParameterInfo>     parameterInfo;
+    std::unordered_map<std::string, int> parameterIndices;
+    String               parametersDescription;
+    bool                 sampleAccurateMidi;
+    bool                 latencyCompensation;
+    bool                 midiSanitization;
+    MidiSanitizer::Options midiSanitizeOptions;
+    MidiSanitizeReport   midiSanitizeReport;
+    MidiBuffer           hangingNoteOffs;
+    std::vector<AutomationLane> automationLanes;
+    int                  automationInterval;
     std::vector<double>  processedMonoAudioPreview;
     std::vector<double>  rmsFrames;
+    std::unique_ptr<FeaturePipeline> featurePipeline;
+    std::vector<float>   featureBlock;
+    std::vector<std::unique_ptr<PolyphaseResampler>> resamplers;
+    std::unique_ptr<RenderCache> renderCache;
+    bool                 lastRenderCached;
+    bool                 multiOutput;
+    ExecutionPolicy      executionPolicy;
+    ExecutionPolicy      resolvedExecutionPolicy;
+    String               executionPolicyDescription;
+    RenderStats          lastRenderStats;
+    std::vector<OutputGroup>        outputGroups;
+    std::vector<int>                stemOutputs;
+    std::vector<std::vector<float>> stemAudio;
     double               currentRmsFrame;
 };
 
@@ -0,0 +1,244 @@
+/*
+  ==============================================================================
+
+    RenderSweep.cpp
+
+  ==============================================================================
+*/
+
+#include "RenderSweep.h"
+
+//==============================================================================
+RenderSweep::RenderSweep (int                sr,
+                          int                bufferSize,
+                          const std::string& pluginPath,
+                          int                numEngines) :
+    currentPatches (nullptr),
+    numItems (0),
+    nextItem (0)
+{
+    if (numEngines <= 0)
+        numEngines = jmax (1, int (std::thread::hardware_concurrency()));
+
+    // Plugins are loaded one after another on this thread; only rendering
+    // happens on the workers.
+    for (int i = 0; i < numEngines; ++i)
+    {
+        std::unique_ptr<RenderEngine> engine (new RenderEngine (sr, bufferSize));
+
+        if (! engine->loadPlugin (pluginPath))
+        {
+            std::cout << "RenderSweep error: Could not load the plugin into engine "
+            << i << "." << std::endl;
+            engines.clear();
+            return;
+        }
+        engines.push_back (std::move (engine));
+    }
+}
+
+//==============================================================================
+int RenderSweep::getNumParameters() const
+{
+    return engines.empty() ? 0 : int (engines[0]->getPluginParameterSize());
+}
+
+//==============================================================================
+void RenderSweep::setExecutionPolicy (const ExecutionPolicy& policy,
+                                      bool                   spread)
+{
+    const std::vector<int> cpus = policy.getCpus();
+
+    for (size_t i = 0; i < engines.size(); ++i)
+    {
+        ExecutionPolicy enginePolicy (policy);
+        if (spread && ! cpus.empty())
+        {
+            enginePolicy.cpus.assign (1, cpus[i % cpus.size()]);
+            enginePolicy.numaNode = -1;
+        }
+        engines[i]->setExecutionPolicy (enginePolicy);
+    }
+}
+
+//==============================================================================
+bool RenderSweep::createShard (const File& file,
+                               int         numPatches,
+                               int         numNotes,
+                               int         numVelocities,
+                               int         numLengths,
+                               int         numSamples,
+                               Shard&      shard)
+{
+    // A version 1.0 .npy header, padded so the data starts 64 byte aligned.
+    String header = String ("{'descr': '") + (ByteOrder::isBigEndian() ? ">f4" : "<f4")
+                  + "', 'fortran_order': False, 'shape': ("
+                  + String (numPatches) + ", " + String (numNotes) + ", "
+                  + String (numVelocities) + ", " + String (numLengths) + ", "
+                  + String (numSamples) + "), }";
+
+    const int preambleSize = 10;
+    while ((preambleSize + header.length() + 1) % 64 != 0)
+        header += " ";
+    header += "\n";
+
+    const int64 dataOffset = preambleSize + header.length();
+    const int64 dataSize = int64 (numPatches) * numNotes * numVelocities
+                         * numLengths * numSamples * int64 (sizeof (float));
+
+    file.deleteFile();
+
+    {
+        FileOutputStream stream (file);
+        if (stream.failedToOpen())
+            return false;
+
+        stream.write ("\x93NUMPY\x01\x00", 8);
+        stream.writeShort (short (header.length()));
+        stream.write (header.toRawUTF8(), size_t (header.length()));
+
+        // Grow the file to its final size, the data pages stay sparse until
+        // the workers write to them.
+        stream.setPosition (dataOffset + dataSize - 1);
+        stream.writeByte (0);
+        stream.flush();
+
+        if (stream.getStatus().failed())
+            return false;
+    }
+
+    shard.file.reset (new MemoryMappedFile (file, MemoryMappedFile::readWrite));
+
+    if (shard.file->getData() == nullptr
+        || int64 (shard.file->getSize()) != dataOffset + dataSize)
+        return false;
+
+    shard.data = reinterpret_cast<float*> (static_cast<char*> (shard.file->getData()) + dataOffset);
+    return true;
+}
+
+//==============================================================================
+StringArray RenderSweep::render (const float*               patches,
+                                 int                        numPatches,
+                                 int                        numParameters,
+                                 const std::vector<int>&    notes,
+                                 const std::vector<int>&    velocities,
+                                 const std::vector<double>& noteLengths,
+                                 double                     renderLength,
+                                 const std::string&         outputPrefix,
+                                 int                        patchesPerShard)
+{
+    StringArray shardPaths;
+
+    if (engines.empty())
+    {
+        std::cout << "RenderSweep::render error: No engines are loaded." << std::endl;
+        return shardPaths;
+    }
+    else if (numParameters != getNumParameters())
+    {
+        std::cout << "RenderSweep::render error: Incorrect patch size!" <<
+        "\n- Current size:  " << getNumParameters() <<
+        "\n- Supplied size: " << numParameters << std::endl;
+        return shardPaths;
+    }
+    else if (numPatches <= 0 || notes.empty() || velocities.empty()
+             || noteLengths.empty() || renderLength <= 0.0)
+    {
+        std::cout << "RenderSweep::render error: " <<
+                     "Patches, notes, velocities, note lengths and the render length must not be empty." <<
+                     std::endl;
+        return shardPaths;
+    }
+
+    if (patchesPerShard <= 0)
+        patchesPerShard = numPatches;
+
+    currentPatches = patches;
+    currentNumParameters = numParameters;
+    currentNotes = notes;
+    currentVelocities = velocities;
+    currentNoteLengths = noteLengths;
+    currentRenderLength = renderLength;
+    // Rows hold exactly what renderPatch produces, whole blocks included.
+    currentNumSamples = engines.front()->getNumRenderSamples (renderLength);
+    currentPatchesPerShard = patchesPerShard;
+
+    // Every shard is created up front so workers never wait on file I/O.
+    const int numShards = (numPatches + patchesPerShard - 1) / patchesPerShard;
+    shards.clear();
+    shards.resize (numShards);
+
+    for (int i = 0; i < numShards; ++i)
+    {
+        const File file (String (outputPrefix) + "_" + String (i).paddedLeft ('0', 5) + ".npy");
+        const int patchesInShard = jmin (patchesPerShard, numPatches - i * patchesPerShard);
+
+        if (! createShard (file, patchesInShard, int (notes.size()), int (velocities.size()),
+                           int (noteLengths.size()), currentNumSamples, shards[i]))
+        {
+            std::cout << "RenderSweep::render error: Could not create "
+            << file.getFullPathName().toStdString() << std::endl;
+            shards.clear();
+            return StringArray();
+        }
+        shardPaths.add (file.getFullPathName());
+    }
+
+    numItems = int64 (numPatches) * notes.size() * velocities.size() * noteLengths.size();
+    nextItem = 0;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < engines.size(); ++i)
+        workers.push_back (std::thread (&RenderSweep::renderItems, this, std::ref (*engines[i])));
+
+    renderItems (*engines[0]);
+
+    for (auto& worker : workers)
+        worker.join();
+
+    // Unmapping flushes the shards.
+    shards.clear();
+    currentPatches = nullptr;
+    return shardPaths;
+}
+
+//==============================================================================
+void RenderSweep::renderItems (RenderEngine& engine)
+{
+    const int64 numLengths = int64 (currentNoteLengths.size());
+    const int64 numVelocities = int64 (currentVelocities.size());
+    const int64 numNotes = int64 (currentNotes.size());
+    const int64 itemsPerPatch = numNotes * numVelocities * numLengths;
+    int64 appliedPatch = -1;
+
+    for (int64 item = nextItem++; item < numItems; item = nextItem++)
+    {
+        const int64 patch = item / itemsPerPatch;
+        const int64 length = item % numLengths;
+        const int64 velocity = (item / numLengths) % numVelocities;
+        const int64 note = (item / (numLengths * numVelocities)) % numNotes;
+
+        // Consecutive items mostly share a patch, only send it when it changes.
+        if (patch != appliedPatch)
+        {
+            engine.setPatchValues (currentPatches + patch * currentNumParameters,
+                                   size_t (currentNumParameters));
+            appliedPatch = patch;
+        }
+
+        engine.renderPatch (uint8 (jlimit (0, 127, currentNotes[note])),
+                            uint8 (jlimit (0, 127, currentVelocities[velocity])),
+                            currentNoteLengths[length],
+                            currentRenderLength);
+
+        const Shard& shard = shards[size_t (patch / currentPatchesPerShard)];
+        const int64 itemInShard = item - (patch / currentPatchesPerShard) * currentPatchesPerShard * itemsPerPatch;
+        float* const destination = shard.data + itemInShard * currentNumSamples;
+
+        const std::vector<double>& audio = engine.getAudioFrames();
+        const int available = jmin (currentNumSamples, int (audio.size()));
+        for (int i = 0; i < available; ++i)
+            destination[i] = float (audio[i]);
+    }
+}
@@ -0,0 +1,98 @@
+/*
+  ==============================================================================
+
+    RenderSweep.h
+
+  ==============================================================================
+*/
+
+#ifndef RENDERSWEEP_H_INCLUDED
+#define RENDERSWEEP_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "RenderEngine.h"
+
+//==============================================================================
+// Renders every combination of patch x note x velocity x note length with a
+// pool of engines, each hosting its own instance of the same plugin.
+//
+// Output goes straight into preallocated, memory mapped .npy files sharded by
+// patch, each holding a float32 array of shape
+// (patches in shard, notes, velocities, note lengths, samples), so nothing is
+// buffered in memory and the results can be opened with numpy.load
+// (mmap_mode='r') while later shards are still rendering.
+class RenderSweep
+{
+public:
+    // Loads the plugin into numEngines engines, or one per hardware thread
+    // if numEngines is zero or less.
+    RenderSweep (int                sampleRate,
+                 int                bufferSize,
+                 const std::string& pluginPath,
+                 int                numEngines);
+
+    bool isReady() const {
+        return ! engines.empty();
+    };
+
+    int getNumEngines() const {
+        return int (engines.size());
+    };
+
+    int getNumParameters() const;
+
+    // Sets the execution policy of every engine. With spread, engine i is
+    // pinned to the i-th of the policy's CPUs alone (wrapping around)
+    // instead of all engines sharing them.
+    void setExecutionPolicy (const ExecutionPolicy& policy,
+                             bool                   spread);
+
+    // patches is a row major numPatches x getNumParameters() matrix in the
+    // engines' patch order, as produced by PatchGenerator. Returns the shard
+    // paths (outputPrefix_00000.npy, ...) or an empty list on error.
+    StringArray render (const float*               patches,
+                        int                        numPatches,
+                        int                        numParameters,
+                        const std::vector<int>&    notes,
+                        const std::vector<int>&    velocities,
+                        const std::vector<double>& noteLengths,
+                        double                     renderLength,
+                        const std::string&         outputPrefix,
+                        int                        patchesPerShard);
+
+private:
+    struct Shard
+    {
+        std::unique_ptr<MemoryMappedFile> file;
+        float*                            data;
+    };
+
+    static bool createShard (const File& file,
+                             int         numPatches,
+                             int         numNotes,
+                             int         numVelocities,
+                             int         numLengths,
+                             int         numSamples,
+                             Shard&      shard);
+
+    void renderItems (RenderEngine& engine);
+
+    std::vector<std::unique_ptr<RenderEngine>> engines;
+
+    // State of the render currently running, shared by the worker threads.
+    const float*          currentPatches;
+    int                   currentNumParameters;
+    std::vector<int>      currentNotes;
+    std::vector<int>      currentVelocities;
+    std::vector<double>   currentNoteLengths;
+    double                currentRenderLength;
+    int                   currentNumSamples;
+    int                   currentPatchesPerShard;
+    int64                 numItems;
+    std::vector<Shard>    shards;
+    std::atomic<int64>    nextItem;
+};
+
+#endif  // RENDERSWEEP_H_INCLUDED
@@ -0,0 +1,821 @@
+/*
+  ==============================================================================
+
+    SfzInstrument.cpp
+
+  ==============================================================================
+*/
+
+#include "SfzInstrument.h"
+#include <cctype>
+#include <limits>
+#include <map>
+
+namespace
+{
+    const char* const sfzPathPrefix = "internal:sfz:";
+
+    // Upper limit on how fast a voice may step through its sample. Bounds the
+    // size of the read scratch buffer so processBlock never allocates.
+    const double maxIncrement = 8.0;
+
+    CriticalSection& getSampleCacheLock()
+    {
+        static CriticalSection lock;
+        return lock;
+    }
+
+    std::map<String, SfzSampleData::Ptr>& getSampleCache()
+    {
+        static std::map<String, SfzSampleData::Ptr> cache;
+        return cache;
+    }
+
+    // Drops cached samples that no instrument refers to any more. Only the
+    // cache holds a reference when the count is one, so nothing can race us
+    // into copying the pointer while we hold the lock.
+    void releaseUnusedSamples()
+    {
+        const ScopedLock sl (getSampleCacheLock());
+        auto& cache = getSampleCache();
+
+        for (auto it = cache.begin(); it != cache.end();)
+        {
+            if (it->second->getReferenceCount() == 1)
+                it = cache.erase (it);
+            else
+                ++it;
+        }
+    }
+
+    //==========================================================================
+    // Splits an SFZ file into headers ("<region>", "") and opcode/value pairs.
+    // Values run to the end of the line or the next "opcode=", so sample paths
+    // with spaces in them survive.
+    void tokenise (const std::string& s,
+                   std::vector<std::pair<String, String>>& tokens)
+    {
+        const size_t n = s.size();
+        size_t i = 0;
+
+        while (i < n)
+        {
+            const char c = s[i];
+
+            if (std::isspace ((unsigned char) c))
+            {
+                ++i;
+            }
+            else if (c == '/' && i + 1 < n && s[i + 1] == '/')
+            {
+                i = s.find ('\n', i);
+            }
+            else if (c == '/' && i + 1 < n && s[i + 1] == '*')
+            {
+                i = s.find ("*/", i);
+                i = (i == std::string::npos) ? n : i + 2;
+            }
+            else if (c == '#')
+            {
+                // #define and #include are not supported.
+                i = s.find ('\n', i);
+            }
+            else if (c == '<')
+            {
+                const size_t close = s.find ('>', i);
+                if (close == std::string::npos)
+                    break;
+
+                tokens.push_back (std::make_pair (String (s.substr (i, close - i + 1)).toLowerCase(),
+                                                  String()));
+                i = close + 1;
+            }
+            else
+            {
+                const size_t equals = s.find ('=', i);
+                if (equals == std::string::npos)
+                    break;
+
+                size_t k = equals + 1;
+                while (k < n)
+                {
+                    if (s[k] == '\n' || s[k] == '\r' || s[k] == '<')
+                        break;
+                    if (s[k] == '/' && k + 1 < n && s[k + 1] == '/')
+                        break;
+                    if (s[k] == ' ' || s[k] == '\t')
+                    {
+                        size_t m = k;
+                        while (m < n && (s[m] == ' ' || s[m] == '\t'))
+                            ++m;
+                        const size_t identifierStart = m;
+                        while (m < n && (std::isalnum ((unsigned char) s[m]) || s[m] == '_'))
+                            ++m;
+                        if (m > identifierStart && m < n && s[m] == '=')
+                            break;
+                    }
+                    ++k;
+                }
+
+                tokens.push_back (std::make_pair (String (s.substr (i, equals - i)).trim().toLowerCase(),
+                                                  String (s.substr (equals + 1, k - equals - 1)).trim()));
+                i = k;
+            }
+
+            if (i == std::string::npos)
+                break;
+        }
+    }
+
+    //==========================================================================
+    // Accepts MIDI numbers or note names, where c4 is 60.
+    int parseKey (const String& value)
+    {
+        const String v = value.trim().toLowerCase();
+        if (v.isEmpty())
+            return 0;
+
+        const juce_wchar first = v[0];
+        if (first == '-' || CharacterFunctions::isDigit (first))
+            return jlimit (0, 127, v.getIntValue());
+
+        static const int semitones[] = { 9, 11, 0, 2, 4, 5, 7 }; // a b c d e f g
+        if (first < 'a' || first > 'g')
+            return 0;
+
+        int note = semitones[first - 'a'];
+        int index = 1;
+
+        if (v[index] == '#')
+        {
+            ++note;
+            ++index;
+        }
+        else if (v[index] == 'b')
+        {
+            --note;
+            ++index;
+        }
+
+        const int octave = v.substring (index).getIntValue();
+        return jlimit (0, 127, (octave + 1) * 12 + note);
+    }
+
+    void applyOpcode (SfzRegion& region, const String& name, const String& value)
+    {
+        if      (name == "lokey")           region.loKey = parseKey (value);
+        else if (name == "hikey")           region.hiKey = parseKey (value);
+        else if (name == "key")             region.loKey = region.hiKey = region.pitchKeyCenter = parseKey (value);
+        else if (name == "pitch_keycenter") region.pitchKeyCenter = parseKey (value);
+        else if (name == "pitch_keytrack")  region.pitchKeyTrack = value.getFloatValue();
+        else if (name == "lovel")           region.loVel = jlimit (0, 127, value.getIntValue());
+        else if (name == "hivel")           region.hiVel = jlimit (0, 127, value.getIntValue());
+        else if (name == "seq_length")      region.seqLength = jmax (1, value.getIntValue());
+        else if (name == "seq_position")    region.seqPosition = jmax (1, value.getIntValue());
+        else if (name == "lorand")          region.loRand = value.getFloatValue();
+        else if (name == "hirand")          region.hiRand = value.getFloatValue();
+        else if (name == "volume")          region.gain *= Decibels::decibelsToGain (value.getFloatValue(), -144.0f);
+        else if (name == "amplitude")       region.gain *= value.getFloatValue() / 100.0f;
+        else if (name == "amp_veltrack")    region.velTrack = value.getFloatValue();
+        else if (name == "transpose")       region.transpose = value.getIntValue();
+        else if (name == "tune")            region.tune = value.getFloatValue();
+        else if (name == "offset")          region.offset = jmax ((int64) 0, value.getLargeIntValue());
+        else if (name == "end")             region.end = value.getLargeIntValue();
+        else if (name == "loop_mode")       region.oneShot = (value == "one_shot");
+        else if (name == "group")           region.group = value.getIntValue();
+        else if (name == "off_by")          region.offBy = value.getIntValue();
+        else if (name == "ampeg_attack")    region.attack = jmax (0.0f, value.getFloatValue());
+        else if (name == "ampeg_hold")      region.hold = jmax (0.0f, value.getFloatValue());
+        else if (name == "ampeg_decay")     region.decay = jmax (0.0f, value.getFloatValue());
+        else if (name == "ampeg_sustain")   region.sustain = jlimit (0.0f, 100.0f, value.getFloatValue()) / 100.0f;
+        else if (name == "ampeg_release")   region.release = jmax (0.001f, value.getFloatValue());
+    }
+}
+
+//==============================================================================
+SfzSampleData::Ptr SfzSampleData::load (const File& file)
+{
+    const String key = file.getFullPathName();
+
+    {
+        const ScopedLock sl (getSampleCacheLock());
+        auto it = getSampleCache().find (key);
+        if (it != getSampleCache().end())
+            return it->second;
+    }
+
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    Ptr data = new SfzSampleData();
+
+    if (AudioFormat* format = formatManager.findFormatForFileExtension (file.getFileExtension()))
+    {
+        ScopedPointer<MemoryMappedAudioFormatReader> mapped (format->createMemoryMappedReader (file));
+
+        if (mapped != nullptr && mapped->mapEntireFile())
+        {
+            data->lengthInSamples = mapped->lengthInSamples;
+            data->sampleRate      = mapped->sampleRate;
+            data->numChannels     = (int) mapped->numChannels;
+            data->mappedReader    = mapped.release();
+        }
+    }
+
+    if (data->mappedReader == nullptr)
+    {
+        ScopedPointer<AudioFormatReader> reader (formatManager.createReaderFor (file));
+
+        if (reader == nullptr)
+            return nullptr;
+
+        data->lengthInSamples = reader->lengthInSamples;
+        data->sampleRate      = reader->sampleRate;
+        data->numChannels     = (int) reader->numChannels;
+        data->decodedData.setSize (data->numChannels, (int) data->lengthInSamples);
+        reader->read (&data->decodedData, 0, (int) data->lengthInSamples, 0, true, true);
+    }
+
+    const ScopedLock sl (getSampleCacheLock());
+    auto inserted = getSampleCache().insert (std::make_pair (key, data));
+    return inserted.first->second;
+}
+
+//==============================================================================
+void SfzSampleData::read (AudioSampleBuffer& destination,
+                          int                startSample,
+                          int                numSamples,
+                          int64              sourceStartSample) const
+{
+    const int available = (int) jlimit ((int64) 0,
+                                        (int64) numSamples,
+                                        lengthInSamples - sourceStartSample);
+
+    if (available > 0)
+    {
+        if (mappedReader != nullptr)
+        {
+            mappedReader->read (&destination, startSample, available,
+                                sourceStartSample, true, true);
+        }
+        else
+        {
+            for (int channel = 0; channel < destination.getNumChannels(); ++channel)
+                destination.copyFrom (channel, startSample, decodedData,
+                                      jmin (channel, numChannels - 1),
+                                      (int) sourceStartSample, available);
+        }
+    }
+
+    if (available < numSamples)
+        for (int channel = 0; channel < destination.getNumChannels(); ++channel)
+            destination.clear (channel, startSample + available, numSamples - available);
+}
+
+//==============================================================================
+bool SfzInstrument::isSfzPath (const std::string& path)
+{
+    return String (path).startsWith (sfzPathPrefix);
+}
+
+//==============================================================================
+SfzInstrument* SfzInstrument::createFromPath (const std::string& path,
+                                              String&            errorMessage)
+{
+    const File file (String (path).fromFirstOccurrenceOf (sfzPathPrefix, false, false));
+    ScopedPointer<SfzInstrument> instrument (new SfzInstrument (file));
+
+    if (! instrument->parse (errorMessage))
+        return nullptr;
+
+    return instrument.release();
+}
+
+//==============================================================================
+SfzInstrument::SfzInstrument (const File& file) :
+    AudioPluginInstance (BusesProperties().withOutput ("Output", AudioChannelSet::stereo(), true)),
+    sourceFile (file),
+    voiceCounter (0),
+    random (0),
+    hostSampleRate (44100.0),
+    maxBlockSize (0)
+{
+    zeromem (roundRobinCounters, sizeof (roundRobinCounters));
+}
+
+SfzInstrument::~SfzInstrument()
+{
+    regions.clear();
+    releaseUnusedSamples();
+}
+
+//==============================================================================
+bool SfzInstrument::parse (String& errorMessage)
+{
+    if (! sourceFile.existsAsFile())
+    {
+        errorMessage = "SFZ file does not exist: " + sourceFile.getFullPathName();
+        return false;
+    }
+
+    if (! sourceFile.hasFileExtension ("sfz"))
+    {
+        // A lone sample is a one-shot spanning the keyboard at its own pitch.
+        SfzRegion region;
+        region.sample = SfzSampleData::load (sourceFile);
+        region.pitchKeyTrack = 0.0f;
+        region.oneShot = true;
+
+        if (region.sample == nullptr)
+        {
+            errorMessage = "Unable to read sample: " + sourceFile.getFullPathName();
+            return false;
+        }
+
+        regions.push_back (region);
+        return true;
+    }
+
+    std::vector<std::pair<String, String>> tokens;
+    tokenise (sourceFile.loadFileAsString().toStdString(), tokens);
+
+    StringPairArray globalOpcodes, masterOpcodes, groupOpcodes, regionOpcodes;
+    StringPairArray* current = nullptr;
+    String defaultPath;
+    bool inRegion = false;
+
+    auto flushRegion = [&] () -> bool
+    {
+        if (! inRegion)
+            return true;
+
+        inRegion = false;
+
+        StringPairArray merged (globalOpcodes);
+        merged.addArray (masterOpcodes);
+        merged.addArray (groupOpcodes);
+        merged.addArray (regionOpcodes);
+
+        if (merged.getValue ("trigger", "attack") != "attack")
+            return true;
+
+        const String sampleName = merged.getValue ("sample", String());
+        if (sampleName.isEmpty())
+            return true;
+
+        const String relativePath = (defaultPath + sampleName).replaceCharacter ('\\', '/');
+        const File sampleFile = sourceFile.getParentDirectory().getChildFile (relativePath);
+
+        SfzRegion region;
+        for (int i = 0; i < merged.size(); ++i)
+            applyOpcode (region, merged.getAllKeys()[i], merged.getAllValues()[i]);
+
+        // "key" also sets the centre, but an explicit pitch_keycenter wins.
+        if (merged.containsKey ("pitch_keycenter"))
+            applyOpcode (region, "pitch_keycenter", merged["pitch_keycenter"]);
+
+        region.sample = SfzSampleData::load (sampleFile);
+
+        if (region.sample == nullptr)
+        {
+            errorMessage = "Unable to read sample: " + sampleFile.getFullPathName();
+            return false;
+        }
+
+        regions.push_back (region);
+        return true;
+    };
+
+    for (const auto& token : tokens)
+    {
+        if (token.first.startsWithChar ('<'))
+        {
+            if (! flushRegion())
+                return false;
+
+            if (token.first == "<control>")
+            {
+                current = nullptr;
+            }
+            else if (token.first == "<global>")
+            {
+                globalOpcodes.clear();
+                masterOpcodes.clear();
+                groupOpcodes.clear();
+                current = &globalOpcodes;
+            }
+            else if (token.first == "<master>")
+            {
+                masterOpcodes.clear();
+                groupOpcodes.clear();
+                current = &masterOpcodes;
+            }
+            else if (token.first == "<group>")
+            {
+                groupOpcodes.clear();
+                current = &groupOpcodes;
+            }
+            else if (token.first == "<region>")
+            {
+                regionOpcodes.clear();
+                current = &regionOpcodes;
+                inRegion = true;
+            }
+            else
+            {
+                // Unsupported header, ignore its opcodes.
+                current = nullptr;
+            }
+        }
+        else if (token.first == "default_path")
+        {
+            defaultPath = token.second;
+        }
+        else if (current != nullptr)
+        {
+            current->set (token.first, token.second);
+        }
+    }
+
+    if (! flushRegion())
+        return false;
+
+    if (regions.empty())
+    {
+        errorMessage = "SFZ file has no playable regions: " + sourceFile.getFullPathName();
+        return false;
+    }
+
+    return true;
+}
+
+//==============================================================================
+void SfzInstrument::fillInPluginDescription (PluginDescription& description) const
+{
+    description.name              = sourceFile.getFileNameWithoutExtension();
+    description.descriptiveName   = "SFZ Sampler: " + sourceFile.getFileName();
+    description.pluginFormatName  = "Internal";
+    description.category          = "Sampler";
+    description.manufacturerName  = "RenderMan";
+    description.version           = "1.0";
+    description.fileOrIdentifier  = sfzPathPrefix + sourceFile.getFullPathName();
+    description.uid               = sourceFile.getFullPathName().hashCode();
+    description.isInstrument      = true;
+    description.numInputChannels  = 0;
+    description.numOutputChannels = 2;
+}
+
+//==============================================================================
+const String SfzInstrument::getName() const
+{
+    return sourceFile.getFileNameWithoutExtension();
+}
+
+//==============================================================================
+void SfzInstrument::prepareToPlay (double sampleRate,
+                                   int    maximumExpectedSamplesPerBlock)
+{
+    hostSampleRate = sampleRate;
+    maxBlockSize = jmax (1, maximumExpectedSamplesPerBlock);
+
+    const int maxReadLength = int (std::ceil (maxBlockSize * maxIncrement)) + 3;
+    readScratch.setSize (2, maxReadLength);
+    pitchScratch.setSize (2, maxBlockSize);
+    gainScratch.setSize (1, maxBlockSize);
+
+    reset();
+}
+
+//==============================================================================
+void SfzInstrument::releaseResources()
+{
+    readScratch.setSize (0, 0);
+    pitchScratch.setSize (0, 0);
+    gainScratch.setSize (0, 0);
+    maxBlockSize = 0;
+}
+
+//==============================================================================
+void SfzInstrument::reset()
+{
+    for (auto& voice : voices)
+        voice = Voice();
+
+    zeromem (roundRobinCounters, sizeof (roundRobinCounters));
+    voiceCounter = 0;
+    random.setSeed (0);
+}
+
+//==============================================================================
+double SfzInstrument::getTailLengthSeconds() const
+{
+    float longestRelease = 0.0f;
+    for (const auto& region : regions)
+        longestRelease = jmax (longestRelease, region.release);
+    return longestRelease;
+}
+
+//==============================================================================
+void SfzInstrument::processBlock (AudioSampleBuffer& buffer,
+                                  MidiBuffer&        midiMessages)
+{
+    const int numSamples = buffer.getNumSamples();
+    buffer.clear();
+
+    // The scratch buffers are only there after prepareToPlay.
+    jassert (maxBlockSize > 0);
+    if (maxBlockSize <= 0)
+        return;
+
+    MidiBuffer::Iterator iterator (midiMessages);
+    MidiMessage message;
+    int eventPosition;
+    int renderedUpTo = 0;
+
+    while (iterator.getNextEvent (message, eventPosition))
+    {
+        eventPosition = jlimit (0, numSamples, eventPosition);
+        renderVoices (buffer, renderedUpTo, eventPosition - renderedUpTo);
+        renderedUpTo = eventPosition;
+        handleMidiEvent (message);
+    }
+
+    renderVoices (buffer, renderedUpTo, numSamples - renderedUpTo);
+}
+
+//==============================================================================
+void SfzInstrument::handleMidiEvent (const MidiMessage& message)
+{
+    if (message.isNoteOn())
+    {
+        const int note = message.getNoteNumber();
+        const int velocity = message.getVelocity();
+        const int sequenceIndex = roundRobinCounters[note]++;
+        const float randomValue = random.nextFloat();
+
+        for (const auto& region : regions)
+        {
+            if (note < region.loKey || note > region.hiKey
+                || velocity < region.loVel || velocity > region.hiVel)
+                continue;
+
+            if (region.seqLength > 1
+                && (sequenceIndex % region.seqLength) != region.seqPosition - 1)
+                continue;
+
+            if (randomValue < region.loRand || randomValue >= region.hiRand)
+                continue;
+
+            if (region.group != 0)
+                for (auto& voice : voices)
+                    if (voice.stage != Voice::idleStage && voice.region->offBy == region.group)
+                        releaseVoice (voice, 0.005f);
+
+            startVoice (region, note, velocity);
+        }
+    }
+    else if (message.isNoteOff())
+    {
+        for (auto& voice : voices)
+            if (voice.note == message.getNoteNumber()
+                && voice.stage < Voice::releaseStage
+                && ! voice.region->oneShot)
+                releaseVoice (voice, voice.region->release);
+    }
+    else if (message.isAllNotesOff())
+    {
+        for (auto& voice : voices)
+            if (voice.stage < Voice::releaseStage)
+                releaseVoice (voice, voice.region->release);
+    }
+    else if (message.isAllSoundOff())
+    {
+        for (auto& voice : voices)
+            voice = Voice();
+    }
+}
+
+//==============================================================================
+void SfzInstrument::startVoice (const SfzRegion& region,
+                                int              note,
+                                int              velocity)
+{
+    // Take a free voice, or steal the oldest one.
+    Voice* voice = &voices[0];
+    for (auto& candidate : voices)
+    {
+        if (candidate.stage == Voice::idleStage)
+        {
+            voice = &candidate;
+            break;
+        }
+
+        if (candidate.startOrder < voice->startOrder)
+            voice = &candidate;
+    }
+
+    const SfzSampleData& sample = *region.sample;
+    const double semitones = (note - region.pitchKeyCenter) * region.pitchKeyTrack / 100.0
+                           + region.transpose + region.tune / 100.0;
+
+    double increment = std::pow (2.0, semitones / 12.0) * sample.getSampleRate() / hostSampleRate;
+    increment = jlimit (1.0 / 64.0, maxIncrement, increment);
+    if (std::abs (increment - 1.0) < 1e-9)
+        increment = 1.0;
+
+    const float velocityCurve = (velocity / 127.0f) * (velocity / 127.0f);
+
+    voice->region      = &region;
+    voice->note        = note;
+    voice->position    = double (region.offset);
+    voice->increment   = increment;
+    voice->endPosition = region.end >= 0 ? jmin (region.end + 1, sample.getLengthInSamples())
+                                         : sample.getLengthInSamples();
+    voice->gain        = region.gain * (1.0f - region.velTrack / 100.0f * (1.0f - velocityCurve));
+    voice->level       = 0.0f;
+    voice->startOrder  = ++voiceCounter;
+
+    enterStage (*voice, Voice::attackStage);
+}
+
+//==============================================================================
+void SfzInstrument::releaseVoice (Voice& voice, float releaseSeconds)
+{
+    voice.stageSamplesLeft = jmax ((int64) 1, (int64) (releaseSeconds * hostSampleRate));
+    voice.slope = -voice.level / float (voice.stageSamplesLeft);
+    voice.stage = Voice::releaseStage;
+}
+
+//==============================================================================
+void SfzInstrument::enterStage (Voice& voice, Voice::Stage stage)
+{
+    const SfzRegion& region = *voice.region;
+
+    // Zero length stages fall straight through to the next one.
+    for (;;)
+    {
+        voice.stage = stage;
+
+        switch (stage)
+        {
+            case Voice::attackStage:
+                voice.stageSamplesLeft = (int64) (region.attack * hostSampleRate);
+                if (voice.stageSamplesLeft > 0)
+                {
+                    voice.slope = (1.0f - voice.level) / float (voice.stageSamplesLeft);
+                    return;
+                }
+                voice.level = 1.0f;
+                stage = Voice::holdStage;
+                break;
+
+            case Voice::holdStage:
+                voice.stageSamplesLeft = (int64) (region.hold * hostSampleRate);
+                voice.slope = 0.0f;
+                if (voice.stageSamplesLeft > 0)
+                    return;
+                stage = Voice::decayStage;
+                break;
+
+            case Voice::decayStage:
+                voice.stageSamplesLeft = (int64) (region.decay * hostSampleRate);
+                if (voice.stageSamplesLeft > 0)
+                {
+                    voice.slope = (region.sustain - voice.level) / float (voice.stageSamplesLeft);
+                    return;
+                }
+                voice.level = region.sustain;
+                stage = Voice::sustainStage;
+                break;
+
+            case Voice::sustainStage:
+                voice.slope = 0.0f;
+                voice.stageSamplesLeft = std::numeric_limits<int64>::max();
+                if (voice.level <= 0.0f)
+                    voice.stage = Voice::idleStage;
+                return;
+
+            case Voice::releaseStage:
+            case Voice::idleStage:
+            default:
+                voice.stage = Voice::idleStage;
+                return;
+        }
+    }
+}
+
+//==============================================================================
+void SfzInstrument::renderVoices (AudioSampleBuffer& buffer,
+                                  int                startSample,
+                                  int                numSamples)
+{
+    while (numSamples > 0)
+    {
+        const int chunk = jmin (numSamples, maxBlockSize);
+
+        for (auto& voice : voices)
+            if (voice.stage != Voice::idleStage)
+                renderVoice (voice, buffer, startSample, chunk);
+
+        startSample += chunk;
+        numSamples -= chunk;
+    }
+}
+
+//==============================================================================
+void SfzInstrument::renderVoice (Voice&             voice,
+                                 AudioSampleBuffer& buffer,
+                                 int                startSample,
+                                 int                numSamples)
+{
+    const SfzSampleData& sample = *voice.region->sample;
+    const int numOutputChannels = buffer.getNumChannels();
+    int rendered = 0;
+
+    while (rendered < numSamples && voice.stage != Voice::idleStage)
+    {
+        // Render up to the next envelope breakpoint so each piece is a
+        // single linear gain ramp.
+        int segment = (int) jmin ((int64) (numSamples - rendered), voice.stageSamplesLeft);
+
+        const double samplesUntilEnd = (voice.endPosition - voice.position) / voice.increment;
+        const bool reachesEnd = samplesUntilEnd <= segment;
+        if (reachesEnd)
+            segment = jmax (0, (int) samplesUntilEnd);
+
+        if (segment > 0)
+        {
+            const AudioSampleBuffer* source = &readScratch;
+            const int64 firstIndex = (int64) voice.position;
+
+            if (voice.increment == 1.0)
+            {
+                sample.read (readScratch, 0, segment, firstIndex);
+            }
+            else
+            {
+                const double fraction = voice.position - double (firstIndex);
+                const int span = int (fraction + (segment - 1) * voice.increment) + 2;
+                sample.read (readScratch, 0, span, firstIndex);
+
+                for (int channel = 0; channel < 2; ++channel)
+                {
+                    const float* in = readScratch.getReadPointer (channel);
+                    float* out = pitchScratch.getWritePointer (channel);
+                    double position = fraction;
+
+                    for (int i = 0; i < segment; ++i)
+                    {
+                        const int index = int (position);
+                        const float alpha = float (position - index);
+                        out[i] = in[index] + alpha * (in[index + 1] - in[index]);
+                        position += voice.increment;
+                    }
+                }
+
+                source = &pitchScratch;
+            }
+
+            const float endLevel = voice.level + voice.slope * float (segment);
+            const float startGain = voice.gain * voice.level;
+
+            if (voice.slope == 0.0f)
+            {
+                for (int channel = 0; channel < numOutputChannels; ++channel)
+                    FloatVectorOperations::addWithMultiply (buffer.getWritePointer (channel, startSample + rendered),
+                                                            source->getReadPointer (channel % 2),
+                                                            startGain,
+                                                            segment);
+            }
+            else
+            {
+                // The envelope ramp is built once and shared by the channels,
+                // so mixing is a vectorised multiply-add per channel.
+                float* gains = gainScratch.getWritePointer (0);
+                const float gainStep = voice.gain * voice.slope;
+                for (int i = 0; i < segment; ++i)
+                    gains[i] = startGain + gainStep * float (i);
+
+                for (int channel = 0; channel < numOutputChannels; ++channel)
+                    FloatVectorOperations::addWithMultiply (buffer.getWritePointer (channel, startSample + rendered),
+                                                            source->getReadPointer (channel % 2),
+                                                            gains,
+                                                            segment);
+            }
+
+            voice.position += segment * voice.increment;
+            voice.level = endLevel;
+            voice.stageSamplesLeft -= segment;
+            rendered += segment;
+        }
+
+        if (reachesEnd)
+        {
+            voice.stage = Voice::idleStage;
+        }
+        else if (voice.stageSamplesLeft <= 0)
+        {
+            enterStage (voice, Voice::Stage (voice.stage + 1));
+        }
+    }
+}
@@ -0,0 +1,182 @@
+/*
+  ==============================================================================
+
+    SfzInstrument.h
+
+  ==============================================================================
+*/
+
+#ifndef SFZINSTRUMENT_H_INCLUDED
+#define SFZINSTRUMENT_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// Audio data for one sample file. Instances are shared by every SfzInstrument
+// in the process through a cache keyed on the file path. WAV and AIFF files are
+// memory mapped, so the pages are also shared with other processes and only
+// the parts that actually get played are ever faulted in. Formats that can't
+// be mapped (FLAC, Ogg) are decoded once into memory.
+class SfzSampleData : public ReferenceCountedObject
+{
+public:
+    typedef ReferenceCountedObjectPtr<SfzSampleData> Ptr;
+
+    static Ptr load (const File& file);
+
+    // Reads float samples into the destination, zero filling past the end of
+    // the file. Safe to call from several threads at once.
+    void read (AudioSampleBuffer& destination,
+               int                startSample,
+               int                numSamples,
+               int64              sourceStartSample) const;
+
+    int64  getLengthInSamples() const  { return lengthInSamples; }
+    double getSampleRate() const       { return sampleRate; }
+    int    getNumChannels() const      { return numChannels; }
+
+private:
+    SfzSampleData() {}
+
+    ScopedPointer<MemoryMappedAudioFormatReader> mappedReader;
+    AudioSampleBuffer                            decodedData;
+    int64                                        lengthInSamples = 0;
+    double                                       sampleRate      = 44100.0;
+    int                                          numChannels     = 0;
+};
+
+//==============================================================================
+// One <region> of an SFZ file with its inherited <global>/<master>/<group>
+// opcodes already applied.
+struct SfzRegion
+{
+    SfzSampleData::Ptr sample;
+    int   loKey          = 0;
+    int   hiKey          = 127;
+    int   pitchKeyCenter = 60;
+    float pitchKeyTrack  = 100.0f;
+    int   loVel          = 1;
+    int   hiVel          = 127;
+    int   seqLength      = 1;
+    int   seqPosition    = 1;
+    float loRand         = 0.0f;
+    float hiRand         = 1.0f;
+    float gain           = 1.0f;
+    float velTrack       = 100.0f;
+    int   transpose      = 0;
+    float tune           = 0.0f;
+    int64 offset         = 0;
+    int64 end            = -1;
+    bool  oneShot        = false;
+    int   group          = 0;
+    int   offBy          = 0;
+    float attack         = 0.0f;
+    float hold           = 0.0f;
+    float decay          = 0.0f;
+    float sustain        = 1.0f;
+    float release        = 0.001f;
+};
+
+//==============================================================================
+// A native sample player that RenderEngine can load in place of a VST/AU with
+// a path of the form "internal:sfz:/path/kit.sfz". A plain audio file path
+// ("internal:sfz:/path/hit.wav") is played as a one-shot across the keyboard.
+//
+// Supports velocity layers, sequential and random round robins, choke groups
+// and a linear AHDSR amplitude envelope. Every MIDI event is handled at its
+// exact sample. Pitch interpolation is scalar, mixing a voice into the output
+// is a SIMD multiply-add (FloatVectorOperations::addWithMultiply).
+class SfzInstrument : public AudioPluginInstance
+{
+public:
+    static bool isSfzPath (const std::string& path);
+
+    // Returns nullptr and fills errorMessage if the file can't be parsed.
+    static SfzInstrument* createFromPath (const std::string& path,
+                                          String&            errorMessage);
+
+    ~SfzInstrument();
+
+    //==========================================================================
+    void fillInPluginDescription (PluginDescription& description) const override;
+
+    const String getName() const override;
+
+    void prepareToPlay (double sampleRate, int maximumExpectedSamplesPerBlock) override;
+
+    void releaseResources() override;
+
+    void reset() override;
+
+    void processBlock (AudioSampleBuffer& buffer, MidiBuffer& midiMessages) override;
+
+    double getTailLengthSeconds() const override;
+
+    bool acceptsMidi() const override                    { return true; }
+    bool producesMidi() const override                   { return false; }
+    AudioProcessorEditor* createEditor() override        { return nullptr; }
+    bool hasEditor() const override                      { return false; }
+    int getNumPrograms() override                        { return 1; }
+    int getCurrentProgram() override                     { return 0; }
+    void setCurrentProgram (int) override                {}
+    const String getProgramName (int) override           { return getName(); }
+    void changeProgramName (int, const String&) override {}
+    void getStateInformation (juce::MemoryBlock&) override {}
+    void setStateInformation (const void*, int) override {}
+
+    int getNumRegions() const                            { return int (regions.size()); }
+
+private:
+    struct Voice
+    {
+        enum Stage { attackStage, holdStage, decayStage, sustainStage, releaseStage, idleStage };
+
+        const SfzRegion* region = nullptr;
+        int    note             = -1;
+        double position         = 0.0;
+        double increment        = 1.0;
+        int64  endPosition      = 0;
+        float  gain             = 0.0f;
+        float  level            = 0.0f;
+        float  slope            = 0.0f;
+        int64  stageSamplesLeft = 0;
+        Stage  stage            = idleStage;
+        uint32 startOrder       = 0;
+    };
+
+    SfzInstrument (const File& sourceFile);
+
+    bool parse (String& errorMessage);
+
+    void handleMidiEvent (const MidiMessage& message);
+
+    void startVoice (const SfzRegion& region, int note, int velocity);
+
+    void releaseVoice (Voice& voice, float releaseSeconds);
+
+    void enterStage (Voice& voice, Voice::Stage stage);
+
+    void renderVoices (AudioSampleBuffer& buffer, int startSample, int numSamples);
+
+    void renderVoice (Voice& voice, AudioSampleBuffer& buffer, int startSample, int numSamples);
+
+    static const int maxVoices = 64;
+
+    File                   sourceFile;
+    std::vector<SfzRegion> regions;
+    Voice                  voices[maxVoices];
+    int                    roundRobinCounters[128];
+    uint32                 voiceCounter;
+    Random                 random;
+    AudioSampleBuffer      readScratch;
+    AudioSampleBuffer      pitchScratch;
+    AudioSampleBuffer      gainScratch;
+    double                 hostSampleRate;
+    int                    maxBlockSize;
+};
+
+#endif  // SFZINSTRUMENT_H_INCLUDED
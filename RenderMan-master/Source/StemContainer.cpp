@@ -0,0 +1,302 @@
+/*
+  ==============================================================================
+
+    StemContainer.cpp
+
+  ==============================================================================
+*/
+
+#include "StemContainer.h"
+
+namespace
+{
+    const char* const magic = "SLKHSTEM";
+    const int version = 1;
+    const int flacBitDepth = 24;
+
+    void writeString (OutputStream& stream, const String& text)
+    {
+        const size_t size = text.getNumBytesAsUTF8();
+        stream.writeInt (int (size));
+        stream.write (text.toRawUTF8(), size);
+    }
+
+    bool readString (MemoryInputStream& stream, String& text)
+    {
+        const int size = stream.readInt();
+        if (size < 0 || size > stream.getNumBytesRemaining())
+            return false;
+
+        const char* const start = static_cast<const char*> (stream.getData()) + stream.getPosition();
+        text = String::fromUTF8 (start, size);
+        stream.skipNextBytes (size);
+        return true;
+    }
+}
+
+//==============================================================================
+bool StemContainer::write (const File&                      file,
+                           const StringArray&               streamNames,
+                           const std::vector<const float*>& streams,
+                           const int64                      totalFrames,
+                           const double                     rate,
+                           const double                     chunkSeconds,
+                           const Compression                chunkCompression,
+                           const String&                    trackMetadata)
+{
+    if (streams.empty() || size_t (streamNames.size()) != streams.size()
+        || totalFrames <= 0 || rate <= 0.0 || chunkSeconds <= 0.0)
+    {
+        std::cout << "StemContainer::write error: " <<
+                     "Give one name per stream, a positive length, sample rate and chunk duration." <<
+                     std::endl;
+        return false;
+    }
+
+    const int chunkFrames = jmax (1, int (std::round (chunkSeconds * rate)));
+    const int numChunks = int ((totalFrames + chunkFrames - 1) / chunkFrames);
+    const int numStreams = int (streams.size());
+
+    file.deleteFile();
+    FileOutputStream stream (file);
+    if (stream.failedToOpen())
+    {
+        std::cout << "StemContainer::write error: Could not open "
+        << file.getFullPathName().toStdString() << std::endl;
+        return false;
+    }
+
+    stream.write (magic, 8);
+    stream.writeInt (version);
+    stream.writeInt (numStreams);
+    stream.writeDouble (rate);
+    stream.writeInt (chunkFrames);
+    stream.writeInt64 (totalFrames);
+    stream.writeInt (numChunks);
+    stream.writeInt (int (chunkCompression));
+    writeString (stream, trackMetadata);
+    for (const String& name : streamNames)
+        writeString (stream, name);
+
+    // The index is filled in once the chunk sizes are known.
+    const int64 indexPosition = stream.getPosition();
+    for (int i = 0; i < numChunks * 2; ++i)
+        stream.writeInt64 (0);
+    while (stream.getPosition() % 64 != 0)
+        stream.writeByte (0);
+
+    std::vector<int64> offsets, sizes;
+    offsets.resize (size_t (numChunks));
+    sizes.resize (size_t (numChunks));
+
+    FlacAudioFormat flac;
+    std::vector<MemoryBlock> encoded;
+    encoded.resize (size_t (numStreams));
+
+    for (int chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const int64 start = int64 (chunk) * chunkFrames;
+        const int count = int (jmin (int64 (chunkFrames), totalFrames - start));
+        offsets[size_t (chunk)] = stream.getPosition();
+
+        if (chunkCompression == flacCompression)
+        {
+            for (int s = 0; s < numStreams; ++s)
+            {
+                encoded[size_t (s)].reset();
+                const float* channel = streams[size_t (s)] + start;
+
+                // The writer owns the stream and flushes it when deleted.
+                std::unique_ptr<AudioFormatWriter> writer (flac.createWriterFor (new MemoryOutputStream (encoded[size_t (s)], false),
+                                                                                  rate, 1, flacBitDepth, StringPairArray(), 0));
+                if (writer == nullptr || ! writer->writeFromFloatArrays (&channel, 1, count))
+                {
+                    std::cout << "StemContainer::write error: FLAC encoding failed." << std::endl;
+                    return false;
+                }
+            }
+
+            for (int s = 0; s < numStreams; ++s)
+                stream.writeInt (int (encoded[size_t (s)].getSize()));
+            for (int s = 0; s < numStreams; ++s)
+                stream.write (encoded[size_t (s)].getData(), encoded[size_t (s)].getSize());
+        }
+        else
+        {
+            for (int s = 0; s < numStreams; ++s)
+                stream.write (streams[size_t (s)] + start, size_t (count) * sizeof (float));
+        }
+
+        sizes[size_t (chunk)] = stream.getPosition() - offsets[size_t (chunk)];
+    }
+
+    stream.setPosition (indexPosition);
+    for (int chunk = 0; chunk < numChunks; ++chunk)
+    {
+        stream.writeInt64 (offsets[size_t (chunk)]);
+        stream.writeInt64 (sizes[size_t (chunk)]);
+    }
+    stream.flush();
+
+    if (stream.getStatus().failed())
+    {
+        std::cout << "StemContainer::write error: "
+        << stream.getStatus().getErrorMessage().toStdString() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//==============================================================================
+bool StemContainer::open (const File& file)
+{
+    mappedFile.reset (new MemoryMappedFile (file, MemoryMappedFile::readOnly));
+    names.clear();
+    chunkOffsets.clear();
+    chunkSizes.clear();
+
+    const size_t fileSize = mappedFile->getSize();
+    if (mappedFile->getData() == nullptr || fileSize < 8
+        || memcmp (mappedFile->getData(), magic, 8) != 0)
+    {
+        std::cout << "StemContainer::open error: "
+        << file.getFullPathName().toStdString() << " is not a stem container." << std::endl;
+        mappedFile = nullptr;
+        return false;
+    }
+
+    MemoryInputStream header (mappedFile->getData(), fileSize, false);
+    header.skipNextBytes (8);
+
+    const int fileVersion = header.readInt();
+    const int numStreams = header.readInt();
+    sampleRate = header.readDouble();
+    framesPerChunk = header.readInt();
+    numFrames = header.readInt64();
+    const int numChunks = header.readInt();
+    compression = Compression (header.readInt());
+
+    bool valid = fileVersion == version && numStreams > 0 && framesPerChunk > 0
+              && numChunks == int ((numFrames + framesPerChunk - 1) / framesPerChunk)
+              && (compression == uncompressed || compression == flacCompression)
+              && readString (header, metadata);
+
+    for (int s = 0; valid && s < numStreams; ++s)
+    {
+        String name;
+        valid = readString (header, name);
+        names.add (name);
+    }
+
+    valid = valid && header.getNumBytesRemaining() >= int64 (numChunks) * 16;
+    for (int chunk = 0; valid && chunk < numChunks; ++chunk)
+    {
+        const uint64 offset = uint64 (header.readInt64());
+        const uint64 size = uint64 (header.readInt64());
+        valid = offset + size <= fileSize;
+        chunkOffsets.push_back (offset);
+        chunkSizes.push_back (size);
+    }
+
+    if (! valid)
+    {
+        std::cout << "StemContainer::open error: The header of "
+        << file.getFullPathName().toStdString() << " is damaged." << std::endl;
+        mappedFile = nullptr;
+        names.clear();
+        return false;
+    }
+    return true;
+}
+
+//==============================================================================
+bool StemContainer::read (const int64             startFrame,
+                          const int               length,
+                          const std::vector<int>& streams,
+                          float*                  destination) const
+{
+    if (! isOpen() || length < 0)
+        return false;
+
+    for (const int s : streams)
+    {
+        if (s < 0 || s >= getNumStreams())
+        {
+            std::cout << "StemContainer::read error: Stream " << s << " does not exist." << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < streams.size(); ++i)
+        FloatVectorOperations::clear (destination + i * size_t (length), length);
+
+    const int64 first = jmax (int64 (0), startFrame);
+    const int64 last = jmin (numFrames, startFrame + length);
+
+    for (int64 frame = first; frame < last;)
+    {
+        const int chunk = int (frame / framesPerChunk);
+        const int offsetInChunk = int (frame - int64 (chunk) * framesPerChunk);
+        const int count = int (jmin (last - frame, int64 (framesPerChunk - offsetInChunk)));
+
+        if (! readChunk (chunk, offsetInChunk, count, streams,
+                         destination + (frame - startFrame), length))
+            return false;
+
+        frame += count;
+    }
+    return true;
+}
+
+//==============================================================================
+bool StemContainer::readChunk (const int               chunk,
+                               const int               offsetInChunk,
+                               const int               count,
+                               const std::vector<int>& streams,
+                               float*                  destination,
+                               const int               destinationStride) const
+{
+    const char* const data = static_cast<const char*> (mappedFile->getData()) + chunkOffsets[size_t (chunk)];
+    const int chunkFrames = int (jmin (int64 (framesPerChunk), numFrames - int64 (chunk) * framesPerChunk));
+
+    if (compression == uncompressed)
+    {
+        if (chunkSizes[size_t (chunk)] < uint64 (chunkFrames) * names.size() * sizeof (float))
+            return false;
+
+        for (size_t i = 0; i < streams.size(); ++i)
+            memcpy (destination + i * size_t (destinationStride),
+                    data + (size_t (streams[i]) * chunkFrames + offsetInChunk) * sizeof (float),
+                    size_t (count) * sizeof (float));
+        return true;
+    }
+
+    // FLAC: walk the size table to each requested stream and decode just
+    // the part of it that is needed.
+    const int numStreams = names.size();
+    if (chunkSizes[size_t (chunk)] < uint64 (numStreams) * 4)
+        return false;
+
+    std::vector<uint64> starts (size_t (numStreams) + 1);
+    starts[0] = uint64 (numStreams) * 4;
+    for (int s = 0; s < numStreams; ++s)
+        starts[size_t (s) + 1] = starts[size_t (s)] + ByteOrder::littleEndianInt (data + s * 4);
+
+    if (starts.back() > chunkSizes[size_t (chunk)])
+        return false;
+
+    FlacAudioFormat flac;
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        const size_t s = size_t (streams[i]);
+        std::unique_ptr<AudioFormatReader> reader (flac.createReaderFor (new MemoryInputStream (data + starts[s], size_t (starts[s + 1] - starts[s]), false),
+                                                                          true));
+        if (reader == nullptr)
+            return false;
+
+        float* channel = destination + i * size_t (destinationStride);
+        AudioBuffer<float> buffer (&channel, 1, count);
+        reader->read (&buffer, 0, count, offsetInChunk, true, false);
+    }
+    return true;
+}
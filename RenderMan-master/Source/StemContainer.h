@@ -0,0 +1,118 @@
+/*
+  ==============================================================================
+
+    StemContainer.h
+
+  ==============================================================================
+*/
+
+#ifndef STEMCONTAINER_H_INCLUDED
+#define STEMCONTAINER_H_INCLUDED
+
+#include <memory>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+//==============================================================================
+// A single file holding every mono stream of a track (stems and mix) cut into
+// fixed length chunks. Chunk c holds frames [c * framesPerChunk, ...) of
+// every stream back to back, so a window of all streams is one contiguous
+// range of the file.
+//
+// Layout, all little endian:
+//   char[8] "SLKHSTEM", uint32 version, uint32 numStreams,
+//   float64 sampleRate, uint32 framesPerChunk, uint64 numFrames,
+//   uint32 numChunks, uint32 compression,
+//   uint32 metadata size + metadata (UTF-8, e.g. the track's YAML),
+//   per stream: uint32 name size + name (UTF-8),
+//   per chunk:  uint64 offset + uint64 size,
+//   chunks, starting 64 byte aligned.
+//
+// Uncompressed chunks are float32 streams of the chunk's length one after
+// the other. FLAC chunks start with one uint32 size per stream followed by
+// that many bytes of 24 bit FLAC per stream.
+class StemContainer
+{
+public:
+    enum Compression
+    {
+        uncompressed = 0,
+        flacCompression
+    };
+
+    // streams holds numStreams pointers to numFrames samples each.
+    static bool write (const File&                      file,
+                       const StringArray&               names,
+                       const std::vector<const float*>& streams,
+                       const int64                      numFrames,
+                       const double                     sampleRate,
+                       const double                     chunkSeconds,
+                       const Compression                compression,
+                       const String&                    metadata);
+
+    //==========================================================================
+    StemContainer() :
+        sampleRate (0.0),
+        framesPerChunk (0),
+        numFrames (0),
+        compression (uncompressed)
+    {
+    }
+
+    // Memory maps the file read only and parses its header and index.
+    bool open (const File& file);
+
+    bool isOpen() const {
+        return mappedFile != nullptr;
+    };
+
+    const StringArray& getNames() const {
+        return names;
+    };
+
+    int getNumStreams() const {
+        return names.size();
+    };
+
+    double getSampleRate() const {
+        return sampleRate;
+    };
+
+    int64 getNumFrames() const {
+        return numFrames;
+    };
+
+    const String& getMetadata() const {
+        return metadata;
+    };
+
+    // Reads frames [startFrame, startFrame + length) of the given streams
+    // into a row major streams.size() x length array. Frames outside the
+    // track are zero. Safe to call from several threads at once.
+    bool read (const int64             startFrame,
+               const int               length,
+               const std::vector<int>& streams,
+               float*                  destination) const;
+
+private:
+    bool readChunk (const int               chunk,
+                    const int               offsetInChunk,
+                    const int               count,
+                    const std::vector<int>& streams,
+                    float*                  destination,
+                    const int               destinationStride) const;
+
+    std::unique_ptr<MemoryMappedFile> mappedFile;
+    StringArray         names;
+    String              metadata;
+    double              sampleRate;
+    int                 framesPerChunk;
+    int64               numFrames;
+    Compression         compression;
+    std::vector<uint64> chunkOffsets;
+    std::vector<uint64> chunkSizes;
+};
+
+#endif  // STEMCONTAINER_H_INCLUDED
@@ -8,12 +8,81 @@
   ==============================================================================
 */
 
+#include "DatasetReader.h"
+#include "ForkServer.h"
 #include "PatchGenerator.h"
+#include "RenderSweep.h"
+#include "StemContainer.h"
+#include "Maximilian/libs/maxiMFCC.h"
 #include <boost/python.hpp>
+#include <boost/python/numpy.hpp>
+#include <chrono>
+#include <future>
 
 // Could also easily be namespace crap.
 namespace wrap
 {
+    //==========================================================================
+    // Lets other Python threads run while a call is busy in C++. Nothing in
+    // its scope may touch a Python object, NumPy data pointers taken before
+    // it are fine as long as the array is kept alive.
+    class ScopedGILRelease
+    {
+    public:
+        ScopedGILRelease() :
+            state (PyEval_SaveThread())
+        { }
+
+        ~ScopedGILRelease()
+        {
+            PyEval_RestoreThread (state);
+        }
+
+    private:
+        PyThreadState* state;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedGILRelease)
+    };
+
+    //==========================================================================
+    // A render running on its own thread, returned by the *_async calls. It
+    // can be polled, or waited on from any Python thread (or an asyncio
+    // executor) without holding the GIL.
+    class RenderHandle
+    {
+    public:
+        RenderHandle() { }
+
+        explicit RenderHandle (std::shared_future<void> renderFuture) :
+            future (renderFuture)
+        { }
+
+        bool done() const
+        {
+            return ! future.valid()
+                || future.wait_for (std::chrono::seconds (0)) == std::future_status::ready;
+        }
+
+        // Returns false if the render is still running after timeout
+        // seconds, a negative timeout waits for as long as it takes.
+        bool wait (double timeoutSeconds)
+        {
+            if (! future.valid())
+                return true;
+
+            ScopedGILRelease release;
+            if (timeoutSeconds < 0.0)
+            {
+                future.wait();
+                return true;
+            }
+            return future.wait_for (std::chrono::duration<double> (timeoutSeconds)) == std::future_status::ready;
+        }
+
+    private:
+        std::shared_future<void> future;
+    };
+
     //==========================================================================
     // Converts a C++ vector to a Python list. All following functions
     // are essentially cheap ripoffs from this one.
@@ -90,6 +159,191 @@ namespace wrap
         return patch;
     }
 
+    //==========================================================================
+    // Copies a one dimensional NumPy array (or anything NumPy can turn into
+    // one, such as a list) into a vector, converting the element type if
+    // needed.
+    template <class T>
+    std::vector<T> arrayToVector (boost::python::object object)
+    {
+        namespace np = boost::python::numpy;
+        np::ndarray array = np::from_object (object,
+                                             np::dtype::get_builtin<T>(),
+                                             1, 1,
+                                             np::ndarray::C_CONTIGUOUS);
+        const T* data = reinterpret_cast<const T*> (array.get_data());
+        return std::vector<T> (data, data + array.shape (0));
+    }
+
+    //==========================================================================
+    // Copies a vector into a new one dimensional NumPy array.
+    template <class T>
+    boost::python::numpy::ndarray vectorToArray (const std::vector<T>& vector)
+    {
+        namespace np = boost::python::numpy;
+        np::ndarray array = np::empty (boost::python::make_tuple (vector.size()),
+                                       np::dtype::get_builtin<T>());
+        std::copy (vector.begin(), vector.end(),
+                   reinterpret_cast<T*> (array.get_data()));
+        return array;
+    }
+
+    //==========================================================================
+    // The keyword arguments of set_execution_policy, and back.
+    ExecutionPolicy makeExecutionPolicy (boost::python::object cpus,
+                                         int                   numaNode,
+                                         bool                  noDenormals,
+                                         int                   niceLevel)
+    {
+        ExecutionPolicy policy;
+        if (! cpus.is_none())
+            policy.cpus = arrayToVector<int> (cpus);
+        policy.numaNode = numaNode;
+        policy.noDenormals = noDenormals;
+        policy.niceLevel = niceLevel;
+        return policy;
+    }
+
+    boost::python::dict executionPolicyToDict (const ExecutionPolicy& policy)
+    {
+        boost::python::dict dict;
+        dict["cpus"]         = vectorToList (policy.getCpus());
+        dict["numa_node"]    = policy.numaNode;
+        dict["no_denormals"] = policy.noDenormals;
+        dict["nice"]         = policy.niceLevel;
+        return dict;
+    }
+
+    //==========================================================================
+    // Runs a maxiSTFT over a buffer and returns (magnitudes, phases) as
+    // frames x bins float32 arrays that the transform writes into directly.
+    boost::python::tuple stftOfSamples (const float* samples,
+                                        int          numSamples,
+                                        int          fftSize,
+                                        int          hopSize,
+                                        int          numThreads)
+    {
+        namespace np = boost::python::numpy;
+
+        if (fftSize < 4 || (fftSize & (fftSize - 1)) != 0)
+        {
+            std::cout << "stft error: The fft size must be a power of two of at least 4." << std::endl;
+            return boost::python::tuple();
+        }
+
+        maxiSTFT transform;
+        transform.setup (fftSize, hopSize);
+        const boost::python::tuple shape = boost::python::make_tuple (transform.getNumFrames (numSamples),
+                                                                      transform.getNumBins());
+        np::ndarray magnitudes = np::empty (shape, np::dtype::get_builtin<float>());
+        np::ndarray phases = np::empty (shape, np::dtype::get_builtin<float>());
+        float* const magnitudeData = reinterpret_cast<float*> (magnitudes.get_data());
+        float* const phaseData = reinterpret_cast<float*> (phases.get_data());
+        {
+            ScopedGILRelease release;
+            transform.process (samples, numSamples, magnitudeData, phaseData, numThreads);
+        }
+        return boost::python::make_tuple (magnitudes, phases);
+    }
+
+    boost::python::tuple stft (boost::python::object audio,
+                               int                   fftSize,
+                               int                   hopSize,
+                               int                   numThreads)
+    {
+        namespace np = boost::python::numpy;
+        np::ndarray samples = np::from_object (audio,
+                                               np::dtype::get_builtin<float>(),
+                                               1, 1,
+                                               np::ndarray::C_CONTIGUOUS);
+        return stftOfSamples (reinterpret_cast<const float*> (samples.get_data()),
+                              int (samples.shape (0)),
+                              fftSize,
+                              hopSize,
+                              numThreads);
+    }
+
+    //==========================================================================
+    // Mel bands (or MFCCs when numCoeffs > 0) of a buffer as a new frames x
+    // bands float32 array that the analyser writes into directly.
+    boost::python::object melOfSamples (const float* samples,
+                                        int          numSamples,
+                                        int          sampleRate,
+                                        int          fftSize,
+                                        int          hopSize,
+                                        int          numFilters,
+                                        int          numCoeffs,
+                                        double       minFreq,
+                                        double       maxFreq,
+                                        int          numThreads)
+    {
+        namespace np = boost::python::numpy;
+
+        if (fftSize < 4 || (fftSize & (fftSize - 1)) != 0 || numFilters < 1)
+        {
+            std::cout << "mel error: The fft size must be a power of two of at least 4 "
+                      << "and there must be at least one filter." << std::endl;
+            return boost::python::object();
+        }
+
+        maxiMelAnalyser analyser;
+        analyser.setup (sampleRate, fftSize, hopSize, numFilters,
+                        numCoeffs > 0 ? numCoeffs : numFilters, minFreq, maxFreq);
+        const int width = numCoeffs > 0 ? analyser.getNumCoeffs() : numFilters;
+        np::ndarray output = np::empty (boost::python::make_tuple (analyser.getNumFrames (numSamples), width),
+                                        np::dtype::get_builtin<float>());
+        float* data = reinterpret_cast<float*> (output.get_data());
+
+        {
+            ScopedGILRelease release;
+            if (numCoeffs > 0)
+                analyser.mfcc (samples, numSamples, data, numThreads);
+            else
+                analyser.melSpectrogram (samples, numSamples, data, numThreads);
+        }
+
+        return output;
+    }
+
+    boost::python::object melSpectrogram (boost::python::object audio,
+                                          int                   sampleRate,
+                                          int                   fftSize,
+                                          int                   hopSize,
+                                          int                   numFilters,
+                                          double                minFreq,
+                                          double                maxFreq,
+                                          int                   numThreads)
+    {
+        namespace np = boost::python::numpy;
+        np::ndarray samples = np::from_object (audio,
+                                               np::dtype::get_builtin<float>(),
+                                               1, 1,
+                                               np::ndarray::C_CONTIGUOUS);
+        return melOfSamples (reinterpret_cast<const float*> (samples.get_data()),
+                             int (samples.shape (0)), sampleRate, fftSize, hopSize,
+                             numFilters, 0, minFreq, maxFreq, numThreads);
+    }
+
+    boost::python::object mfcc (boost::python::object audio,
+                                int                   sampleRate,
+                                int                   fftSize,
+                                int                   hopSize,
+                                int                   numFilters,
+                                int                   numCoeffs,
+                                double                minFreq,
+                                double                maxFreq,
+                                int                   numThreads)
+    {
+        namespace np = boost::python::numpy;
+        np::ndarray samples = np::from_object (audio,
+                                               np::dtype::get_builtin<float>(),
+                                               1, 1,
+                                               np::ndarray::C_CONTIGUOUS);
+        return melOfSamples (reinterpret_cast<const float*> (samples.get_data()),
+                             int (samples.shape (0)), sampleRate, fftSize, hopSize,
+                             numFilters, jmax (1, numCoeffs), minFreq, maxFreq, numThreads);
+    }
+
     //==========================================================================
     class RenderEngineWrapper : public RenderEngine
     {
@@ -98,29 +352,117 @@ namespace wrap
             RenderEngine (sr, bs)
         { }
 
+        ~RenderEngineWrapper()
+        {
+            // The render thread uses this engine. It never needs the GIL.
+            if (pendingRender.valid())
+                pendingRender.wait();
+        }
+
+        // Every call that uses the engine first waits for an async render
+        // still running on it.
+        void waitForPendingRender()
+        {
+            if (pendingRender.valid())
+            {
+                ScopedGILRelease release;
+                pendingRender.wait();
+            }
+        }
+
+        // Keeps the engine to itself for as long as it exists, for wrappers
+        // of other classes that are constructed from it.
+        class ScopedUse
+        {
+        public:
+            explicit ScopedUse (RenderEngineWrapper& engine) :
+                lock ((engine.waitForPendingRender(), engine.engineLock))
+            { }
+
+        private:
+            const ScopedLock lock;
+        };
+
+        bool wrapperLoadPlugin (std::string path)
+        {
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
+            return RenderEngine::loadPlugin (path);
+        }
+
+        bool wrapperLoadMidi (std::string path)
+        {
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
+            return RenderEngine::loadMidi (path);
+        }
+
         void wrapperSetPatch (boost::python::list listOfTuples)
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             PluginPatch patch = listOfTuplesToPluginPatch (listOfTuples);
             RenderEngine::setPatch(patch);
         }
 
         float wrapperGetParameter (int parameter)
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return RenderEngine::getParameter(parameter);
         }
 
         void wrapperSetParameter (int parameter, float value)
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             RenderEngine::setParameter(parameter, value);
         }
 
         boost::python::list wrapperGetPatch()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return pluginPatchToListOfTuples (RenderEngine::getPatch());
         }
         
+        bool wrapperSetAutomation (int                   parameter,
+                                   boost::python::object times,
+                                   boost::python::object values)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::setAutomation (parameter,
+                                                arrayToVector<double> (times),
+                                                arrayToVector<float> (values));
+        }
+
+        bool wrapperSetAutomationCurve (int                   parameter,
+                                        boost::python::object values,
+                                        double                rate)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::setAutomationCurve (parameter,
+                                                     arrayToVector<float> (values),
+                                                     rate);
+        }
+
+        bool wrapperSetPatchValues (boost::python::object values)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<float> row = arrayToVector<float> (values);
+            return RenderEngine::setPatchValues (row.data(), row.size());
+        }
+
         void wrapperRenderMidi (double renderLength)
         {
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
             RenderEngine::renderMidi(renderLength);
         }
 
@@ -133,41 +475,985 @@ namespace wrap
             if (midiNote < 0) midiNote = 0;
             if (midiVelocity > 255) midiVelocity = 255;
             if (midiVelocity < 0) midiVelocity = 0;
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
             RenderEngine::renderPatch(midiNote,
                                       midiVelocity,
                                       noteLength,
                                       renderLength);
         }
 
+        // Renders for getAutoRenderLength and returns that length.
+        double wrapperRenderMidiAuto (double minTail, double maxTail, double minLength)
+        {
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
+            const double renderLength = RenderEngine::getAutoRenderLength (minTail, maxTail, minLength);
+            RenderEngine::renderMidi (renderLength);
+            return renderLength;
+        }
+
+        RenderHandle wrapperRenderMidiAsync (double renderLength)
+        {
+            waitForPendingRender();
+            pendingRender = std::async (std::launch::async, [this, renderLength]
+            {
+                const ScopedLock sl (engineLock);
+                RenderEngine::renderMidi (renderLength);
+            }).share();
+            return RenderHandle (pendingRender);
+        }
+
+        RenderHandle wrapperRenderPatchAsync (int    midiNote,
+                                              int    midiVelocity,
+                                              double noteLength,
+                                              double renderLength)
+        {
+            const uint8 note = uint8 (jlimit (0, 255, midiNote));
+            const uint8 velocity = uint8 (jlimit (0, 255, midiVelocity));
+            waitForPendingRender();
+            pendingRender = std::async (std::launch::async, [this, note, velocity, noteLength, renderLength]
+            {
+                const ScopedLock sl (engineLock);
+                RenderEngine::renderPatch (note, velocity, noteLength, renderLength);
+            }).share();
+            return RenderHandle (pendingRender);
+        }
+
+        bool wrapperWriteToWav (std::string path, maxiRecorder::Format format, int sampleRate)
+        {
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
+            return RenderEngine::writeToWav (path, format, sampleRate);
+        }
+
         int wrapperGetPluginParameterSize()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return int (RenderEngine::getPluginParameterSize());
         }
 
         std::string wrapperGetPluginParametersDescription()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return RenderEngine::getPluginParametersDescription().toStdString();
         }
 
+        // Columns of the parameter table: NumPy arrays for the numeric fields
+        // and lists of strings for the names and labels.
+        boost::python::dict wrapperGetParameterInfo()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<PluginParameterInfo>& info = RenderEngine::getPluginParameterInfo();
+            const size_t size = info.size();
+            std::vector<int>   index (size), numSteps (size);
+            std::vector<float> defaultValue (size);
+            std::vector<bool>  isDiscrete (size), isBoolean (size);
+            boost::python::list name, label;
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                index[i]        = info[i].index;
+                numSteps[i]     = info[i].numSteps;
+                defaultValue[i] = info[i].defaultValue;
+                isDiscrete[i]   = info[i].isDiscrete;
+                isBoolean[i]    = info[i].isBoolean;
+                name.append (info[i].name.toStdString());
+                label.append (info[i].label.toStdString());
+            }
+
+            boost::python::dict table;
+            table["index"]       = vectorToArray (index);
+            table["name"]        = name;
+            table["label"]       = label;
+            table["default"]     = vectorToArray (defaultValue);
+            table["num_steps"]   = vectorToArray (numSteps);
+            table["is_discrete"] = vectorToArray (isDiscrete);
+            table["is_boolean"]  = vectorToArray (isBoolean);
+            return table;
+        }
+
+        boost::python::list wrapperGetParameterValueStrings (int parameter)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<PluginParameterInfo>& info = RenderEngine::getPluginParameterInfo();
+            boost::python::list list;
+            if (parameter >= 0 && parameter < int (info.size()))
+                for (const String& text : info[parameter].valueStrings)
+                    list.append (text.toStdString());
+            return list;
+        }
+
         boost::python::list wrapperGetAudioFrames()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return vectorToList (RenderEngine::getAudioFrames());
         }
 
+        boost::python::tuple wrapperGetStft (int fftSize, int hopSize, int numThreads)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<double>& audio = RenderEngine::getAudioFrames();
+            const std::vector<float> samples (audio.begin(), audio.end());
+            return stftOfSamples (samples.data(), int (samples.size()),
+                                  fftSize, hopSize, numThreads);
+        }
+
+        bool wrapperEnableFeaturePipeline (int  fftSize,
+                                           int  hopSize,
+                                           int  numMelBands,
+                                           bool stft,
+                                           bool mel,
+                                           bool onset,
+                                           bool rms)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const int features = (stft  ? FeaturePipeline::stftFeature  : 0)
+                               | (mel   ? FeaturePipeline::melFeature   : 0)
+                               | (onset ? FeaturePipeline::onsetFeature : 0)
+                               | (rms   ? FeaturePipeline::rmsFeature   : 0);
+            return RenderEngine::enableFeaturePipeline (fftSize, hopSize, numMelBands, features);
+        }
+
+        bool wrapperSetOutputSampleRates (boost::python::object rates)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::setOutputSampleRates (arrayToVector<int> (rates));
+        }
+
+        boost::python::list wrapperGetOutputSampleRates()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            boost::python::list rates;
+            for (const int rate : RenderEngine::getOutputSampleRates())
+                rates.append (rate);
+            return rates;
+        }
+
+        boost::python::object wrapperGetResampledAudio (int rate)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<float>* audio = RenderEngine::getResampledAudio (rate);
+            if (audio == nullptr)
+                return boost::python::object();
+            return vectorToArray (*audio);
+        }
+
+        bool wrapperLoadStemMidi (boost::python::list paths)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            std::vector<std::string> files;
+            for (int i = 0; i < boost::python::len (paths); ++i)
+                files.push_back (boost::python::extract<std::string> (paths[i]));
+            return RenderEngine::loadStemMidi (files);
+        }
+
+        bool wrapperSetStemOutputs (boost::python::object outputs)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::setStemOutputs (arrayToVector<int> (outputs));
+        }
+
+        boost::python::list wrapperGetOutputNames()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            boost::python::list names;
+            for (const OutputGroup& group : RenderEngine::getOutputGroups())
+                names.append (group.name.toStdString());
+            return names;
+        }
+
+        // One dict per stem: its MIDI channel and the output (index, name
+        // and plugin channels) its audio is taken from.
+        boost::python::list wrapperGetStemRouting()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            boost::python::list routing;
+            const std::vector<int>& outputs = RenderEngine::getStemOutputs();
+            for (size_t stem = 0; stem < outputs.size(); ++stem)
+            {
+                const OutputGroup& group = RenderEngine::getOutputGroups()[size_t (outputs[stem])];
+                boost::python::dict entry;
+                entry["stem"]         = int (stem);
+                entry["midi_channel"] = int (stem) + 1;
+                entry["output"]       = outputs[stem];
+                entry["output_name"]  = group.name.toStdString();
+                entry["channels"]     = boost::python::make_tuple (group.firstChannel,
+                                                                   group.firstChannel + group.numChannels);
+                routing.append (entry);
+            }
+            return routing;
+        }
+
+        boost::python::object wrapperGetStemAudio (int stem)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<float>* audio = RenderEngine::getStemAudio (stem);
+            if (audio == nullptr)
+                return boost::python::object();
+            return vectorToArray (*audio);
+        }
+
+        void wrapperSetExecutionPolicy (boost::python::object cpus,
+                                        int                   numaNode,
+                                        bool                  noDenormals,
+                                        int                   niceLevel)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::setExecutionPolicy (makeExecutionPolicy (cpus, numaNode, noDenormals, niceLevel));
+        }
+
+        void wrapperSetMidiSanitization (bool enabled,
+                                         bool removeMetaEvents,
+                                         bool removeSysEx,
+                                         bool removeRedundantControllers,
+                                         bool fixOverlappingNotes,
+                                         bool closeHangingNotes)
+        {
+            MidiSanitizer::Options options;
+            options.removeMetaEvents = removeMetaEvents;
+            options.removeSysEx = removeSysEx;
+            options.removeRedundantControllers = removeRedundantControllers;
+            options.fixOverlappingNotes = fixOverlappingNotes;
+            options.closeHangingNotes = closeHangingNotes;
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::setMidiSanitization (enabled, options);
+        }
+
+        boost::python::dict wrapperGetMidiReport()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const MidiSanitizeReport& report = RenderEngine::getMidiSanitizeReport();
+            boost::python::dict dict;
+            dict["events_in"]                     = report.eventsIn;
+            dict["events_out"]                    = report.eventsOut;
+            dict["meta_events_removed"]           = report.metaEventsRemoved;
+            dict["sysex_removed"]                 = report.sysExRemoved;
+            dict["redundant_controllers_removed"] = report.redundantControllersRemoved;
+            dict["duplicate_note_ons_removed"]    = report.duplicateNoteOnsRemoved;
+            dict["overlapping_notes_ended"]       = report.overlappingNotesEnded;
+            dict["stray_note_offs_removed"]       = report.strayNoteOffsRemoved;
+            dict["hanging_notes_closed"]          = report.hangingNotesClosed;
+            return dict;
+        }
+
+        boost::python::dict wrapperGetExecutionPolicy()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return executionPolicyToDict (RenderEngine::getExecutionPolicy());
+        }
+
+        boost::python::dict wrapperGetRenderStats()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const RenderStats& stats = RenderEngine::getRenderStats();
+            boost::python::dict dict;
+            dict["render_seconds"]     = stats.renderSeconds;
+            dict["num_blocks"]         = stats.numBlocks;
+            dict["mean_block_seconds"] = stats.meanBlockSeconds;
+            dict["max_block_seconds"]  = stats.maxBlockSeconds;
+            dict["cpu"]                = stats.cpu;
+            dict["affinity_set"]       = stats.affinitySet;
+            dict["nice_set"]           = stats.niceLevelSet;
+            dict["denormals_disabled"] = stats.denormalsDisabled;
+            dict["policy"]             = stats.policy.toStdString();
+            dict["arena_growths"]      = stats.arenaGrowths;
+            return dict;
+        }
+
+        bool wrapperEnableRenderCache (std::string directory, double maxSizeGigabytes)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::enableRenderCache (directory, int64 (maxSizeGigabytes * 1024.0 * 1024.0 * 1024.0));
+        }
+
+        std::string wrapperGetRenderHash (double renderLength)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::getRenderHash (renderLength).toStdString();
+        }
+
+        // The features of the last render as float32 arrays with one row per
+        // frame, keyed by "stft", "mel", "onset" and "rms".
+        boost::python::dict wrapperGetFeatures()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            boost::python::dict features;
+            const FeaturePipeline* pipeline = RenderEngine::getFeaturePipeline();
+            if (pipeline == nullptr)
+                return features;
+
+            const int frames = pipeline->getNumFrames();
+            const int enabled = pipeline->getFeatures();
+
+            if (enabled & FeaturePipeline::stftFeature)
+                features["stft"] = vectorToArray (pipeline->getMagnitudes())
+                                       .reshape (boost::python::make_tuple (frames, pipeline->getNumBins()));
+            if (enabled & FeaturePipeline::melFeature)
+                features["mel"] = vectorToArray (pipeline->getMelBands())
+                                      .reshape (boost::python::make_tuple (frames, pipeline->getNumMelBands()));
+            if (enabled & FeaturePipeline::onsetFeature)
+                features["onset"] = vectorToArray (pipeline->getOnsetStrength());
+            if (enabled & FeaturePipeline::rmsFeature)
+                features["rms"] = vectorToArray (pipeline->getRms());
+
+            return features;
+        }
+
+        boost::python::object wrapperGetMelSpectrogram (int fftSize, int hopSize, int numFilters, int numThreads)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<double>& audio = RenderEngine::getAudioFrames();
+            const std::vector<float> samples (audio.begin(), audio.end());
+            return melOfSamples (samples.data(), int (samples.size()), int (RenderEngine::getSampleRate()),
+                                 fftSize, hopSize, numFilters, 0, 0.0, 0.0, numThreads);
+        }
+
+        boost::python::object wrapperGetMfccFrames (int fftSize, int hopSize, int numFilters, int numCoeffs, int numThreads)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            const std::vector<double>& audio = RenderEngine::getAudioFrames();
+            const std::vector<float> samples (audio.begin(), audio.end());
+            return melOfSamples (samples.data(), int (samples.size()), int (RenderEngine::getSampleRate()),
+                                 fftSize, hopSize, numFilters, jmax (1, numCoeffs), 0.0, 0.0, numThreads);
+        }
+
         boost::python::list wrapperGetRMSFrames()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return vectorToList (RenderEngine::getRMSFrames());
         }
         
         std::string wrapperGetProgramName()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return RenderEngine::getProgramName().toStdString();
         }
         
         std::string wrapperGetPluginName()
         {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
             return RenderEngine::getPluginName().toStdString();
         }
+
+        bool wrapperLoadPreset (std::string path)
+        {
+            waitForPendingRender();
+            ScopedGILRelease release;
+            const ScopedLock sl (engineLock);
+            return RenderEngine::loadPreset (path);
+        }
+
+        int wrapperNMidiEvents()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::nMidiEvents();
+        }
+
+        bool wrapperIsMidiSanitized()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::isMidiSanitized();
+        }
+
+        double wrapperGetAutoRenderLength (double minTail, double maxTail, double minLength)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::getAutoRenderLength (minTail, maxTail, minLength);
+        }
+
+        void wrapperSetLatencyCompensation (bool shouldCompensate)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::setLatencyCompensation (shouldCompensate);
+        }
+
+        bool wrapperIsLatencyCompensated()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::isLatencyCompensated();
+        }
+
+        int wrapperGetLatencySamples()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::getLatencySamples();
+        }
+
+        void wrapperSetSampleAccurateMidi (bool shouldBeSampleAccurate)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::setSampleAccurateMidi (shouldBeSampleAccurate);
+        }
+
+        bool wrapperIsSampleAccurateMidi()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::isSampleAccurateMidi();
+        }
+
+        bool wrapperRemoveAutomation (int parameter)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::removeAutomation (parameter);
+        }
+
+        void wrapperClearAutomation()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::clearAutomation();
+        }
+
+        void wrapperSetAutomationInterval (int intervalInSamples)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::setAutomationInterval (intervalInSamples);
+        }
+
+        int wrapperGetAutomationInterval()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::getAutomationInterval();
+        }
+
+        int wrapperGetParameterIndex (std::string name)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::getParameterIndex (name);
+        }
+
+        bool wrapperOverridePluginParameter (int index, float value)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::overridePluginParameter (index, value);
+        }
+
+        bool wrapperRemoveOverridenParameter (int index)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::removeOverridenParameter (index);
+        }
+
+        void wrapperDisableFeaturePipeline()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::disableFeaturePipeline();
+        }
+
+        bool wrapperSetMultiOutput (bool shouldUseAllOutputs)
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::setMultiOutput (shouldUseAllOutputs);
+        }
+
+        bool wrapperIsMultiOutput()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::isMultiOutput();
+        }
+
+        int wrapperGetNumStems()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::getNumStems();
+        }
+
+        void wrapperDisableRenderCache()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            RenderEngine::disableRenderCache();
+        }
+
+        bool wrapperWasLastRenderCached()
+        {
+            waitForPendingRender();
+            const ScopedLock sl (engineLock);
+            return RenderEngine::wasLastRenderCached();
+        }
+
+    private:
+        // Python threads may now call into one engine at the same time, so
+        // loads and renders take turns.
+        CriticalSection          engineLock;
+        std::shared_future<void> pendingRender;
+    };
+
+    //==========================================================================
+    class PatchGeneratorWrapper : public PatchGenerator
+    {
+    public:
+        // The generator reads the engine's patch, so no render may run on it
+        // meanwhile. The ScopedUse lasts until the constructor returns.
+        PatchGeneratorWrapper (RenderEngineWrapper& engine) :
+            PatchGeneratorWrapper (engine, RenderEngineWrapper::ScopedUse (engine))
+        { }
+
+        PatchGeneratorWrapper (RenderEngineWrapper& engine, uint64 seed) :
+            PatchGeneratorWrapper (engine, seed, RenderEngineWrapper::ScopedUse (engine))
+        { }
+
+        boost::python::tuple wrapperGetRandomParameter (int index)
+        {
+            return parameterToTuple (PatchGenerator::getRandomParameter (index));
+        }
+
+        boost::python::list wrapperGetRandomPatch()
+        {
+            return pluginPatchToListOfTuples (PatchGenerator::getRandomPatch());
+        }
+
+        boost::python::numpy::ndarray wrapperGetParameterIndices()
+        {
+            return vectorToArray (PatchGenerator::getParameterIndices());
+        }
+
+        // Returns a new num_patches x num_parameters float32 array.
+        boost::python::numpy::ndarray wrapperGenerate (int                            numPatches,
+                                                       PatchGenerator::SamplingMethod method)
+        {
+            namespace np = boost::python::numpy;
+            numPatches = std::max (0, numPatches);
+            np::ndarray patches = np::empty (boost::python::make_tuple (numPatches,
+                                                                        PatchGenerator::getNumParameters()),
+                                             np::dtype::get_builtin<float>());
+            PatchGenerator::generateBatch (reinterpret_cast<float*> (patches.get_data()),
+                                           numPatches,
+                                           method);
+            return patches;
+        }
+
+    private:
+        PatchGeneratorWrapper (RenderEngineWrapper& engine, const RenderEngineWrapper::ScopedUse&) :
+            PatchGenerator (engine)
+        { }
+
+        PatchGeneratorWrapper (RenderEngineWrapper& engine, uint64 seed, const RenderEngineWrapper::ScopedUse&) :
+            PatchGenerator (engine, seed)
+        { }
+    };
+
+    //==========================================================================
+    class RenderSweepWrapper : public RenderSweep
+    {
+    public:
+        RenderSweepWrapper (int sr, int bs, std::string pluginPath, int numEngines) :
+            RenderSweep (sr, bs, pluginPath, numEngines)
+        { }
+
+        void wrapperSetExecutionPolicy (boost::python::object cpus,
+                                        int                   numaNode,
+                                        bool                  noDenormals,
+                                        int                   niceLevel,
+                                        bool                  spread)
+        {
+            RenderSweep::setExecutionPolicy (makeExecutionPolicy (cpus, numaNode, noDenormals, niceLevel),
+                                             spread);
+        }
+
+        boost::python::list wrapperRender (boost::python::object patches,
+                                           boost::python::object notes,
+                                           boost::python::object velocities,
+                                           boost::python::object noteLengths,
+                                           double                renderLength,
+                                           std::string           outputPrefix,
+                                           int                   patchesPerShard)
+        {
+            namespace np = boost::python::numpy;
+            np::ndarray patchArray = np::from_object (patches,
+                                                      np::dtype::get_builtin<float>(),
+                                                      2, 2,
+                                                      np::ndarray::C_CONTIGUOUS);
+
+            const float* const patchData = reinterpret_cast<const float*> (patchArray.get_data());
+            const int numPatches = int (patchArray.shape (0));
+            const int numParameters = int (patchArray.shape (1));
+            const std::vector<int> noteVector = arrayToVector<int> (notes);
+            const std::vector<int> velocityVector = arrayToVector<int> (velocities);
+            const std::vector<double> noteLengthVector = arrayToVector<double> (noteLengths);
+
+            StringArray shardPaths;
+            {
+                ScopedGILRelease release;
+                shardPaths = RenderSweep::render (patchData,
+                                                  numPatches,
+                                                  numParameters,
+                                                  noteVector,
+                                                  velocityVector,
+                                                  noteLengthVector,
+                                                  renderLength,
+                                                  outputPrefix,
+                                                  patchesPerShard);
+            }
+
+            boost::python::list list;
+            for (const String& path : shardPaths)
+                list.append (path.toStdString());
+            return list;
+        }
+    };
+
+    //==========================================================================
+    class ForkServerWrapper : public ForkServer
+    {
+    public:
+        // The engine is kept alive by the server (with_custodian_and_ward).
+        // Forking while a render runs would copy it half done.
+        ForkServerWrapper (RenderEngineWrapper& engine, int numWorkers) :
+            ForkServerWrapper (engine, numWorkers, RenderEngineWrapper::ScopedUse (engine))
+        { }
+
+        int64 wrapperSubmit (std::string midiPath,
+                             std::string wavPath,
+                             double      renderLength,
+                             double      minTail,
+                             double      maxTail,
+                             double      minLength,
+                             float       peak,
+                             int         bitsPerSample)
+        {
+            Job job;
+            job.midiPath = String::fromUTF8 (midiPath.c_str());
+            job.wavPath = String::fromUTF8 (wavPath.c_str());
+            job.renderLength = renderLength;
+            job.minTail = minTail;
+            job.maxTail = maxTail;
+            job.minLength = minLength;
+            job.peak = peak;
+            job.bitsPerSample = bitsPerSample;
+            return ForkServer::submit (job);
+        }
+
+        // A dict describing the next finished job, or None on timeout or
+        // when nothing is pending.
+        boost::python::object wrapperWait (double timeout)
+        {
+            Result result;
+            bool finished;
+            {
+                ScopedGILRelease release;
+                finished = ForkServer::waitForResult (result, timeout);
+            }
+            if (! finished)
+                return boost::python::object();
+
+            boost::python::dict dict;
+            dict["job"] = result.job;
+            dict["ok"] = result.ok;
+            dict["render_length"] = result.renderLength;
+            dict["num_samples"] = result.numSamples;
+            dict["peak"] = result.peak;
+            dict["render_seconds"] = result.renderSeconds;
+            dict["error"] = result.error.toStdString();
+            return dict;
+        }
+
+    private:
+        ForkServerWrapper (RenderEngineWrapper& engine, int numWorkers, const RenderEngineWrapper::ScopedUse&) :
+            ForkServer (engine, numWorkers)
+        { }
+    };
+
+    //==========================================================================
+    // audio is a float32 streams x frames array, one row per name.
+    bool writeStemContainer (std::string           path,
+                             boost::python::list   names,
+                             boost::python::object audio,
+                             double                sampleRate,
+                             double                chunkSeconds,
+                             bool                  flac,
+                             std::string           metadata)
+    {
+        namespace np = boost::python::numpy;
+        np::ndarray streams = np::from_object (audio,
+                                               np::dtype::get_builtin<float>(),
+                                               2, 2,
+                                               np::ndarray::C_CONTIGUOUS);
+
+        StringArray streamNames;
+        for (int i = 0; i < boost::python::len (names); ++i)
+            streamNames.add (String (boost::python::extract<std::string> (names[i])()));
+
+        const int64 numFrames = int64 (streams.shape (1));
+        const float* data = reinterpret_cast<const float*> (streams.get_data());
+        std::vector<const float*> pointers;
+        for (int i = 0; i < int (streams.shape (0)); ++i)
+            pointers.push_back (data + i * numFrames);
+
+        return StemContainer::write (File (path), streamNames, pointers, numFrames,
+                                     sampleRate, chunkSeconds,
+                                     flac ? StemContainer::flacCompression : StemContainer::uncompressed,
+                                     String::fromUTF8 (metadata.c_str()));
+    }
+
+    class StemContainerWrapper : public StemContainer
+    {
+    public:
+        StemContainerWrapper (std::string path)
+        {
+            StemContainer::open (File (path));
+        }
+
+        boost::python::list wrapperGetNames()
+        {
+            boost::python::list list;
+            for (const String& name : StemContainer::getNames())
+                list.append (name.toStdString());
+            return list;
+        }
+
+        std::string wrapperGetMetadata()
+        {
+            return StemContainer::getMetadata().toStdString();
+        }
+
+        // Returns a float32 streams x num_frames array, all streams in file
+        // order if streams is None.
+        boost::python::object wrapperRead (int64 start, int numFrames, boost::python::object streams)
+        {
+            namespace np = boost::python::numpy;
+
+            std::vector<int> indices;
+            if (streams.is_none())
+                for (int i = 0; i < StemContainer::getNumStreams(); ++i)
+                    indices.push_back (i);
+            else
+                indices = arrayToVector<int> (streams);
+
+            np::ndarray output = np::empty (boost::python::make_tuple (indices.size(), jmax (0, numFrames)),
+                                            np::dtype::get_builtin<float>());
+
+            float* const data = reinterpret_cast<float*> (output.get_data());
+            bool ok;
+            {
+                ScopedGILRelease release;
+                ok = StemContainer::read (start, jmax (0, numFrames), indices, data);
+            }
+            if (! ok)
+                return boost::python::object();
+
+            return output;
+        }
+    };
+
+    //==========================================================================
+    // Keeps the NumPy array of every queued prefetch, which its job writes
+    // into directly, until read() asks for the same window.
+    class DatasetReaderWrapper : public DatasetReader
+    {
+    public:
+        DatasetReaderWrapper (std::string root, int numThreads) :
+            DatasetReader (numThreads)
+        {
+            DatasetReader::open (File (root));
+        }
+
+        ~DatasetReaderWrapper()
+        {
+            // The jobs write into the arrays below.
+            DatasetReader::cancelAllPrefetches();
+        }
+
+        std::string wrapperGetTrackName (int track)
+        {
+            return DatasetReader::getTrackName (track).toStdString();
+        }
+
+        boost::python::list wrapperGetStreamNames (int track)
+        {
+            boost::python::list list;
+            for (const String& name : DatasetReader::getStreamNames (track))
+                list.append (name.toStdString());
+            return list;
+        }
+
+        bool wrapperPrefetch (int track, int64 start, int numFrames, boost::python::object streams)
+        {
+            namespace np = boost::python::numpy;
+
+            Pending pending;
+            pending.track = track;
+            pending.start = start;
+            pending.numFrames = jmax (0, numFrames);
+            pending.streams = streamIndices (track, streams);
+            pending.array = np::empty (boost::python::make_tuple (pending.streams.size(), pending.numFrames),
+                                       np::dtype::get_builtin<float>());
+            pending.ticket = DatasetReader::prefetch (track, pending.streams, start, pending.numFrames,
+                                                      reinterpret_cast<float*> (pending.array.get_data()));
+            if (pending.ticket < 0)
+                return false;
+
+            pendingWindows.push_back (pending);
+            return true;
+        }
+
+        // Returns a float32 streams x num_frames array, all streams of the
+        // track if streams is None.
+        boost::python::object wrapperRead (int track, int64 start, int numFrames, boost::python::object streams)
+        {
+            namespace np = boost::python::numpy;
+
+            const std::vector<int> indices = streamIndices (track, streams);
+            numFrames = jmax (0, numFrames);
+
+            for (auto pending = pendingWindows.begin(); pending != pendingWindows.end(); ++pending)
+            {
+                if (pending->track == track && pending->start == start
+                    && pending->numFrames == numFrames && pending->streams == indices)
+                {
+                    const Pending found = *pending;
+                    pendingWindows.erase (pending);
+                    bool ok;
+                    {
+                        ScopedGILRelease release;
+                        ok = DatasetReader::waitForPrefetch (found.ticket);
+                    }
+                    if (! ok)
+                        return boost::python::object();
+                    return found.array;
+                }
+            }
+
+            np::ndarray output = np::empty (boost::python::make_tuple (indices.size(), numFrames),
+                                            np::dtype::get_builtin<float>());
+
+            float* const data = reinterpret_cast<float*> (output.get_data());
+            bool ok;
+            {
+                ScopedGILRelease release;
+                ok = DatasetReader::read (track, indices, start, numFrames, data);
+            }
+            if (! ok)
+                return boost::python::object();
+
+            return output;
+        }
+
+        // Returns (mix, gains): a float32 array of num_frames samples and the
+        // gain applied to each mixed stream, or None on error. A seed of 0 or
+        // more makes the augmentation repeatable.
+        boost::python::object wrapperRemix (int                   track,
+                                            int64                 start,
+                                            int                   numFrames,
+                                            boost::python::object streams,
+                                            float                 gainRangeDecibels,
+                                            float                 dropoutProbability,
+                                            bool                  randomPolarity,
+                                            int64                 seed)
+        {
+            namespace np = boost::python::numpy;
+
+            std::vector<int> indices;
+            if (! streams.is_none())
+                indices = arrayToVector<int> (streams);
+            numFrames = jmax (0, numFrames);
+
+            // Each call gets its own generator, calls can run in parallel.
+            Random callRandom (seed >= 0 ? seed : random.nextInt64());
+
+            np::ndarray output = np::empty (boost::python::make_tuple (numFrames),
+                                            np::dtype::get_builtin<float>());
+            std::vector<float> gains;
+
+            float* const data = reinterpret_cast<float*> (output.get_data());
+            bool ok;
+            {
+                ScopedGILRelease release;
+                ok = DatasetReader::remix (track, indices, start, numFrames,
+                                           gainRangeDecibels, dropoutProbability, randomPolarity, callRandom,
+                                           data, gains);
+            }
+            if (! ok)
+                return boost::python::object();
+
+            return boost::python::make_tuple (output, vectorToArray (gains));
+        }
+
+        boost::python::numpy::ndarray wrapperGetMixGains (int track)
+        {
+            return vectorToArray (DatasetReader::getMixGains (track));
+        }
+
+    private:
+        struct Pending
+        {
+            Pending() :
+                array (boost::python::numpy::empty (boost::python::make_tuple (0),
+                                                    boost::python::numpy::dtype::get_builtin<float>()))
+            {
+            }
+
+            int                           track;
+            int64                         start;
+            int                           numFrames;
+            std::vector<int>              streams;
+            int64                         ticket;
+            boost::python::numpy::ndarray array;
+        };
+
+        std::vector<int> streamIndices (int track, boost::python::object streams)
+        {
+            if (! streams.is_none())
+                return arrayToVector<int> (streams);
+
+            std::vector<int> indices;
+            for (int i = 0; i < DatasetReader::getStreamNames (track).size(); ++i)
+                indices.push_back (i);
+            return indices;
+        }
+
+        std::vector<Pending> pendingWindows;
+        Random random;
     };
 }
 
@@ -177,25 +1463,220 @@ BOOST_PYTHON_MODULE(librenderman)
     using namespace boost::python;
     using namespace wrap;
 
-    class_<RenderEngineWrapper>("RenderEngine", init<int, int>())
+    boost::python::numpy::initialize();
+
+    def("write_stem_container", &writeStemContainer, (boost::python::arg("path"),
+                                                      boost::python::arg("names"),
+                                                      boost::python::arg("audio"),
+                                                      boost::python::arg("sample_rate"),
+                                                      boost::python::arg("chunk_seconds") = 1.0,
+                                                      boost::python::arg("flac") = false,
+                                                      boost::python::arg("metadata") = std::string()));
+    def("stft", &stft, (boost::python::arg("audio"),
+                        boost::python::arg("fft_size"),
+                        boost::python::arg("hop_size"),
+                        boost::python::arg("num_threads") = 0));
+    def("mel_spectrogram", &melSpectrogram, (boost::python::arg("audio"),
+                                             boost::python::arg("sample_rate"),
+                                             boost::python::arg("fft_size"),
+                                             boost::python::arg("hop_size"),
+                                             boost::python::arg("num_filters") = 128,
+                                             boost::python::arg("min_freq") = 0.0,
+                                             boost::python::arg("max_freq") = 0.0,
+                                             boost::python::arg("num_threads") = 0));
+    def("mfcc", &mfcc, (boost::python::arg("audio"),
+                        boost::python::arg("sample_rate"),
+                        boost::python::arg("fft_size"),
+                        boost::python::arg("hop_size"),
+                        boost::python::arg("num_filters") = 40,
+                        boost::python::arg("num_coeffs") = 13,
+                        boost::python::arg("min_freq") = 0.0,
+                        boost::python::arg("max_freq") = 0.0,
+                        boost::python::arg("num_threads") = 0));
+
+    enum_<maxiRecorder::Format>("WavFormat")
+    .value("pcm16", maxiRecorder::pcm16)
+    .value("pcm24", maxiRecorder::pcm24)
+    .value("float32", maxiRecorder::float32);
+
+    class_<RenderHandle>("RenderHandle", no_init)
+    .def("done", &RenderHandle::done)
+    .def("wait", &RenderHandle::wait, (boost::python::arg("timeout") = -1.0));
+
+    class_<RenderEngineWrapper, boost::noncopyable>("RenderEngine", init<int, int>())
     .def("hello", &RenderEngineWrapper::hello)
-    .def("n_midi_events", &RenderEngineWrapper::nMidiEvents)
-    .def("load_preset", &RenderEngineWrapper::loadPreset)
-    .def("load_plugin", &RenderEngineWrapper::loadPlugin)
-    .def("load_midi", &RenderEngineWrapper::loadMidi)
+    .def("n_midi_events", &RenderEngineWrapper::wrapperNMidiEvents)
+    .def("load_preset", &RenderEngineWrapper::wrapperLoadPreset)
+    .def("load_plugin", &RenderEngineWrapper::wrapperLoadPlugin)
+    .def("load_midi", &RenderEngineWrapper::wrapperLoadMidi)
+    .def("set_midi_sanitization", &RenderEngineWrapper::wrapperSetMidiSanitization, (boost::python::arg("enabled"),
+                                                                                    boost::python::arg("meta_events") = true,
+                                                                                    boost::python::arg("sysex") = true,
+                                                                                    boost::python::arg("redundant_controllers") = true,
+                                                                                    boost::python::arg("overlapping_notes") = true,
+                                                                                    boost::python::arg("hanging_notes") = true))
+    .def("is_midi_sanitized", &RenderEngineWrapper::wrapperIsMidiSanitized)
+    .def("get_midi_report", &RenderEngineWrapper::wrapperGetMidiReport)
     .def("get_patch", &RenderEngineWrapper::wrapperGetPatch)
     .def("set_patch", &RenderEngineWrapper::wrapperSetPatch)
     .def("get_parameter", &RenderEngineWrapper::wrapperGetParameter)
+    .def("apply_patch_row", &RenderEngineWrapper::wrapperSetPatchValues)
     .def("set_parameter", &RenderEngineWrapper::wrapperSetParameter)
     .def("render_midi", &RenderEngineWrapper::wrapperRenderMidi)
+    .def("render_midi_async", &RenderEngineWrapper::wrapperRenderMidiAsync)
+    .def("render_midi_auto", &RenderEngineWrapper::wrapperRenderMidiAuto, (boost::python::arg("min_tail") = 0.5,
+                                                                          boost::python::arg("max_tail") = 10.0,
+                                                                          boost::python::arg("min_length") = 0.0))
+    .def("get_auto_render_length", &RenderEngineWrapper::wrapperGetAutoRenderLength, (boost::python::arg("min_tail") = 0.5,
+                                                                               boost::python::arg("max_tail") = 10.0,
+                                                                               boost::python::arg("min_length") = 0.0))
+    .def("set_latency_compensation", &RenderEngineWrapper::wrapperSetLatencyCompensation)
+    .def("is_latency_compensated", &RenderEngineWrapper::wrapperIsLatencyCompensated)
+    .def("get_latency_samples", &RenderEngineWrapper::wrapperGetLatencySamples)
+    .def("set_execution_policy", &RenderEngineWrapper::wrapperSetExecutionPolicy, (boost::python::arg("cpus") = boost::python::object(),
+                                                                                  boost::python::arg("numa_node") = -1,
+                                                                                  boost::python::arg("no_denormals") = true,
+                                                                                  boost::python::arg("nice") = 0))
+    .def("get_execution_policy", &RenderEngineWrapper::wrapperGetExecutionPolicy)
+    .def("get_render_stats", &RenderEngineWrapper::wrapperGetRenderStats)
+    .def("set_sample_accurate_midi", &RenderEngineWrapper::wrapperSetSampleAccurateMidi)
+    .def("is_sample_accurate_midi", &RenderEngineWrapper::wrapperIsSampleAccurateMidi)
+    .def("set_automation", &RenderEngineWrapper::wrapperSetAutomation)
+    .def("set_automation_curve", &RenderEngineWrapper::wrapperSetAutomationCurve)
+    .def("remove_automation", &RenderEngineWrapper::wrapperRemoveAutomation)
+    .def("clear_automation", &RenderEngineWrapper::wrapperClearAutomation)
+    .def("set_automation_interval", &RenderEngineWrapper::wrapperSetAutomationInterval)
+    .def("get_automation_interval", &RenderEngineWrapper::wrapperGetAutomationInterval)
     .def("render_patch", &RenderEngineWrapper::wrapperRenderPatch)
+    .def("render_patch_async", &RenderEngineWrapper::wrapperRenderPatchAsync)
     .def("get_plugin_parameter_size", &RenderEngineWrapper::wrapperGetPluginParameterSize)
     .def("get_plugin_parameters_description", &RenderEngineWrapper::wrapperGetPluginParametersDescription)
-    .def("override_plugin_parameter", &RenderEngineWrapper::overridePluginParameter)
-    .def("remove_overriden_plugin_parameter", &RenderEngineWrapper::removeOverridenParameter)
+    .def("get_parameter_info", &RenderEngineWrapper::wrapperGetParameterInfo)
+    .def("get_parameter_value_strings", &RenderEngineWrapper::wrapperGetParameterValueStrings)
+    .def("get_parameter_index", &RenderEngineWrapper::wrapperGetParameterIndex)
+    .def("override_plugin_parameter", &RenderEngineWrapper::wrapperOverridePluginParameter)
+    .def("remove_overriden_plugin_parameter", &RenderEngineWrapper::wrapperRemoveOverridenParameter)
     .def("get_audio_frames", &RenderEngineWrapper::wrapperGetAudioFrames)
     .def("get_rms_frames", &RenderEngineWrapper::wrapperGetRMSFrames)
-    .def("write_to_wav", &RenderEngineWrapper::writeToWav)
+    .def("get_stft", &RenderEngineWrapper::wrapperGetStft, (boost::python::arg("fft_size"),
+                                                            boost::python::arg("hop_size"),
+                                                            boost::python::arg("num_threads") = 0))
+    .def("get_mel_spectrogram", &RenderEngineWrapper::wrapperGetMelSpectrogram, (boost::python::arg("fft_size"),
+                                                                                boost::python::arg("hop_size"),
+                                                                                boost::python::arg("num_filters") = 128,
+                                                                                boost::python::arg("num_threads") = 0))
+    .def("get_mfcc_frames", &RenderEngineWrapper::wrapperGetMfccFrames, (boost::python::arg("fft_size"),
+                                                                         boost::python::arg("hop_size"),
+                                                                         boost::python::arg("num_filters") = 40,
+                                                                         boost::python::arg("num_coeffs") = 13,
+                                                                         boost::python::arg("num_threads") = 0))
+    .def("set_feature_pipeline", &RenderEngineWrapper::wrapperEnableFeaturePipeline, (boost::python::arg("fft_size") = 2048,
+                                                                                     boost::python::arg("hop_size") = 512,
+                                                                                     boost::python::arg("num_mel_bands") = 128,
+                                                                                     boost::python::arg("stft") = true,
+                                                                                     boost::python::arg("mel") = true,
+                                                                                     boost::python::arg("onset") = true,
+                                                                                     boost::python::arg("rms") = true))
+    .def("disable_feature_pipeline", &RenderEngineWrapper::wrapperDisableFeaturePipeline)
+    .def("get_features", &RenderEngineWrapper::wrapperGetFeatures)
+    .def("set_output_sample_rates", &RenderEngineWrapper::wrapperSetOutputSampleRates)
+    .def("get_output_sample_rates", &RenderEngineWrapper::wrapperGetOutputSampleRates)
+    .def("get_resampled_audio", &RenderEngineWrapper::wrapperGetResampledAudio)
+    .def("set_multi_output", &RenderEngineWrapper::wrapperSetMultiOutput)
+    .def("is_multi_output", &RenderEngineWrapper::wrapperIsMultiOutput)
+    .def("get_output_names", &RenderEngineWrapper::wrapperGetOutputNames)
+    .def("load_stem_midi", &RenderEngineWrapper::wrapperLoadStemMidi)
+    .def("set_stem_outputs", &RenderEngineWrapper::wrapperSetStemOutputs)
+    .def("get_num_stems", &RenderEngineWrapper::wrapperGetNumStems)
+    .def("get_stem_routing", &RenderEngineWrapper::wrapperGetStemRouting)
+    .def("get_stem_audio", &RenderEngineWrapper::wrapperGetStemAudio)
+    .def("set_render_cache", &RenderEngineWrapper::wrapperEnableRenderCache, (boost::python::arg("directory"),
+                                                                              boost::python::arg("max_size_gb") = 0.0))
+    .def("disable_render_cache", &RenderEngineWrapper::wrapperDisableRenderCache)
+    .def("was_last_render_cached", &RenderEngineWrapper::wrapperWasLastRenderCached)
+    .def("get_render_hash", &RenderEngineWrapper::wrapperGetRenderHash)
+    .def("write_to_wav", &RenderEngineWrapper::wrapperWriteToWav, (boost::python::arg("path"),
+                                                                   boost::python::arg("format") = maxiRecorder::pcm16,
+                                                                   boost::python::arg("sample_rate") = 0))
     .def("get_program_name", &RenderEngineWrapper::wrapperGetProgramName)
     .def("get_plugin_name", &RenderEngineWrapper::wrapperGetPluginName);
+
+    enum_<PatchGenerator::SamplingMethod>("SamplingMethod")
+    .value("uniform", PatchGenerator::uniformSampling)
+    .value("sobol", PatchGenerator::sobolSampling)
+    .value("latin_hypercube", PatchGenerator::latinHypercubeSampling);
+
+    class_<PatchGeneratorWrapper>("PatchGenerator", init<RenderEngineWrapper&>())
+    .def(init<RenderEngineWrapper&, uint64>())
+    .def("get_random_parameter", &PatchGeneratorWrapper::wrapperGetRandomParameter)
+    .def("get_random_patch", &PatchGeneratorWrapper::wrapperGetRandomPatch)
+    .def("set_seed", &PatchGeneratorWrapper::setSeed)
+    .def("get_num_parameters", &PatchGeneratorWrapper::getNumParameters)
+    .def("get_parameter_indices", &PatchGeneratorWrapper::wrapperGetParameterIndices)
+    .def("set_parameter_range", &PatchGeneratorWrapper::setParameterRange)
+    .def("set_parameter_mask", &PatchGeneratorWrapper::setParameterMask)
+    .def("generate", &PatchGeneratorWrapper::wrapperGenerate);
+
+    class_<RenderSweepWrapper, boost::noncopyable>("RenderSweep", init<int, int, std::string, int>())
+    .def("is_ready", &RenderSweepWrapper::isReady)
+    .def("get_num_engines", &RenderSweepWrapper::getNumEngines)
+    .def("get_num_parameters", &RenderSweepWrapper::getNumParameters)
+    .def("set_execution_policy", &RenderSweepWrapper::wrapperSetExecutionPolicy, (boost::python::arg("cpus") = boost::python::object(),
+                                                                                 boost::python::arg("numa_node") = -1,
+                                                                                 boost::python::arg("no_denormals") = true,
+                                                                                 boost::python::arg("nice") = 0,
+                                                                                 boost::python::arg("spread") = false))
+    .def("render", &RenderSweepWrapper::wrapperRender);
+
+    class_<ForkServerWrapper, boost::noncopyable>("ForkServer", init<RenderEngineWrapper&, int>((boost::python::arg("engine"),
+                                                                                              boost::python::arg("num_workers")))[boost::python::with_custodian_and_ward<1, 2>()])
+    .def("is_ready", &ForkServerWrapper::isReady)
+    .def("get_num_workers", &ForkServerWrapper::getNumWorkers)
+    .def("get_num_pending", &ForkServerWrapper::getNumPending)
+    .def("submit", &ForkServerWrapper::wrapperSubmit, (boost::python::arg("midi_path"),
+                                                       boost::python::arg("wav_path"),
+                                                       boost::python::arg("render_length") = 0.0,
+                                                       boost::python::arg("min_tail") = 0.5,
+                                                       boost::python::arg("max_tail") = 10.0,
+                                                       boost::python::arg("min_length") = 0.0,
+                                                       boost::python::arg("peak") = 0.0f,
+                                                       boost::python::arg("bits") = 16))
+    .def("wait", &ForkServerWrapper::wrapperWait, (boost::python::arg("timeout") = -1.0))
+    .def("shutdown", &ForkServerWrapper::shutdown);
+
+    class_<StemContainerWrapper, boost::noncopyable>("StemContainer", init<std::string>())
+    .def("is_open", &StemContainerWrapper::isOpen)
+    .def("get_names", &StemContainerWrapper::wrapperGetNames)
+    .def("get_num_streams", &StemContainerWrapper::getNumStreams)
+    .def("get_sample_rate", &StemContainerWrapper::getSampleRate)
+    .def("get_num_frames", &StemContainerWrapper::getNumFrames)
+    .def("get_metadata", &StemContainerWrapper::wrapperGetMetadata)
+    .def("read", &StemContainerWrapper::wrapperRead, (boost::python::arg("start"),
+                                                      boost::python::arg("num_frames"),
+                                                      boost::python::arg("streams") = boost::python::object()));
+
+    class_<DatasetReaderWrapper, boost::noncopyable>("DatasetReader", init<std::string, int>((boost::python::arg("root"),
+                                                                                             boost::python::arg("num_threads") = 2)))
+    .def("get_num_tracks", &DatasetReaderWrapper::getNumTracks)
+    .def("get_track_name", &DatasetReaderWrapper::wrapperGetTrackName)
+    .def("get_stream_names", &DatasetReaderWrapper::wrapperGetStreamNames)
+    .def("get_num_frames", &DatasetReaderWrapper::getNumFrames)
+    .def("get_sample_rate", &DatasetReaderWrapper::getSampleRate)
+    .def("prefetch", &DatasetReaderWrapper::wrapperPrefetch, (boost::python::arg("track"),
+                                                              boost::python::arg("start"),
+                                                              boost::python::arg("num_frames"),
+                                                              boost::python::arg("streams") = boost::python::object()))
+    .def("read", &DatasetReaderWrapper::wrapperRead, (boost::python::arg("track"),
+                                                      boost::python::arg("start"),
+                                                      boost::python::arg("num_frames"),
+                                                      boost::python::arg("streams") = boost::python::object()))
+    .def("get_mix_gains", &DatasetReaderWrapper::wrapperGetMixGains)
+    .def("remix", &DatasetReaderWrapper::wrapperRemix, (boost::python::arg("track"),
+                                                        boost::python::arg("start"),
+                                                        boost::python::arg("num_frames"),
+                                                        boost::python::arg("streams") = boost::python::object(),
+                                                        boost::python::arg("gain_range_db") = 0.0f,
+                                                        boost::python::arg("dropout") = 0.0f,
+                                                        boost::python::arg("random_polarity") = false,
+                                                        boost::python::arg("seed") = -1));
 }
@@ -0,0 +1,246 @@
+/*
+  ==============================================================================
+
+    RenderAllocations.cpp
+
+    Counts the heap allocations every render makes, on any thread, while an
+    engine renders the same MIDI over and over. A warmed up engine should
+    not allocate at all, so this exits with 1 if any render after the
+    warm-up renders did, or came out silent. The instrument is the built in SFZ player with a
+    generated sample, so no plugin is needed.
+
+    Linux (glibc) only, as allocations are counted by replacing malloc and
+    friends. Build it against the objects of the library build, without the
+    Python bindings:
+
+        cd Builds/LinuxMakefile && make CONFIG=Release
+        g++ -std=c++11 -O2 -DLINUX=1 -DNDEBUG=1 -I../../JuceLibraryCode \
+            -I../../JuceLibraryCode/modules ../../Tools/RenderAllocations.cpp \
+            $(ls build/intermediate/Release/*.o | grep -v source_) \
+            $(pkg-config --libs alsa freetype2 libcurl x11 xext xinerama) \
+            -lGL -ldl -lpthread -lrt -o RenderAllocations
+        ./RenderAllocations
+
+  ==============================================================================
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+#include "../Source/RenderEngine.h"
+
+//==============================================================================
+extern "C"
+{
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc (void*, size_t);
+    void* __libc_memalign (size_t, size_t);
+}
+
+namespace
+{
+    std::atomic<bool>  counting (false);
+    std::atomic<int64> allocations (0);
+
+    inline void count()
+    {
+        if (counting.load (std::memory_order_relaxed))
+            allocations.fetch_add (1, std::memory_order_relaxed);
+    }
+}
+
+// operator new ends up here too.
+extern "C"
+{
+    void* malloc (size_t size)
+    {
+        count();
+        return __libc_malloc (size);
+    }
+
+    void* calloc (size_t numElements, size_t size)
+    {
+        count();
+        return __libc_calloc (numElements, size);
+    }
+
+    void* realloc (void* pointer, size_t size)
+    {
+        count();
+        return __libc_realloc (pointer, size);
+    }
+
+    void* memalign (size_t alignment, size_t size)
+    {
+        count();
+        return __libc_memalign (alignment, size);
+    }
+
+    void* aligned_alloc (size_t alignment, size_t size)
+    {
+        count();
+        return __libc_memalign (alignment, size);
+    }
+
+    int posix_memalign (void** pointer, size_t alignment, size_t size)
+    {
+        count();
+        void* const allocated = __libc_memalign (alignment, size);
+        if (allocated == nullptr)
+            return ENOMEM;
+        *pointer = allocated;
+        return 0;
+    }
+}
+
+//==============================================================================
+namespace
+{
+    const double sampleRate = 44100.0;
+    const int    bufferSize = 512;
+    const double renderLength = 6.0;
+    const int    warmUpRenders = 2;
+    const int    measuredRenders = 8;
+
+    // A second of a decaying stereo saw, played across the whole keyboard.
+    bool writeInstrument (const File& directory, File& sfzFile)
+    {
+        AudioSampleBuffer tone (2, int (sampleRate));
+        for (int i = 0; i < tone.getNumSamples(); ++i)
+        {
+            const float saw = float (std::fmod (i * 220.0 / sampleRate, 1.0) * 2.0 - 1.0);
+            const float envelope = float (std::exp (-3.0 * i / sampleRate));
+            tone.setSample (0, i, 0.5f * saw * envelope);
+            tone.setSample (1, i, -0.5f * saw * envelope);
+        }
+
+        const File wavFile = directory.getChildFile ("tone.wav");
+        std::unique_ptr<FileOutputStream> stream (wavFile.createOutputStream());
+        WavAudioFormat wav;
+        std::unique_ptr<AudioFormatWriter> writer (wav.createWriterFor (stream.get(), sampleRate, 2, 16,
+                                                                        StringPairArray(), 0));
+        if (writer == nullptr)
+            return false;
+        stream.release();
+        if (! writer->writeFromAudioSampleBuffer (tone, 0, tone.getNumSamples()))
+            return false;
+        writer = nullptr;
+
+        sfzFile = directory.getChildFile ("tone.sfz");
+        return sfzFile.replaceWithText ("<region> sample=tone.wav lokey=0 hikey=127 pitch_keycenter=60 "
+                                        "ampeg_release=0.3\n");
+    }
+
+    // Chords with overlapping repeats and a controller sweep, the last
+    // chord left hanging.
+    bool writeMidi (const File& file)
+    {
+        MidiMessageSequence track;
+        for (int bar = 0; bar < 8; ++bar)
+        {
+            const double time = bar * 0.5;
+            for (const int note : { 48, 55, 60, 64 })
+            {
+                track.addEvent (MidiMessage::noteOn (1, note + bar % 3, 0.8f), time);
+                if (bar < 7)
+                    track.addEvent (MidiMessage::noteOff (1, note + bar % 3), time + 0.7);
+            }
+            for (int step = 0; step < 8; ++step)
+                track.addEvent (MidiMessage::controllerEvent (1, 1, bar * 8 + step), time + step * 0.06);
+        }
+        track.updateMatchedPairs();
+
+        MidiFile midi;
+        midi.setTicksPerQuarterNote (960);
+        MidiMessageSequence ticks;
+        for (int i = 0; i < track.getNumEvents(); ++i)
+        {
+            MidiMessage message = track.getEventPointer (i)->message;
+            message.setTimeStamp (message.getTimeStamp() * 2.0 * 960.0);
+            ticks.addEvent (message);
+        }
+        midi.addTrack (ticks);
+
+        file.deleteFile();
+        FileOutputStream stream (file);
+        return stream.openedOk() && midi.writeTo (stream);
+    }
+
+    // Renders warm-up plus measured times and prints what each render
+    // allocated. Returns whether the measured renders allocated nothing.
+    bool check (const String& name, RenderEngine& engine)
+    {
+        std::cout << name << ":";
+        bool allocationFree = true;
+
+        for (int i = 0; i < warmUpRenders + measuredRenders; ++i)
+        {
+            allocations = 0;
+            counting = true;
+            engine.renderMidi (renderLength);
+            counting = false;
+
+            const int64 count = allocations;
+            std::cout << " " << count << "/" << engine.getRenderStats().arenaGrowths;
+            if (i >= warmUpRenders && count > 0)
+                allocationFree = false;
+        }
+
+        // A render that makes no sound proves nothing.
+        double peak = 0.0;
+        for (const double sample : engine.getAudioFrames())
+            peak = jmax (peak, std::abs (sample));
+
+        std::cout << (peak == 0.0 ? "  SILENT" : allocationFree ? "  ok" : "  ALLOCATES") << std::endl;
+        return allocationFree && peak > 0.0;
+    }
+}
+
+//==============================================================================
+int main()
+{
+    const File directory = File::createTempFile ("RenderAllocations");
+    directory.createDirectory();
+
+    File sfzFile;
+    const File midiFile = directory.getChildFile ("chords.mid");
+    if (! writeInstrument (directory, sfzFile) || ! writeMidi (midiFile))
+    {
+        std::cout << "Could not write the test files to " << directory.getFullPathName() << std::endl;
+        directory.deleteRecursively();
+        return 2;
+    }
+
+    const std::string instrument = "internal:sfz:" + sfzFile.getFullPathName().toStdString();
+    const std::string midi = midiFile.getFullPathName().toStdString();
+
+    std::cout << "Allocations/arena growths per render, " << warmUpRenders
+              << " warm-up renders first" << std::endl;
+
+    bool allocationFree = true;
+    {
+        RenderEngine engine (int (sampleRate), bufferSize);
+        if (! engine.loadPlugin (instrument) || ! engine.loadMidi (midi))
+            return 2;
+        allocationFree &= check ("plain", engine);
+
+        engine.setMidiSanitization (true);
+        engine.loadMidi (midi);
+        engine.setSampleAccurateMidi (true);
+        allocationFree &= check ("sanitized, sample accurate", engine);
+
+        engine.enableFeaturePipeline (2048, 512, 64,
+                                      FeaturePipeline::stftFeature | FeaturePipeline::melFeature
+                                    | FeaturePipeline::onsetFeature | FeaturePipeline::rmsFeature);
+        engine.setOutputSampleRates ({ 16000, 22050 });
+        allocationFree &= check ("features, resampled", engine);
+
+        engine.setMultiOutput (true);
+        engine.loadStemMidi ({ midi });
+        allocationFree &= check ("stems", engine);
+    }
+
+    directory.deleteRecursively();
+    return allocationFree ? 0 : 1;
+}
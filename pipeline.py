@@ -0,0 +1,203 @@
+"""
+Building blocks for running the stages of `render_by_instrument` as a streaming pipeline:
+bounded queues between stages that make producers wait for consumers (back-pressure),
+and per stage counters that are logged while it runs.
+"""
+
+import time
+import threading
+import collections
+
+
+class AffinityQueue(object):
+    """
+    A bounded FIFO of `(key, item)` pairs. `get` prefers the oldest item with a given key,
+    so a render worker keeps taking stems for the patch it already has loaded instead of
+    reloading. An item that has been passed over `maxsize` times is handed out next no
+    matter what, so nothing waits forever. Without a key it is a plain FIFO.
+
+    Args:
+        maxsize (int): Number of items after which `put` blocks.
+
+    """
+    def __init__(self, maxsize):
+        self.maxsize = max(1, int(maxsize))
+        self.items = collections.deque()
+        self.cond = threading.Condition()
+        self.closed = False
+
+    def __len__(self):
+        with self.cond:
+            return len(self.items)
+
+    def put(self, key, item):
+        """
+        Blocks while the queue is full.
+
+        Returns:
+            float: Seconds spent waiting for space.
+
+        """
+        start = time.time()
+        with self.cond:
+            while len(self.items) >= self.maxsize:
+                self.cond.wait()
+            self.items.append([key, item, 0])
+            self.cond.notify_all()
+        return time.time() - start
+
+    def get(self, key=None):
+        """
+        Blocks until there is an item or the queue is closed.
+
+        Returns:
+            tuple: `(key, item, seconds spent waiting)`, or None once the queue is closed
+                and empty.
+
+        """
+        start = time.time()
+        with self.cond:
+            while not self.items and not self.closed:
+                self.cond.wait()
+            if not self.items:
+                return None
+
+            index = 0
+            if key is not None and self.items[0][2] < self.maxsize:
+                for i, entry in enumerate(self.items):
+                    if entry[0] == key:
+                        index = i
+                        break
+
+            for i in range(index):
+                self.items[i][2] += 1
+
+            entry = self.items[index]
+            del self.items[index]
+            self.cond.notify_all()
+        return entry[0], entry[1], time.time() - start
+
+    def close(self):
+        """No more items will be put, `get` returns None once the rest are taken."""
+        with self.cond:
+            self.closed = True
+            self.cond.notify_all()
+
+
+class Stage(object):
+    """
+    Counters for one pipeline stage. Worker time is split into busy (working on an item),
+    starved (waiting for input) and blocked (waiting for space downstream), which shows
+    which stage holds the others back.
+
+    Args:
+        name (str): Name used in the log.
+        num_workers (int): Number of worker threads of the stage.
+        input_queue (AffinityQueue): The queue the stage takes its items from, if any.
+
+    """
+    def __init__(self, name, num_workers, input_queue=None):
+        self.name = name
+        self.num_workers = num_workers
+        self.input_queue = input_queue
+        self.lock = threading.Lock()
+        self.created = time.time()
+        self.busy = 0
+        self.done = 0
+        self.failed = 0
+        self.busy_time = 0.0
+        self.starved_time = 0.0
+        self.blocked_time = 0.0
+
+    def start(self):
+        """Call when a worker picks up an item. Returns the value to pass to `finish`."""
+        with self.lock:
+            self.busy += 1
+        return time.time()
+
+    def finish(self, start, failed=False):
+        with self.lock:
+            self.busy -= 1
+            self.busy_time += time.time() - start
+            if failed:
+                self.failed += 1
+            else:
+                self.done += 1
+
+    def add_starved(self, seconds):
+        with self.lock:
+            self.starved_time += seconds
+
+    def add_blocked(self, seconds):
+        with self.lock:
+            self.blocked_time += seconds
+
+    def summary(self):
+        """One line of occupancy, throughput and where the workers' time went."""
+        with self.lock:
+            worker_time = max(1e-9, (time.time() - self.created) * self.num_workers)
+            line = '{}: {}/{} busy, {} done, {} failed'.format(self.name, self.busy,
+                                                             self.num_workers, self.done,
+                                                             self.failed)
+            if self.input_queue is not None:
+                line += ', queue {}/{}'.format(len(self.input_queue), self.input_queue.maxsize)
+            line += ' | busy {:.0%}, starved {:.0%}, blocked {:.0%}'.format(
+                self.busy_time / worker_time, self.starved_time / worker_time,
+                self.blocked_time / worker_time)
+            return line
+
+
+class StageMonitor(object):
+    """
+    Logs the summary of every stage every `interval` seconds from a background thread.
+
+    Args:
+        stages (list): `Stage` objects.
+        interval (float): Seconds between reports, zero or less to never report.
+        log (callable): Called with each line, e.g. `logger.info`.
+
+    """
+    def __init__(self, stages, interval, log):
+        self.stages = stages
+        self.interval = interval
+        self.log = log
+        self.stopped = threading.Event()
+        self.thread = None
+
+    def report(self):
+        for stage in self.stages:
+            self.log(stage.summary())
+
+    def start(self):
+        if self.interval <= 0:
+            return
+
+        def loop():
+            while not self.stopped.wait(self.interval):
+                self.report()
+
+        self.thread = threading.Thread(target=loop, name='pipeline-monitor')
+        self.thread.daemon = True
+        self.thread.start()
+
+    def stop(self):
+        self.stopped.set()
+        if self.thread is not None:
+            self.thread.join()
+        self.report()
+
+
+def start_workers(target, num_workers, name):
+    """Starts `num_workers` daemon threads running `target`."""
+    threads = []
+    for i in range(num_workers):
+        thread = threading.Thread(target=target, name='{}-{}'.format(name, i))
+        thread.daemon = True
+        thread.start()
+        threads.append(thread)
+    return threads
+
+
+def join_workers(threads):
+    for thread in threads:
+        thread.join()
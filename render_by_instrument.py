@@ -9,6 +9,7 @@ import collections
 import shutil
 import random
 import logging
+import threading
 from datetime import datetime
 
 import numpy as np
@@ -17,7 +18,9 @@ import yaml
 import pretty_midi
 import pyloudnorm as pyln
 
+import librenderman as rm
 import utils
+import pipeline
 import midi_inst_rules
 
 logging.basicConfig(level=logging.DEBUG,
@@ -190,109 +193,149 @@ def prepare_midi(midi_paths, max_num_files, output_base_dir, inst_classes, defs_
         logger.info('({}/{}) Selected {}'.format(midi_files_read, max_num_files, path))
         midi_files_read += 1
 
-        # Make a whole bunch of paths to store everything
-        uuid = os.path.splitext(os.path.basename(path))[0]
-        out_dir_name = 'Track{:05d}'.format(midi_files_read)
-        output_dir = os.path.join(output_base_dir, out_dir_name)
-        utils.safe_make_dirs(output_dir)
-        shutil.copy(path, output_dir)
-        os.rename(os.path.join(output_dir, uuid + '.mid'),
-                  os.path.join(output_dir, 'all_src.mid'))
-        midi_out_dir = os.path.join(output_dir, 'MIDI')
-        audio_out_dir = os.path.join(output_dir, 'stems')
-        utils.safe_make_dirs(midi_out_dir)
-        utils.safe_make_dirs(audio_out_dir)
+        render_infos = prepare_track(pm, path, midi_files_read, output_base_dir, inst_classes,
+                                     inv_defs_dict, pgm0_is_piano=pgm0_is_piano,
+                                     rerender_existing=rerender_existing,
+                                     same_pgms_diff=same_pgms_diff,
+                                     zero_based_midi=zero_based_midi)
+        for selected_patch, render_info in render_infos:
+            srcs_by_inst[selected_patch].append(render_info)
 
-        # Set up metadata
-        metadata = {
-            'lmd_midi_dir': os.path.sep.join(path.split(os.path.sep)[-6:]),
-            'midi_dir': midi_out_dir,
-            'audio_dir': audio_out_dir,
-            'UUID': uuid,
-            'stems': {}
-        }
-        seen_pgms = {}
-
-        # Loop through instruments in this MIDI file
-        for j, inst in enumerate(pm.instruments):
-
-            # Name it and figure out what instrument class this is
-            key = 'S{:02d}'.format(j)
-            inst_cls = utils.get_inst_class(inst_classes, inst, pgm0_is_piano)
-
-            # Set up metadata
-            metadata['stems'][key] = {}
-            metadata['stems'][key]['inst_class'] = inst_cls
-            metadata['stems'][key]['is_drum'] = inst.is_drum
-            metadata['stems'][key]['midi_program_name'] = utils.get_inst_program_name(inst_classes,
-                                                                             inst, pgm0_is_piano)
-
-            if inst.is_drum:
-                # Drums use this special flag, but not the program number,
-                # so the pgm # is always set to 0.
-                # But usually program number 0 is piano.
-                # So we define program number 129/128 for drums to avoid collisions.
-                program_num = 129 if not zero_based_midi else 128
-            else:
-                program_num = int(inst.program)
+        logger.info('Finished {}'.format(path))
 
-            metadata['stems'][key]['program_num'] = program_num
-            metadata['stems'][key]['midi_saved'] = False
-            metadata['stems'][key]['audio_rendered'] = False
+        if midi_files_read >= max_num_files:
+            logger.info('Finished reading MIDI')
+            break
 
-            if program_num not in inv_defs_dict or len(inv_defs_dict[program_num]) < 1:
-                metadata['stems'][key]['plugin_name'] = 'None'
-                logger.info('No instrument loaded for \'{}\' (skipping).'.format(inst_cls))
-                continue
+    return srcs_by_inst
 
-            # if we've seen this program # before, use the previously selected patch
-            if not same_pgms_diff and program_num in seen_pgms.keys():
-                selected_patch = seen_pgms[program_num]
-            else:
-                selected_patch = select_patch_rand(inv_defs_dict, program_num)
-                seen_pgms[program_num] = selected_patch
 
-            metadata['stems'][key]['plugin_name'] = selected_patch
+def prepare_track(pm, path, track_num, output_base_dir, inst_classes, inv_defs_dict,
+                  pgm0_is_piano=False, rerender_existing=False, same_pgms_diff=False,
+                  zero_based_midi=False):
+    """
+    Sets up the output directory of one MIDI file that passed `check_midi_file`. The MIDI
+    file is copied there, each instrument track is split off into its own MIDI file and
+    assigned a synthesis patch.
 
-            # Save the info we need for the next stages
-            render_info = {'metadata': os.path.join(output_dir, 'metadata.yaml'),
-                           'source_key': key,
-                           'end_time': pm.get_end_time() + 5.0}
-            srcs_by_inst[selected_patch].append(render_info)
+    Args:
+        pm (pretty_midi.PrettyMIDI): The parsed MIDI file.
+        path (str): Path to the MIDI file.
+        track_num (int): Number of the output directory, `Track<track_num>`.
+        output_base_dir (str): Base directory where output will be stored.
+        inst_classes:
+        inv_defs_dict: Patches by program number, see `invert_defs_dict`.
+        pgm0_is_piano:
+        rerender_existing:
+        same_pgms_diff:
+        zero_based_midi:
 
-            # Make the output path
-            midi_out_path = os.path.join(midi_out_dir, '{}.mid'.format(key))
-            if os.path.exists(midi_out_path) and not rerender_existing:
-                logger.info('Found {}. Skipping...'.format(midi_out_path))
-                continue
+    Returns:
+        list: A `(patch, render_info)` pair for every stem that has a patch.
+
+    """
+    render_infos = []
+
+    # Make a whole bunch of paths to store everything
+    uuid = os.path.splitext(os.path.basename(path))[0]
+    out_dir_name = 'Track{:05d}'.format(track_num)
+    output_dir = os.path.join(output_base_dir, out_dir_name)
+    utils.safe_make_dirs(output_dir)
+    shutil.copy(path, output_dir)
+    os.rename(os.path.join(output_dir, uuid + '.mid'),
+              os.path.join(output_dir, 'all_src.mid'))
+    midi_out_dir = os.path.join(output_dir, 'MIDI')
+    audio_out_dir = os.path.join(output_dir, 'stems')
+    utils.safe_make_dirs(midi_out_dir)
+    utils.safe_make_dirs(audio_out_dir)
+
+    # Set up metadata
+    metadata = {
+        'lmd_midi_dir': os.path.sep.join(path.split(os.path.sep)[-6:]),
+        'midi_dir': midi_out_dir,
+        'audio_dir': audio_out_dir,
+        'UUID': uuid,
+        'stems': {}
+    }
+    seen_pgms = {}
+
+    # Loop through instruments in this MIDI file
+    for j, inst in enumerate(pm.instruments):
+
+        # Name it and figure out what instrument class this is
+        key = 'S{:02d}'.format(j)
+        inst_cls = utils.get_inst_class(inst_classes, inst, pgm0_is_piano)
 
-            # Save a midi file with just that source
-            midi_stem = copy.copy(pm)
-            midi_stem.name = key
-            midi_stem.instruments = []
-            inst = midi_inst_rules.apply_midi_rules(inst, inst_cls)
-            midi_stem.instruments.append(inst)
-            midi_stem.write(midi_out_path)
+        # Set up metadata
+        metadata['stems'][key] = {}
+        metadata['stems'][key]['inst_class'] = inst_cls
+        metadata['stems'][key]['is_drum'] = inst.is_drum
+        metadata['stems'][key]['midi_program_name'] = utils.get_inst_program_name(inst_classes,
+                                                                                  inst, pgm0_is_piano)
+
+        if inst.is_drum:
+            # Drums use this special flag, but not the program number,
+            # so the pgm # is always set to 0.
+            # But usually program number 0 is piano.
+            # So we define program number 129/128 for drums to avoid collisions.
+            program_num = 129 if not zero_based_midi else 128
+        else:
+            program_num = int(inst.program)
+
+        metadata['stems'][key]['program_num'] = program_num
+        metadata['stems'][key]['midi_saved'] = False
+        metadata['stems'][key]['audio_rendered'] = False
+
+        if program_num not in inv_defs_dict or len(inv_defs_dict[program_num]) < 1:
+            metadata['stems'][key]['plugin_name'] = 'None'
+            logger.info('No instrument loaded for \'{}\' (skipping).'.format(inst_cls))
+            continue
 
-            if os.path.isfile(midi_out_path):
-                metadata['stems'][key]['midi_saved'] = True
-                logger.info('Wrote {}.mid. Selected patch \'{}\''.format(key, selected_patch))
+        # if we've seen this program # before, use the previously selected patch
+        if not same_pgms_diff and program_num in seen_pgms.keys():
+            selected_patch = seen_pgms[program_num]
+        else:
+            selected_patch = select_patch_rand(inv_defs_dict, program_num)
+            seen_pgms[program_num] = selected_patch
+
+        metadata['stems'][key]['plugin_name'] = selected_patch
+
+        # Save the info we need for the next stages
+        render_info = {'metadata': os.path.join(output_dir, 'metadata.yaml'),
+                       'source_key': key,
+                       'end_time': pm.get_end_time()}
+        render_infos.append((selected_patch, render_info))
+
+        # Make the output path
+        midi_out_path = os.path.join(midi_out_dir, '{}.mid'.format(key))
+        if os.path.exists(midi_out_path) and not rerender_existing:
+            logger.info('Found {}. Skipping...'.format(midi_out_path))
+            continue
 
-        if not rerender_existing:
-            with open(os.path.join(output_dir, 'metadata.yaml'), 'w') as f:
-                f.write(yaml.safe_dump(metadata, default_flow_style=False, allow_unicode=True))
+        # Save a midi file with just that source
+        midi_stem = copy.copy(pm)
+        midi_stem.name = key
+        midi_stem.instruments = []
+        inst = midi_inst_rules.apply_midi_rules(inst, inst_cls)
+        midi_stem.instruments.append(inst)
+        midi_stem.write(midi_out_path)
 
-        logger.info('Finished {}'.format(path))
+        if os.path.isfile(midi_out_path):
+            metadata['stems'][key]['midi_saved'] = True
+            logger.info('Wrote {}.mid. Selected patch \'{}\''.format(key, selected_patch))
 
-        if midi_files_read >= max_num_files:
-            logger.info('Finished reading MIDI')
-            break
+    if not rerender_existing:
+        with open(os.path.join(output_dir, 'metadata.yaml'), 'w') as f:
+            f.write(yaml.safe_dump(metadata, default_flow_style=False, allow_unicode=True))
 
-    return srcs_by_inst
+    return render_infos
 
 
 def render_sources(src_by_inst, sr, buf, kontakt_path, def_dir, dest_dir, sleep=7.0, restart_lim=50,
-                   rerender_existing=False):
+                   rerender_existing=False, sample_accurate_midi=False, features=None,
+                   render_cache=None, min_tail=0.5, max_tail=5.0, latency_compensation=True,
+                   execution_policy=None, sanitize_midi=False, fork_workers=0,
+                   memory_budget_mb=0, slowdown_limit=0):
     """
 
     Args:
@@ -303,12 +346,50 @@ def render_sources(src_by_inst, sr, buf, kontakt_path, def_dir, dest_dir, sleep=
         def_dir:
         dest_dir:
         sleep:
-        restart_lim:
+        restart_lim (int): Renders after which the engine is loaded again regardless, zero for
+            no limit. See `utils.EngineRecycler`.
         rerender_existing:
+        sample_accurate_midi (bool): Split render blocks at MIDI events so note timing
+            is sample accurate without shrinking `buf`.
+        features (dict): If not None, keyword arguments for `set_feature_pipeline`.
+            Features are computed while each stem renders and saved next to it as
+            `<stem>_features.npz`, before the stem is normalized.
+        render_cache (dict): If not None, keyword arguments for `set_render_cache`. Renders
+            that match one already in the cache are read from it instead.
+        min_tail (float): Shortest tail (seconds) rendered after the end of the track's MIDI.
+        max_tail (float): Longest tail (seconds). In between, the patch's own reported tail
+            length is used.
+        latency_compensation (bool): Pre-roll and trim each plugin's reported latency so
+            every stem is sample aligned with its MIDI.
+        execution_policy (dict): If not None, keyword arguments for `set_execution_policy`
+            (CPU affinity, nice level and denormal handling while rendering).
+        sanitize_midi (bool): Drop meta events, sysex and repeated controller values, fix
+            overlapping notes and close hanging ones before rendering. What changed is saved
+            in the stem's metadata as `midi_sanitization`.
+        fork_workers (int): If above zero, each patch is loaded once and that many worker
+            processes forked from it render its stems in parallel (see `render_with_fork_server`).
+            If `restart_lim` is above zero, the engine is reloaded after that many renders
+            per worker.
+        memory_budget_mb (float): Reload the engine once the process has grown by this many MB
+            during its renders since it was loaded, zero to not check. Not checked with
+            `fork_workers`.
+        slowdown_limit (float): Reload the engine once its mean block time has grown to this
+            many times that of its first renders, zero to not check. Not checked with
+            `fork_workers`.
 
     Returns:
 
     """
+    if fork_workers > 0:
+        return render_with_fork_server(src_by_inst, sr, buf, kontakt_path, def_dir, dest_dir,
+                                       fork_workers, sleep=sleep, restart_lim=restart_lim,
+                                       rerender_existing=rerender_existing,
+                                       sample_accurate_midi=sample_accurate_midi,
+                                       features=features, render_cache=render_cache,
+                                       min_tail=min_tail, max_tail=max_tail,
+                                       latency_compensation=latency_compensation,
+                                       execution_policy=execution_policy,
+                                       sanitize_midi=sanitize_midi)
 
     output_dirs = []
     inst_cnt = 0
@@ -320,87 +401,298 @@ def render_sources(src_by_inst, sr, buf, kontakt_path, def_dir, dest_dir, sleep=
         try:
             eng = None
             render_cnt = 0
+            recycler = utils.EngineRecycler(memory_budget_mb, slowdown_limit, restart_lim)
             for render_info_dict in render_info_list:
 
                 render_cnt += 1
-                metadata_path = render_info_dict['metadata']
-                source_key = render_info_dict['source_key']
-                end_time = render_info_dict['end_time']
-                metadata = yaml.load(open(metadata_path, 'r'))
-
-                audio_out_path = os.path.join(metadata['audio_dir'], '{}.wav'.format(source_key))
-
-                if os.path.exists(audio_out_path) and not rerender_existing:
-                    logger.info('Found {}. Skipping...'.format(audio_out_path))
-                    output_dirs.append(os.path.dirname(audio_out_path))
+                rendered_dir = find_rendered_stem(render_info_dict, rerender_existing)
+                if rendered_dir is not None:
+                    output_dirs.append(rendered_dir)
                     continue
 
                 logger.info('({}/{}) Starting Render '
                             'for MIDI {}, Src {}'.format(render_cnt, len(render_info_list),
-                                                         metadata['midi_dir'], source_key))
+                                                         render_info_dict['metadata'],
+                                                         render_info_dict['source_key']))
 
-                if eng is None or render_cnt % restart_lim == 0:
+                reason = recycler.should_recycle() if eng is not None else None
+                if eng is None or reason is not None:
+                    if reason is not None:
+                        logger.info('Reloading RenderMan engine {}, it {}'.format(inst, reason))
                     del eng
 
-                    if '.nkm' in inst:
-                        eng = utils.load_engine_konkakt(sr, buf, str(kontakt_path), def_dir, inst,
-                                                        dest_dir, sleep,
-                                                        verbose=False)
-                    else:
-                        eng = utils.load_engine(sr, buf, inst, verbose=False)
+                    eng = load_render_engine(inst, sr, buf, kontakt_path, def_dir, dest_dir,
+                                             sleep=sleep,
+                                             sample_accurate_midi=sample_accurate_midi,
+                                             features=features,
+                                             render_cache=render_cache,
+                                             latency_compensation=latency_compensation,
+                                             execution_policy=execution_policy,
+                                             sanitize_midi=sanitize_midi)
 
+                    recycler.loaded()
                     logger.info('~~({}/{})~~ Loaded RenderMan engine {}'.format(inst_cnt,
                                                                                 len(src_by_inst),
                                                                                 inst))
 
-                midi_file_path = os.path.abspath(os.path.join(metadata['midi_dir'],
-                                                              '{}.mid'.format(source_key)))
+                recycler.rendering()
+                rendered_dir = render_stem(eng, render_info_dict, sr, min_tail=min_tail,
+                                           max_tail=max_tail, features=features)
+                recycler.rendered(eng)
+                if rendered_dir is not None:
+                    output_dirs.append(rendered_dir)
 
-                metadata['stems'][source_key]['plugin_preset_name'] = eng.get_program_name()
+            del eng
+        except Exception as e:
+            logger.warning("Got exception '{}' when loading {}. Skipping...".format(e.message, inst))
 
-                # Set and save params here
-                # _, metadata[source_key]['parameters'] = utils.set_parameters(eng)
+    logger.info('Finished rendering audio')
+    return list(set(output_dirs))
 
-                eng.load_midi(str(midi_file_path))
-                eng.render_midi(end_time)
-                logger.info('Rendered MIDI file...')
 
-                # Do some crude normalization before we write to disk
-                audio = np.array(eng.get_audio_frames())
-                if np.max(np.abs(audio)) == 0.0:
-                    continue
+def render_with_fork_server(src_by_inst, sr, buf, kontakt_path, def_dir, dest_dir, num_workers,
+                            sleep=7.0, restart_lim=50, rerender_existing=False,
+                            sample_accurate_midi=False, features=None, render_cache=None,
+                            min_tail=0.5, max_tail=5.0, latency_compensation=True,
+                            execution_policy=None, sanitize_midi=False):
+    """
+    `render_sources` with a RenderMan `ForkServer` per patch: the patch is loaded once and
+    `num_workers` processes forked from the loaded engine render its stems in parallel,
+    sharing the plugin's samples copy-on-write. Workers normalize and write the stems
+    themselves. Features and MIDI sanitization reports are not collected in this mode.
+
+    """
+    if features is not None:
+        logger.warning('Features are not computed when rendering with fork workers.')
+
+    output_dirs = []
+    inst_cnt = 0
+    for inst, render_info_list in src_by_inst.items():
+        inst_cnt += 1
+
+        pending = []
+        for render_info_dict in render_info_list:
+            rendered_dir = find_rendered_stem(render_info_dict, rerender_existing)
+            if rendered_dir is not None:
+                output_dirs.append(rendered_dir)
+            else:
+                pending.append(render_info_dict)
+
+        batch_size = restart_lim * num_workers if restart_lim > 0 else max(1, len(pending))
+        for batch_start in range(0, len(pending), batch_size):
+            batch = pending[batch_start:batch_start + batch_size]
+            try:
+                eng = load_render_engine(inst, sr, buf, kontakt_path, def_dir, dest_dir,
+                                         sleep=sleep,
+                                         sample_accurate_midi=sample_accurate_midi,
+                                         render_cache=render_cache,
+                                         latency_compensation=latency_compensation,
+                                         execution_policy=execution_policy,
+                                         sanitize_midi=sanitize_midi)
+                server = rm.ForkServer(eng, num_workers)
+                if not server.is_ready():
+                    raise RuntimeError('Could not fork render workers')
+
+                logger.info('~~({}/{})~~ Loaded RenderMan engine {} into {} workers, '
+                            'rendering {} stems'.format(inst_cnt, len(src_by_inst), inst,
+                                                        server.get_num_workers(), len(batch)))
+
+                jobs = {}
+                for render_info_dict in batch:
+                    metadata = yaml.load(open(render_info_dict['metadata'], 'r'))
+                    source_key = render_info_dict['source_key']
+                    audio_out_path = os.path.join(metadata['audio_dir'],
+                                                  '{}.wav'.format(source_key))
+                    midi_file_path = os.path.abspath(os.path.join(metadata['midi_dir'],
+                                                                  '{}.mid'.format(source_key)))
+                    job = server.submit(str(midi_file_path), str(audio_out_path),
+                                        min_tail=min_tail, max_tail=max_tail,
+                                        min_length=render_info_dict['end_time'], peak=0.8)
+                    jobs[job] = (render_info_dict, audio_out_path)
+
+                preset_name = eng.get_program_name()
+                while server.get_num_pending() > 0:
+                    result = server.wait()
+                    if result is None:
+                        break
+                    render_info_dict, audio_out_path = jobs[result['job']]
+                    if not result['ok']:
+                        logger.warning('Could not render {}: {}'.format(audio_out_path,
+                                                                        result['error']))
+                        continue
+
+                    logger.info('Rendered MIDI file in {:.1f} secs...'
+                                .format(result['render_seconds']))
+                    rendered = os.path.isfile(audio_out_path)
+                    if rendered:
+                        logger.info('Wrote {} to disk'.format(audio_out_path))
+                    record_stem(render_info_dict, preset_name, rendered)
+                    if rendered:
+                        output_dirs.append(os.path.dirname(audio_out_path))
+
+                server.shutdown()
+                del server
+                del eng
+            except Exception as e:
+                logger.warning("Got exception '{}' when loading {}. Skipping...".format(e.message,
+                                                                                        inst))
 
-                audio /= np.max(np.abs(audio))
-                audio *= 0.8
+    logger.info('Finished rendering audio')
+    return list(set(output_dirs))
 
-                if not np.isclose(float(len(audio)) / float(sr), end_time, atol=0.1):
-                    raise RuntimeError(
-                        'Length of rendered audio ({}) does not match end_time ({})'
-                        .format(float(len(audio)) / float(sr), end_time)
-                    )
 
-                # Save the audio to disk
-                sf.write(audio_out_path, audio, sr)
+def load_render_engine(inst, sr, buf, kontakt_path, def_dir, dest_dir, sleep=7.0,
+                       sample_accurate_midi=False, features=None, render_cache=None,
+                       latency_compensation=True, execution_policy=None, sanitize_midi=False):
+    """
+    Loads the RenderMan engine for one patch, set up for `render_stem`. See `render_sources`
+    for the arguments.
 
-                if os.path.isfile(audio_out_path):
-                    logger.info('Wrote {} to disk'.format(audio_out_path))
-                    output_dirs.append(os.path.dirname(audio_out_path))
-                    metadata['stems'][source_key]['audio_rendered'] = True
-                else:
-                    logger.warning('Could not write {}!'.format(audio_out_path))
+    """
+    if '.nkm' in inst:
+        eng = utils.load_engine_konkakt(sr, buf, str(kontakt_path), def_dir, inst,
+                                        dest_dir, sleep,
+                                        verbose=False)
+    else:
+        eng = utils.load_engine(sr, buf, inst, verbose=False)
 
-                with open(metadata_path, 'w') as f:
-                    f.write(yaml.safe_dump(metadata, default_flow_style=False, allow_unicode=True))
+    eng.set_sample_accurate_midi(sample_accurate_midi)
+    eng.set_latency_compensation(latency_compensation)
+    eng.set_midi_sanitization(sanitize_midi)
 
-            del eng
-        except Exception as e:
-            logger.warning("Got exception '{}' when loading {}. Skipping...".format(e.message, inst))
+    if features is not None:
+        eng.set_feature_pipeline(**features)
 
-    logger.info('Finished rendering audio')
-    return list(set(output_dirs))
+    if render_cache is not None:
+        eng.set_render_cache(**render_cache)
+
+    if execution_policy is not None:
+        eng.set_execution_policy(**execution_policy)
+
+    return eng
+
+
+def find_rendered_stem(render_info_dict, rerender_existing=False):
+    """
+    Returns the audio directory of a stem that was already rendered and should not be
+    rendered again, else None.
 
+    """
+    metadata = yaml.load(open(render_info_dict['metadata'], 'r'))
+    audio_out_path = os.path.join(metadata['audio_dir'],
+                                  '{}.wav'.format(render_info_dict['source_key']))
+
+    if os.path.exists(audio_out_path) and not rerender_existing:
+        logger.info('Found {}. Skipping...'.format(audio_out_path))
+        return os.path.dirname(audio_out_path)
+
+    return None
+
+
+def render_stem(eng, render_info_dict, sr, min_tail=0.5, max_tail=5.0, features=None,
+                metadata_lock=None):
+    """
+    Renders one stem with a loaded engine and writes it (and its features) to the track's
+    audio directory. See `render_sources` for the arguments.
+
+    Args:
+        metadata_lock (threading.Lock): If not None, held while the track's `metadata.yaml`
+            is updated, for when other stems of the track render at the same time.
+
+    Returns:
+        str: The audio directory, or None if nothing was written.
+
+    """
+    metadata_path = render_info_dict['metadata']
+    source_key = render_info_dict['source_key']
+    end_time = render_info_dict['end_time']
+    metadata = yaml.load(open(metadata_path, 'r'))
+
+    audio_out_path = os.path.join(metadata['audio_dir'], '{}.wav'.format(source_key))
+    midi_file_path = os.path.abspath(os.path.join(metadata['midi_dir'],
+                                                  '{}.mid'.format(source_key)))
+
+    # Set and save params here
+    # _, metadata[source_key]['parameters'] = utils.set_parameters(eng)
+
+    eng.load_midi(str(midi_file_path))
+    midi_report = eng.get_midi_report() if eng.is_midi_sanitized() else None
+    if midi_report is not None:
+        logger.info('Sanitized MIDI, {} of {} events left'.format(midi_report['events_out'],
+                                                                midi_report['events_in']))
+    # The track's MIDI end plus this patch's tail, so stems of one track
+    # only differ by their tails. They are padded to match when mixing.
+    render_length = eng.render_midi_auto(min_tail, max_tail, end_time)
+    if eng.was_last_render_cached():
+        logger.info('Found render in the cache...')
+    else:
+        stats = eng.get_render_stats()
+        logger.info('Rendered MIDI file in {:.1f} secs (slowest block {:.1f} ms)...'
+                    .format(stats['render_seconds'], stats['max_block_seconds'] * 1000.0))
+
+    # Do some crude normalization before we write to disk
+    audio = np.array(eng.get_audio_frames())
+    if np.max(np.abs(audio)) == 0.0:
+        return None
+
+    audio /= np.max(np.abs(audio))
+    audio *= 0.8
+
+    if not np.isclose(float(len(audio)) / float(sr), render_length, atol=0.1):
+        raise RuntimeError(
+            'Length of rendered audio ({}) does not match render length ({})'
+            .format(float(len(audio)) / float(sr), render_length)
+        )
+
+    # Save the audio to disk
+    sf.write(audio_out_path, audio, sr)
+
+    if features is not None:
+        features_out_path = os.path.join(metadata['audio_dir'],
+                                         '{}_features.npz'.format(source_key))
+        np.savez(features_out_path, **eng.get_features())
+
+    rendered = os.path.isfile(audio_out_path)
+    if rendered:
+        logger.info('Wrote {} to disk'.format(audio_out_path))
+    else:
+        logger.warning('Could not write {}!'.format(audio_out_path))
+
+    record_stem(render_info_dict, eng.get_program_name(), rendered, midi_report=midi_report,
+                metadata_lock=metadata_lock)
+
+    return os.path.dirname(audio_out_path) if rendered else None
 
-def normalize_and_mix(output_dirs, sr, normalization_factor, target_peak, remix_existing=False):
+
+def record_stem(render_info_dict, preset_name, rendered, midi_report=None, metadata_lock=None):
+    """
+    Saves how a stem was rendered into its track's `metadata.yaml`. See `render_stem` for
+    `metadata_lock`.
+
+    """
+    metadata_path = render_info_dict['metadata']
+    source_key = render_info_dict['source_key']
+
+    if metadata_lock is not None:
+        metadata_lock.acquire()
+    try:
+        # Reread it, other stems of this track may have been written in the meantime.
+        metadata = yaml.load(open(metadata_path, 'r'))
+        metadata['stems'][source_key]['plugin_preset_name'] = preset_name
+        if midi_report is not None:
+            metadata['stems'][source_key]['midi_sanitization'] = dict(midi_report)
+        if rendered:
+            metadata['stems'][source_key]['audio_rendered'] = True
+
+        with open(metadata_path, 'w') as f:
+            f.write(yaml.safe_dump(metadata, default_flow_style=False, allow_unicode=True))
+    finally:
+        if metadata_lock is not None:
+            metadata_lock.release()
+
+
+def normalize_and_mix(output_dirs, sr, normalization_factor, target_peak, remix_existing=False,
+                      pack_stem_container=False, materialize_mix=True):
     """
 
     Args:
@@ -409,76 +701,344 @@ def normalize_and_mix(output_dirs, sr, normalization_factor, target_peak, remix_
         normalization_factor:
         target_peak:
         remix_existing:
+        pack_stem_container (bool): Also write the mix, every stem and the metadata into a
+            single `stems.slkh` container next to `mix.wav` (see RenderMan's `StemContainer`).
+        materialize_mix (bool): If False, neither `mix.wav` nor the gained stems are written.
+            Each stem's mix gain goes into the metadata and `mix_gains.json` instead, and
+            RenderMan's `DatasetReader.remix` builds mixes from the untouched stems on demand.
 
     Returns:
 
     """
 
     logger.info('Starting mixing...')
-    meter = pyln.Meter(sr)
-    target_gain = np.power(10.0, target_peak / 20.0)
     for i, cur_dir in enumerate(output_dirs):
         try:
-            mix_output_path = os.path.join(os.path.dirname(cur_dir), 'mix.wav')
-            if os.path.exists(mix_output_path) and not remix_existing:
-                logger.info('Found {}. Skipping'.format(mix_output_path))
-                continue
+            logger.info('({}/{}) Mixing {}'.format(i+1, len(output_dirs), cur_dir))
+            mix_track(cur_dir, sr, normalization_factor, target_peak,
+                      remix_existing=remix_existing,
+                      pack_stem_container=pack_stem_container,
+                      materialize_mix=materialize_mix)
 
-            metadata_path = os.path.join(os.path.dirname(cur_dir), 'metadata.yaml')
-            if os.path.isfile(metadata_path):
-                metadata = yaml.load(open(metadata_path))
-            else:
-                metadata = {}
-            metadata['normalized'] = False
+        except Exception as e:
+            logger.warning('Trouble mixing {}. Exception: {} Skipping...'.format(cur_dir,
+                                                                                 e.message))
 
-            logger.info('({}/{}) Mixing {}'.format(i+1, len(output_dirs), cur_dir))
 
-            all_audio = {p: sf.read(os.path.join(cur_dir, p))[0] for p in os.listdir(cur_dir)
-                         if os.path.splitext(p)[1] == '.wav'}
-            all_audio = collections.OrderedDict(all_audio)
-            loudnesses = [meter.integrated_loudness(a) for a in all_audio.values()]
+def mix_track(cur_dir, sr, normalization_factor, target_peak, remix_existing=False,
+              pack_stem_container=False, materialize_mix=True):
+    """
+    Normalizes and mixes the stems of one track. See `normalize_and_mix` for the arguments.
+
+    Args:
+        cur_dir (str): The track's audio (stems) directory.
+
+    """
+    meter = pyln.Meter(sr)
+    target_gain = np.power(10.0, target_peak / 20.0)
+    mix_output_path = os.path.join(os.path.dirname(cur_dir), 'mix.wav')
+    gains_output_path = os.path.join(os.path.dirname(cur_dir), 'mix_gains.json')
+    done_path = mix_output_path if materialize_mix else gains_output_path
+    if os.path.exists(done_path) and not remix_existing:
+        logger.info('Found {}. Skipping'.format(done_path))
+        return
+
+    metadata_path = os.path.join(os.path.dirname(cur_dir), 'metadata.yaml')
+    if os.path.isfile(metadata_path):
+        metadata = yaml.load(open(metadata_path))
+    else:
+        metadata = {}
+    metadata['normalized'] = False
 
-            for j, n, in enumerate(all_audio.keys()):
-                k = os.path.splitext(n)[0]
-                if k not in metadata['stems']:
-                    metadata['stems'][k] = {}
-                metadata['stems'][k]['integrated_loudness'] = float(loudnesses[j])
+    all_audio = {p: sf.read(os.path.join(cur_dir, p))[0] for p in os.listdir(cur_dir)
+                 if os.path.splitext(p)[1] == '.wav'}
+    all_audio = collections.OrderedDict(all_audio)
 
-            if np.any(np.isinf(loudnesses)):
-                raise RuntimeError('One or more sources have -inf loudness!')
+    # Stems end with their own patch's tail, pad them all to the longest.
+    num_samples = max(len(a) for a in all_audio.values())
+    all_audio = collections.OrderedDict(
+        (p, np.pad(a, [(0, num_samples - len(a))] + [(0, 0)] * (a.ndim - 1), 'constant'))
+        for p, a in all_audio.items())
+    loudnesses = [meter.integrated_loudness(a) for a in all_audio.values()]
 
-            normalized_audio = {p: pyln.normalize.loudness(a, loudnesses[j], normalization_factor)
-                                for j, (p, a) in enumerate(all_audio.items())}
-            mixture = np.sum(normalized_audio.values(), axis=0)
+    for j, n, in enumerate(all_audio.keys()):
+        k = os.path.splitext(n)[0]
+        if k not in metadata['stems']:
+            metadata['stems'][k] = {}
+        metadata['stems'][k]['integrated_loudness'] = float(loudnesses[j])
 
-            peak = np.max(np.abs(mixture))
-            if peak >= target_gain:
-                gain = target_gain / peak
-                mixture *= gain
+    if np.any(np.isinf(loudnesses)):
+        raise RuntimeError('One or more sources have -inf loudness!')
 
-                if np.any(np.isnan(mixture)):
-                    raise RuntimeError('This mixture contains NaNs!!!')
+    normalized_audio = {p: pyln.normalize.loudness(a, loudnesses[j], normalization_factor)
+                        for j, (p, a) in enumerate(all_audio.items())}
+    mixture = np.sum(normalized_audio.values(), axis=0)
 
-                normalized_audio = {p: a * gain for p, a in normalized_audio.items()}
+    peak = np.max(np.abs(mixture))
+    if peak >= target_gain:
+        gain = target_gain / peak
+        mixture *= gain
 
-                metadata['overall_gain'] = float(gain)
+        if np.any(np.isnan(mixture)):
+            raise RuntimeError('This mixture contains NaNs!!!')
 
-            else:
-                metadata['overall_gain'] = 1.0
+        normalized_audio = {p: a * gain for p, a in normalized_audio.items()}
 
-            _ = [sf.write(os.path.join(cur_dir, p), a, sr) for p, a in normalized_audio.items()]
-            sf.write(mix_output_path, mixture, sr)
+        metadata['overall_gain'] = float(gain)
 
-            metadata['normalization_factor'] = normalization_factor
-            metadata['target_peak'] = target_peak
-            metadata['normalized'] = True
+    else:
+        metadata['overall_gain'] = 1.0
+
+    mix_gains = collections.OrderedDict()
+    for j, n in enumerate(all_audio.keys()):
+        k = os.path.splitext(n)[0]
+        mix_gains[k] = float(np.power(10.0, (normalization_factor - loudnesses[j]) / 20.0)
+                             * metadata['overall_gain'])
+        metadata['stems'][k]['mix_gain'] = mix_gains[k]
+
+    if materialize_mix:
+        _ = [sf.write(os.path.join(cur_dir, p), a, sr) for p, a in normalized_audio.items()]
+        sf.write(mix_output_path, mixture, sr)
+    else:
+        with open(gains_output_path, 'w') as f:
+            json.dump(mix_gains, f, indent=2)
+
+    metadata['normalization_factor'] = normalization_factor
+    metadata['target_peak'] = target_peak
+    metadata['normalized'] = True
+
+    metadata_yaml = yaml.safe_dump(metadata, default_flow_style=False, allow_unicode=True)
+    with open(metadata_path, 'w') as f:
+        f.write(metadata_yaml)
+
+    if pack_stem_container:
+        if materialize_mix:
+            names = ['mix'] + [os.path.splitext(p)[0] for p in normalized_audio.keys()]
+            streams = np.stack([mixture] + list(normalized_audio.values())).astype(np.float32)
+        else:
+            # Untouched stems, the gains in mix_gains.json apply to them.
+            names = [os.path.splitext(p)[0] for p in all_audio.keys()]
+            streams = np.stack(list(all_audio.values())).astype(np.float32)
+        container_path = os.path.join(os.path.dirname(cur_dir), 'stems.slkh')
+        if not rm.write_stem_container(str(container_path), names, streams, sr,
+                                       metadata=metadata_yaml):
+            logger.warning('Could not write {}!'.format(container_path))
+
+
+def run_pipeline(config, midi_paths, inst_classes, defs_dict, band_classes_def=None):
+    """
+    Prepares, renders and mixes tracks as a streaming pipeline instead of one phase after
+    the other. Stems go to the render workers as soon as their track's MIDI is prepared,
+    and a track is mixed as soon as its last stem is rendered. Bounded queues between the
+    stages keep MIDI preparation only as far ahead as rendering can keep up with, and
+    rendering waits for mixing the same way. Stage occupancy is logged every
+    `pipeline_report_interval` seconds.
 
-            with open(metadata_path, 'w') as f:
-                f.write(yaml.safe_dump(metadata, default_flow_style=False, allow_unicode=True))
+    Each render worker keeps one engine loaded and prefers stems for that patch. See
+    `render_sources` for the render settings taken from `config`.
 
-        except Exception as e:
-            logger.warning('Trouble mixing {}. Exception: {} Skipping...'.format(cur_dir,
-                                                                                 e.message))
+    Args:
+        config (dict): The run's config.
+        midi_paths (list): List of paths to MIDI files, in the order they are tried.
+        inst_classes:
+        defs_dict:
+        band_classes_def:
+
+    """
+    sr = config['renderman_sr']
+    max_num_files = config['max_num_files']
+    rerender_existing = config['rerender_existing']
+    zero_based_midi = config['zero_based_midi']
+    pgm0_is_piano = config['render_pgm0_as_piano']
+    features = config.get('renderman_features', None)
+    sleep = config['renderman_sleep']
+    restart_lim = config.get('renderman_restart_lim', 50)
+    memory_budget_mb = config.get('renderman_memory_budget_mb', 0)
+    slowdown_limit = config.get('renderman_slowdown_limit', 0)
+    if config.get('renderman_fork_workers', 0) > 0:
+        # Forking from a process running other threads copies only the forking one.
+        logger.warning('renderman_fork_workers is ignored when pipeline is true.')
+
+    defs_dict = defs_dict if not zero_based_midi else make_zero_based_midi(defs_dict)
+    inv_defs_dict = invert_defs_dict(defs_dict)
+
+    stem_queue = pipeline.AffinityQueue(config.get('pipeline_max_pending_stems', 32))
+    mix_queue = pipeline.AffinityQueue(config.get('pipeline_max_pending_mixes', 4))
+    prep = pipeline.Stage('prep', max(1, config.get('pipeline_prep_workers', 1)))
+    render = pipeline.Stage('render', max(1, config.get('pipeline_render_workers', 1)), stem_queue)
+    mix = pipeline.Stage('mix', max(1, config.get('pipeline_mix_workers', 1)), mix_queue)
+
+    paths = iter(midi_paths)
+    selected = [0]
+    selected_lock = threading.Lock()
+
+    # Stems left to render and the metadata lock of every track in flight.
+    tracks = {}
+    tracks_lock = threading.Lock()
+
+    # Kontakt reads its patch from one shared default .nkm, so only one engine
+    # may be loading at a time, including the sleep while its samples load.
+    # Engines are dropped under it too, so their memory going back is not taken
+    # for growth of the others.
+    load_lock = utils.LoadLock()
+
+    def prep_worker():
+        while True:
+            with selected_lock:
+                path = next(paths, None) if selected[0] < max_num_files else None
+            if path is None:
+                return
+
+            start = prep.start()
+            try:
+                pm = check_midi_file(path, inst_classes, pgm0_is_piano,
+                                     band_classes_def, config['separate_drums'])
+                if not pm:
+                    prep.finish(start)
+                    continue
+
+                with selected_lock:
+                    if selected[0] >= max_num_files:
+                        prep.finish(start)
+                        return
+                    selected[0] += 1
+                    track_num = selected[0]
+
+                logger.info('({}/{}) Selected {}'.format(track_num, max_num_files, path))
+                render_infos = prepare_track(pm, path, track_num, config['output_dir'],
+                                             inst_classes, inv_defs_dict,
+                                             pgm0_is_piano=pgm0_is_piano,
+                                             rerender_existing=rerender_existing,
+                                             zero_based_midi=zero_based_midi)
+            except Exception as e:
+                logger.warning('Trouble preparing {}. Exception: {} Skipping...'.format(path,
+                                                                                    e.message))
+                prep.finish(start, failed=True)
+                continue
+
+            prep.finish(start)
+            if len(render_infos) == 0:
+                continue
+
+            metadata_path = render_infos[0][1]['metadata']
+            with tracks_lock:
+                tracks[metadata_path] = {'remaining': len(render_infos),
+                                         'lock': threading.Lock()}
+
+            for selected_patch, render_info in render_infos:
+                prep.add_blocked(stem_queue.put(selected_patch, render_info))
+
+    def stem_done(metadata_path):
+        with tracks_lock:
+            track = tracks[metadata_path]
+            track['remaining'] -= 1
+            if track['remaining'] > 0:
+                return
+            del tracks[metadata_path]
+
+        audio_dir = os.path.join(os.path.dirname(metadata_path), 'stems')
+        render.add_blocked(mix_queue.put(None, audio_dir))
+
+    def render_worker():
+        eng, eng_patch = None, None
+        recycler = utils.EngineRecycler(memory_budget_mb, slowdown_limit, restart_lim,
+                                        load_lock=load_lock)
+        while True:
+            job = stem_queue.get(eng_patch)
+            if job is None:
+                with load_lock:
+                    eng, eng_patch = None, None
+                break
+
+            patch, render_info_dict, waited = job
+            render.add_starved(waited)
+            start = render.start()
+            failed = False
+            try:
+                if find_rendered_stem(render_info_dict, rerender_existing) is None:
+                    reason = recycler.should_recycle() if patch == eng_patch else None
+                    if reason is not None:
+                        logger.info('Reloading RenderMan engine {}, it {}'.format(patch, reason))
+                    if eng is None or patch != eng_patch or reason is not None:
+                        with load_lock:
+                            eng, eng_patch = None, None
+                            eng = load_render_engine(
+                                patch, sr, config['renderman_buf'], config['kontakt_path'],
+                                config['user_nkms_dir'], config['kontakt_defs_dir'], sleep=0.0,
+                                sample_accurate_midi=config.get('renderman_sample_accurate_midi',
+                                                                False),
+                                features=features,
+                                render_cache=config.get('render_cache', None),
+                                latency_compensation=config.get('renderman_latency_compensation',
+                                                                True),
+                                execution_policy=config.get('renderman_execution_policy', None),
+                                sanitize_midi=config.get('renderman_sanitize_midi', False))
+                            if not patch.startswith('internal:'):
+                                time.sleep(sleep)
+                        recycler.loaded()
+                        eng_patch = patch
+                        logger.info('Loaded RenderMan engine {}'.format(patch))
+
+                    logger.info('Starting Render for {}, Src {}'.format(
+                        render_info_dict['metadata'], render_info_dict['source_key']))
+                    with tracks_lock:
+                        metadata_lock = tracks[render_info_dict['metadata']]['lock']
+                    recycler.rendering()
+                    render_stem(eng, render_info_dict, sr,
+                                min_tail=config.get('renderman_min_tail', 0.5),
+                                max_tail=config.get('renderman_max_tail', 5.0),
+                                features=features, metadata_lock=metadata_lock)
+                    recycler.rendered(eng)
+            except Exception as e:
+                logger.warning("Got exception '{}' when rendering {} with {}. "
+                               "Skipping...".format(e.message, render_info_dict['metadata'], patch))
+                recycler.render_failed()
+                with load_lock:
+                    eng, eng_patch = None, None
+                failed = True
+
+            render.finish(start, failed)
+            stem_done(render_info_dict['metadata'])
+
+    def mix_worker():
+        while True:
+            job = mix_queue.get()
+            if job is None:
+                break
+
+            _, cur_dir, waited = job
+            mix.add_starved(waited)
+            start = mix.start()
+            try:
+                logger.info('Mixing {}'.format(cur_dir))
+                mix_track(cur_dir, sr, config['mix_normalization_factor'],
+                          config['mix_target_peak'], remix_existing=True,
+                          pack_stem_container=config.get('pack_stem_container', False),
+                          materialize_mix=config.get('materialize_mix', True))
+                logger.info('Finished {}'.format(os.path.dirname(cur_dir)))
+                mix.finish(start)
+            except Exception as e:
+                logger.warning('Trouble mixing {}. Exception: {} Skipping...'.format(cur_dir,
+                                                                                     e.message))
+                mix.finish(start, failed=True)
+
+    monitor = pipeline.StageMonitor([prep, render, mix],
+                                    config.get('pipeline_report_interval', 60.0), logger.info)
+    monitor.start()
+
+    prep_threads = pipeline.start_workers(prep_worker, prep.num_workers, 'prep')
+    render_threads = pipeline.start_workers(render_worker, render.num_workers, 'render')
+    mix_threads = pipeline.start_workers(mix_worker, mix.num_workers, 'mix')
+
+    # Each stage ends once the one before it is done and its queue is drained.
+    pipeline.join_workers(prep_threads)
+    stem_queue.close()
+    pipeline.join_workers(render_threads)
+    mix_queue.close()
+    pipeline.join_workers(mix_threads)
+
+    monitor.stop()
+    logger.info('Pipeline finished, {} tracks selected'.format(selected[0]))
 
 
 def run(config_file_path):
@@ -528,41 +1088,59 @@ def run(config_file_path):
     if config['band_definition_file']:
         band_definition = set(json.load(open(config['band_definition_file'], 'r'))['band_def'])
 
-    src_by_inst = prepare_midi(
-        midi_file_paths,
-        max_num_files,
-        output_dir,
-        inst_classes,
-        defs_dict,
-        pgm0_is_piano=config['render_pgm0_as_piano'],
-        band_classes_def=band_definition,
-        rerender_existing=config['rerender_existing'],
-        separate_drums=config['separate_drums'],
-        zero_based_midi=config['zero_based_midi']
-    )
-    logger.info('All done with MIDI ({} secs elapsed). '
-                'Onto RenderMan...'.format(time.time() - start))
-
-    output_dirs = render_sources(
-        src_by_inst,
-        config['renderman_sr'],
-        config['renderman_buf'],
-        config['kontakt_path'],
-        config['user_nkms_dir'],
-        config['kontakt_defs_dir'],
-        sleep=config['renderman_sleep'],
-        rerender_existing=config['rerender_existing']
-    )
-    logger.info('Done with RenderMan ({} secs elapsed). '
-                'Onto mixing...'.format(time.time() - start))
-
-    normalize_and_mix(
-        output_dirs,
-        config['renderman_sr'],
-        config['mix_normalization_factor'],
-        config['mix_target_peak'],
-        remix_existing=True
-    )
+    if config.get('pipeline', False):
+        run_pipeline(config, midi_file_paths, inst_classes, defs_dict,
+                     band_classes_def=band_definition)
+    else:
+        src_by_inst = prepare_midi(
+            midi_file_paths,
+            max_num_files,
+            output_dir,
+            inst_classes,
+            defs_dict,
+            pgm0_is_piano=config['render_pgm0_as_piano'],
+            band_classes_def=band_definition,
+            rerender_existing=config['rerender_existing'],
+            separate_drums=config['separate_drums'],
+            zero_based_midi=config['zero_based_midi']
+        )
+        logger.info('All done with MIDI ({} secs elapsed). '
+                    'Onto RenderMan...'.format(time.time() - start))
+
+        output_dirs = render_sources(
+            src_by_inst,
+            config['renderman_sr'],
+            config['renderman_buf'],
+            config['kontakt_path'],
+            config['user_nkms_dir'],
+            config['kontakt_defs_dir'],
+            sleep=config['renderman_sleep'],
+            restart_lim=config.get('renderman_restart_lim', 50),
+            rerender_existing=config['rerender_existing'],
+            sample_accurate_midi=config.get('renderman_sample_accurate_midi', False),
+            features=config.get('renderman_features', None),
+            render_cache=config.get('render_cache', None),
+            min_tail=config.get('renderman_min_tail', 0.5),
+            max_tail=config.get('renderman_max_tail', 5.0),
+            latency_compensation=config.get('renderman_latency_compensation', True),
+            execution_policy=config.get('renderman_execution_policy', None),
+            sanitize_midi=config.get('renderman_sanitize_midi', False),
+            fork_workers=config.get('renderman_fork_workers', 0),
+            memory_budget_mb=config.get('renderman_memory_budget_mb', 0),
+            slowdown_limit=config.get('renderman_slowdown_limit', 0)
+        )
+        logger.info('Done with RenderMan ({} secs elapsed). '
+                    'Onto mixing...'.format(time.time() - start))
+
+        normalize_and_mix(
+            output_dirs,
+            config['renderman_sr'],
+            config['mix_normalization_factor'],
+            config['mix_target_peak'],
+            remix_existing=True,
+            pack_stem_container=config.get('pack_stem_container', False),
+            materialize_mix=config.get('materialize_mix', True)
+        )
     dur = time.time() - start
     logger.info('Finished {} files in {} seconds'.format(max_num_files, dur))
     logger.info('Output audio is at {}'.format(output_dir))
@@ -4,6 +4,7 @@ import shutil
 import numpy as np
 import time
 import errno
+import threading
 
 sys.path.append(os.path.join('RenderMan-master', 'Builds', 'MacOSX', 'build', 'Debug'))
 
@@ -70,31 +71,30 @@ def select_plugin(engine_dict, inst_class):
     return engine_dict[inst_class].values()[idx], engine_dict[inst_class].keys()[idx]
 
 
-def parse_parameter_names(param_str, program_name):
+def parse_parameter_names(param_info, program_name):
+    """
+    Picks the parameters that belong to the loaded program out of the table
+    returned by `eng.get_parameter_info()`.
+    :param param_info: dict of parameter columns from the engine
+    :param program_name: name of the loaded program
+    :return: dict of parameter index to name without the program suffix
+    """
     result = {}
     suf = ' - ' + program_name
-    for s in param_str.split('\n'):
-        if not s:
-            continue
-
-        # idx, name, text = s.split(', ')
-        idx, name = s.split(', ')
-
+    for idx, name in zip(param_info['index'], param_info['name']):
         if '#' in name or suf not in name:
             # '#' means the parameter is not used and
             # if the suffix is not in the name, then
             # the parameter is for another instrument.
             continue
 
-        idx = int(idx)
-        name = name.rsplit(' - ')[0]  # TODO: use program name suffix
-        result[idx] = name
+        result[int(idx)] = name.rsplit(' - ')[0]  # TODO: use program name suffix
 
     return result
 
 
 def set_parameters(eng):
-    parameter_names = parse_parameter_names(eng.get_plugin_parameters_description(),
+    parameter_names = parse_parameter_names(eng.get_parameter_info(),
                                             eng.get_program_name())
 
     params = {}
@@ -123,7 +123,10 @@ def load_engine(sr, buf, plugin_path, sleep=7.0, verbose=True):
     # Set parameters like so:
     # eng.set_parameter(90, 0.5)
 
-    time.sleep(sleep)
+    # Native instruments (e.g. 'internal:sfz:/path/kit.sfz') are ready as
+    # soon as load_plugin returns.
+    if not str(plugin_path).startswith('internal:'):
+        time.sleep(sleep)
     return eng
 
 
@@ -200,3 +203,177 @@ def file_ready_string(string):
     """
     return string.replace(' ', '_').lower()
 
+
+
+def get_rss_bytes():
+    """
+    Resident set size of this process, read from `/proc/self/statm`.
+    Returns:
+        int: Bytes, or None where there is no `/proc` (e.g. MacOS).
+
+    """
+    try:
+        with open('/proc/self/statm', 'r') as f:
+            return int(f.read().split()[1]) * os.sysconf('SC_PAGE_SIZE')
+    except (IOError, OSError, ValueError, IndexError):
+        return None
+
+
+class EngineRecycler(object):
+    """
+    Decides when a loaded RenderMan engine should be thrown away and loaded again, instead
+    of doing that every so many renders. An engine is recycled when
+
+    - the process has grown by more than `memory_budget_mb` during the engine's own renders
+      since it was loaded (see `rendering`),
+    - its mean block time, averaged over its last `window` renders, has grown to
+      `slowdown_limit` times that of its first `window` renders,
+    - or it has made `max_renders` renders.
+
+    Zero turns a check off. Renders served from the render cache are not timed.
+
+    Args:
+        memory_budget_mb (float): Allowed growth in MB.
+        slowdown_limit (float): Allowed ratio of recent to initial mean block time.
+        max_renders (int): Renders after which the engine is recycled regardless.
+        window (int): Renders averaged for the block timings.
+        load_lock (LoadLock): Shared by every thread of the process that loads, drops or
+            renders with an engine, if there is more than one.
+
+    """
+    def __init__(self, memory_budget_mb=0, slowdown_limit=0, max_renders=0, window=5,
+                 load_lock=None):
+        self.memory_budget = memory_budget_mb * 1024 * 1024
+        self.slowdown_limit = slowdown_limit
+        self.max_renders = max_renders
+        self.window = max(1, window)
+        self.load_lock = load_lock
+        self.loaded()
+
+    def loaded(self):
+        """Call once a new engine is loaded (and has settled), to start measuring from there."""
+        self.grown = 0
+        self.start = None
+        self.renders = 0
+        self.initial_blocks = []
+        self.recent_blocks = []
+
+    def rendering(self):
+        """
+        Call right before each render. The resident size is read here and again in
+        `rendered`, and the difference is the engine's growth for that render. Renders that
+        overlapped another engine's render, load or drop are not counted.
+
+        """
+        if self.load_lock is None:
+            self.start = get_rss_bytes(), True
+        else:
+            self.start = self.load_lock.start_render()
+
+    def rendered(self, eng):
+        """Call after each render with the engine that made it."""
+        self.renders += 1
+        growth = self._finish()
+        if growth is not None:
+            self.grown += growth
+
+        stats = eng.get_render_stats()
+        if eng.was_last_render_cached() or stats['num_blocks'] == 0:
+            return
+
+        if len(self.initial_blocks) < self.window:
+            self.initial_blocks.append(stats['mean_block_seconds'])
+        else:
+            self.recent_blocks = (self.recent_blocks + [stats['mean_block_seconds']])[-self.window:]
+
+    def render_failed(self):
+        """Call instead of `rendered` when a render raised, to end its measurement."""
+        self._finish()
+
+    def _finish(self):
+        if self.start is None:
+            return None
+        start, self.start = self.start, None
+        if self.load_lock is None:
+            rss_before, alone = start
+            rss = get_rss_bytes()
+        else:
+            rss_before, alone, rss = self.load_lock.finish_render(start)
+        if rss is None or rss_before is None or not alone:
+            return None
+        return rss - rss_before
+
+    def growth(self):
+        """Bytes the engine has grown by during its renders since it was loaded."""
+        return self.grown
+
+    def should_recycle(self):
+        """
+        Returns:
+            str: Why the engine should be recycled, or None if it can stay.
+
+        """
+        if 0 < self.max_renders <= self.renders:
+            return 'made {} renders'.format(self.renders)
+
+        if self.memory_budget > 0 and self.growth() > self.memory_budget:
+            return 'grew by {:.0f} MB'.format(self.growth() / (1024.0 * 1024.0))
+
+        if self.slowdown_limit > 0 and len(self.recent_blocks) == self.window:
+            initial = np.mean(self.initial_blocks)
+            recent = np.mean(self.recent_blocks)
+            if initial > 0 and recent > self.slowdown_limit * initial:
+                return 'blocks slowed down {:.1f}x'.format(recent / initial)
+
+        return None
+
+
+class LoadLock(object):
+    """
+    Lock for loading and dropping engines when several threads each have one. It also keeps
+    track of the renders in progress, so `EngineRecycler` only counts memory growth over a
+    render that no other engine's render, load or drop overlapped.
+
+    """
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.events = 0
+        self.rendering = 0
+
+    def __enter__(self):
+        self.lock.acquire()
+        self.events += 1
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.lock.release()
+        return False
+
+    def start_render(self):
+        """
+        Returns:
+            tuple: The measurement to pass to `finish_render`.
+
+        """
+        with self.lock:
+            self.events += 1
+            self.rendering += 1
+            return get_rss_bytes(), self.rendering == 1, self.events
+
+    def finish_render(self, start):
+        """
+        Args:
+            start (tuple): What `start_render` returned for this render.
+
+        Returns:
+            tuple: `get_rss_bytes()` from the start of the render, whether the render ran
+                alone, and `get_rss_bytes()` now.
+
+        """
+        rss_before, alone, events = start
+        with self.lock:
+            alone = alone and self.events == events
+            rss = get_rss_bytes()
+            self.events += 1
+            self.rendering -= 1
+            return rss_before, alone, rss